@@ -0,0 +1,48 @@
+-- Cold-start cost of a script: how long until it first produces output, and what it allocated by then.
+-- Usage: lua bench/coldstart.lua <script.lua> [runs]
+-- Times are the best CPU seconds over all runs; memory is KB allocated with the collector stopped.
+-- The first print/io.write call marks the first instruction of the protected program's own logic.
+
+local bench = dofile((arg[0]:gsub("[^/\\]+$", "harness.lua")))
+bench.usage("<script.lua> [runs]", 1)
+local path, runs = arg[1], tonumber(arg[2]) or 5
+local _, source = bench.compile(path)
+
+local realPrint, realWrite = print, io.write
+local bestLoad, bestFirst, bestTotal, firstMem = math.huge, math.huge, math.huge, 0
+
+for _ = 1, runs do
+    collectgarbage("collect")
+    collectgarbage("stop")
+    local before = collectgarbage("count")
+    local start = os.clock()
+    local first, mem
+
+    local function mark()
+        if not first then
+            first = os.clock() - start
+            mem = collectgarbage("count") - before
+        end
+    end
+    print = function() mark() end
+    io.write = function() mark() return io.stdout end
+
+    local chunk = bench.load(source, "@" .. path)
+    local loaded = os.clock() - start
+    local ok = pcall(chunk)
+    local total = os.clock() - start
+
+    print, io.write = realPrint, realWrite
+    collectgarbage("restart")
+    if not ok then bench.fail(path .. ": run failed") end
+
+    bestLoad = math.min(bestLoad, loaded)
+    bestTotal = math.min(bestTotal, total)
+    if first and first < bestFirst then
+        bestFirst, firstMem = first, mem
+    end
+end
+
+if bestFirst == math.huge then bestFirst = bestTotal end
+print(string.format("%-40s size=%10d  load=%8.4fs  first-output=%8.4fs %8.0fKB  total=%8.4fs",
+    path, #source, bestLoad, bestFirst, firstMem, bestTotal))
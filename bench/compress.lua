@@ -0,0 +1,30 @@
+-- Payload compression per level: size, compressor throughput and the cost of the generated Lua decompressor.
+-- Usage: lua bench/compress.lua <path to obfuscator> <payload file> [target] [runs]
+-- Each level is written with `obfuscator compress`, whose output returns a function running the same decompressor
+-- the VM runtime embeds; the result must match the input byte for byte.
+
+local bench = dofile((arg[0]:gsub("[^/\\]+$", "harness.lua")))
+bench.usage("<path to obfuscator> <payload file> [target] [runs]", 2)
+local obfuscator, input, target, runs = arg[1], arg[2], arg[3] or "lua54", tonumber(arg[4]) or 5
+local output = os.tmpname()
+
+local original = bench.read(input)
+print(string.format("%s, %d bytes, target %s", input:match("[^/\\]+$"), #original, target))
+print(string.format("%-5s %10s %7s %10s %12s %10s", "level", "bytes", "ratio", "pack MB/s", "unpack ms", "unpack MB/s"))
+
+local failures = 0
+for level = 1, 9 do
+    local log = io.popen('"' .. obfuscator .. '" compress "' .. input .. '" "' .. output .. '" --level ' .. level ..
+        ' --target ' .. target .. ' 2>&1'):read("*a")
+    local packed = tonumber(log:match("-> (%d+) bytes"))
+    local throughput = tonumber(log:match("(%d+) MB/s"))
+    local unpack = assert(bench.load(bench.read(output), "=level" .. level))()
+
+    local fastest, result = bench.best(runs, unpack)
+    if result ~= original then failures = failures + 1 end
+
+    print(string.format("%-5d %10d %6.1f%% %10s %12.2f %10.1f%s", level, packed or 0, (packed or 0) / #original * 100,
+        throughput or "?", fastest * 1000, #original / fastest / 1e6, result == original and "" or "  MISMATCH"))
+end
+os.remove(output)
+if failures > 0 then os.exit(1) end
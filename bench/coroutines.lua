@@ -0,0 +1,76 @@
+-- Per-call cost and garbage of the coroutine wrapper emitted by ControlFlow (use_coroutines).
+-- Usage: lua bench/coroutines.lua [calls] [pool size]
+-- Compares the previous wrapper (a new coroutine per call) with the pooled trampoline.
+
+local bench = dofile((arg[0]:gsub("[^/\\]+$", "harness.lua")))
+local calls = tonumber(arg and arg[1]) or 200000
+local poolSize = tonumber(arg and arg[2]) or 8
+
+local function createPerCall(f)
+    return function(...)
+        local co = coroutine.create(f)
+        local success, result
+        repeat
+            success, result = coroutine.resume(co, ...)
+            if not success then
+                error(result)
+            end
+        until coroutine.status(co) == 'dead'
+        return result
+    end
+end
+
+local pooled
+do
+    local create, resume, yield = coroutine.create, coroutine.resume, coroutine.yield
+    local pool, idle, DONE = {}, 0, {}
+
+    local function trampoline(f, ...)
+        return trampoline(yield(DONE, f(...)))
+    end
+
+    local function finish(co, ok, first, ...)
+        if not ok then error(first, 0) end
+        if first ~= DONE then
+            return finish(co, resume(co, yield(first, ...)))
+        end
+        if idle < poolSize then
+            idle = idle + 1
+            pool[idle] = co
+        end
+        return ...
+    end
+
+    pooled = function(f)
+        return function(...)
+            local co = pool[idle]
+            if co then
+                pool[idle] = nil
+                idle = idle - 1
+            else
+                co = create(trampoline)
+            end
+            return finish(co, resume(co, f, ...))
+        end
+    end
+end
+
+local function work(a, b)
+    return a * 3 + b
+end
+
+local function run(name, wrap)
+    local fn = wrap(work)
+    local elapsed, garbage, sum = bench.measure(function()
+        local sum = 0
+        for i = 1, calls do
+            sum = sum + fn(i, 1)
+        end
+        return sum
+    end)
+    print(string.format("%-8s %10d calls  %8.3fs  %8.1f ns/call  %10.0f KB garbage  %6.2f bytes/call  (sum %d)",
+        name, calls, elapsed, elapsed / calls * 1e9, garbage, garbage * 1024 / calls, sum))
+end
+
+run("create", createPerCall)
+run("pooled", pooled)
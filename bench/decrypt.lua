@@ -0,0 +1,43 @@
+-- Pure Lua __decrypt against the obfdecrypt C module on a large payload.
+-- Usage: LUA_CPATH="<build dir>/?.so" lua bench/decrypt.lua <protected.lua> [MB] [runs]
+-- The protected script (any output with --strings or --vm) is run once with the module hidden to obtain the Lua
+-- decryptor emitted for its target; both decryptors then process the same data and must agree byte for byte.
+
+local bench = dofile((arg[0]:gsub("[^/\\]+$", "harness.lua")))
+bench.usage("<protected.lua> [MB] [runs]", 1)
+local protected, megabytes, runs = arg[1], tonumber(arg[2]) or 10, tonumber(arg[3]) or 3
+
+local MODULE = "obfdecrypt"
+
+-- Protected scripts look the module up on package.cpath only, so an empty one hides it
+local cpath = package.cpath
+package.cpath = ""
+bench.quiet(pcall, (bench.compile(protected)))
+package.cpath = cpath
+
+local luaDecrypt = rawget(_G, "__decrypt")
+if type(luaDecrypt) ~= "function" then bench.fail(protected .. " does not define __decrypt") end
+local ok, native = pcall(require, MODULE)
+if not ok then bench.fail("cannot load " .. MODULE .. ": " .. tostring(native)) end
+
+local key, block = {}, {}
+for i = 1, 16 do key[i] = (i * 97 + 13) % 256 end
+for i = 1, 4093 do block[i] = string.char((i * 31 + math.floor(i / 7)) % 256) end
+local unit = table.concat(block)
+local data = string.rep(unit, math.floor(megabytes * 1048576 / #unit) + 1):sub(1, math.floor(megabytes * 1048576))
+
+local luaTime, luaResult = bench.best(runs, luaDecrypt, data, key)
+local nativeTime, nativeResult = bench.best(runs, native.decrypt, data, key)
+
+-- Odd lengths exercise the scalar tail after the vector loop
+local identical = luaResult == nativeResult
+for n = 0, 40 do
+    local piece = data:sub(1, n)
+    identical = identical and luaDecrypt(piece, key) == native.decrypt(piece, key)
+end
+
+print(string.format("%.1f MB payload, %d-byte key", #data / 1048576, #key))
+print(string.format("lua     %8.3fs  %8.1f MB/s", luaTime, #data / luaTime / 1e6))
+print(string.format("native  %8.3fs  %8.1f MB/s", nativeTime, #data / nativeTime / 1e6))
+print(string.format("speedup %8.1fx  identical=%s", luaTime / nativeTime, tostring(identical)))
+if not identical then os.exit(1) end
@@ -0,0 +1,58 @@
+-- Per-step cost of the ControlFlow state dispatcher.
+-- Usage: lua bench/dispatch.lua [states] [steps]
+-- Compares the previous hash-keyed dispatcher (closure call and jump counter per step)
+-- with the dense array dispatcher emitted by ControlFlow::scramble.
+
+local bench = dofile((arg[0]:gsub("[^/\\]+$", "harness.lua")))
+local numStates = tonumber(arg and arg[1]) or 64
+local steps = tonumber(arg and arg[2]) or 2000000
+
+local function hashed()
+    local ids, handlers = {}, {}
+    for i = 1, numStates do ids[i] = 1000 + i * 37 end
+    for i = 1, numStates do
+        local nextState = ids[i % numStates + 1]
+        handlers[ids[i]] = function(__next)
+            return __next(nextState)
+        end
+    end
+    local state, jumps = ids[1], 0
+    local function __next(newState)
+        jumps = jumps + 1
+        if jumps > steps then return false end
+        state = newState
+        return true
+    end
+    while true do
+        if handlers[state] then
+            if not handlers[state](__next) then return jumps end
+        else
+            return jumps
+        end
+    end
+end
+
+local function dense()
+    local handlers, remaining = {}, steps
+    for i = 1, numStates do
+        local nextState = i % numStates + 1
+        handlers[i] = function(result)
+            remaining = remaining - 1
+            if remaining == 0 then return 0, result end
+            return nextState, result
+        end
+    end
+    local state, result = 1, nil
+    repeat
+        state, result = handlers[state](result)
+    until state == 0
+    return steps
+end
+
+local function run(name, fn)
+    local elapsed, count = bench.best(1, fn)
+    print(string.format("%-8s %10d steps  %8.3fs  %8.1f ns/step", name, count, elapsed, elapsed / count * 1e9))
+end
+
+run("hashed", hashed)
+run("dense", dense)
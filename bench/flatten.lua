@@ -0,0 +1,66 @@
+-- Workload for measuring per-function control flow flattening.
+-- Usage: obfuscator obfuscate bench/flatten.lua out.lua --flow
+--        lua bench/harness.lua bench/flatten.lua 5
+--        lua bench/harness.lua out.lua 5
+-- Vary [ControlFlow] flatten_budget to see how each flattening level trades run time.
+
+local function classify(n)
+    local kind
+    if n % 15 == 0 then
+        kind = 3
+    elseif n % 5 == 0 then
+        kind = 2
+    elseif n % 3 == 0 then
+        kind = 1
+    else
+        kind = 0
+    end
+    return kind
+end
+
+local function gcd(a, b)
+    while b ~= 0 do
+        local t = b
+        b = a % b
+        a = t
+    end
+    return a
+end
+
+local function collatz(n)
+    local steps = 0
+    while n ~= 1 do
+        if n % 2 == 0 then
+            n = n / 2
+        else
+            n = 3 * n + 1
+        end
+        steps = steps + 1
+    end
+    return steps
+end
+
+local function sum(t)
+    local total = 0
+    for i = 1, #t do
+        total = total + t[i]
+    end
+    return total
+end
+
+local values = {}
+for i = 1, 1000 do
+    values[i] = i % 17
+end
+
+local checksum = 0
+for i = 1, 200000 do
+    checksum = checksum + classify(i) + gcd(i, 360)
+end
+for i = 1, 20000 do
+    checksum = checksum + collatz(i)
+end
+for i = 1, 500 do
+    checksum = checksum + sum(values)
+end
+return checksum
@@ -0,0 +1,45 @@
+-- Global-heavy workload for bench/interpreter.lua: cheap library calls (math.*, string.*, type) in hot loops,
+-- so the cost of resolving the globals themselves dominates.
+-- Usage: lua bench/globals.lua [iterations]
+
+local iterations = tonumber(arg and arg[1]) or 1000000
+
+local function checksum(text)
+    local sum = 0
+    for i = 1, #text do
+        sum = (sum * 31 + string.byte(text, i)) % 1000003
+    end
+    return sum
+end
+
+local function clamp(n)
+    local total = 0
+    for i = 1, n do
+        total = total + math.max(math.min(i % 13, 9), 2) + math.abs(5 - i % 11)
+    end
+    return total
+end
+
+local function kinds(n)
+    local values = {1, "a", true, 2.5}
+    local numbers = 0
+    for i = 1, n do
+        if type(values[i % 4 + 1]) == "number" then
+            numbers = numbers + 1
+        end
+    end
+    return numbers
+end
+
+local function lengths(n)
+    local total = 0
+    for i = 1, n do
+        total = total + select("#", i, i) + string.len("abc")
+    end
+    return total
+end
+
+print(checksum(string.rep("obfuscator", iterations // 10)))
+print(clamp(iterations))
+print(kinds(iterations))
+print(lengths(iterations))
@@ -0,0 +1,93 @@
+-- Shared file, timing and usage helpers for the bench scripts, which load it from their own directory with
+--     local bench = dofile((arg[0]:gsub("[^/\\]+$", "harness.lua")))
+-- Run directly it reports the load/run cost of a Lua script, for comparing original and protected builds.
+-- Usage: lua bench/harness.lua <script.lua> [runs]
+-- Times are CPU seconds; memory is KB allocated with the collector stopped.
+
+local bench = {}
+
+bench.load = loadstring or load
+
+function bench.fail(message)
+    io.stderr:write(message, "\n")
+    os.exit(1)
+end
+
+-- Exits with the usage line unless the first `required` arguments are given
+function bench.usage(text, required)
+    for i = 1, required or 0 do
+        if not arg[i] then bench.fail("usage: lua " .. arg[0] .. " " .. text) end
+    end
+end
+
+function bench.read(path)
+    local file = assert(io.open(path, "rb"))
+    local data = file:read("*a")
+    file:close()
+    return data
+end
+
+-- The chunk of the script at `path` and its source; a script that does not load ends the benchmark
+function bench.compile(path)
+    local source = bench.read(path)
+    local chunk, err = bench.load(source, "@" .. path)
+    if not chunk then bench.fail("load failed: " .. tostring(err)) end
+    return chunk, source
+end
+
+-- Runs fn with print silenced, so timed scripts do not time the terminal
+function bench.quiet(fn, ...)
+    local realPrint = print
+    print = function() end
+    local results = {pcall(fn, ...)}
+    print = realPrint
+    if not results[1] then error(results[2], 0) end
+    return (table.unpack or unpack)(results, 2)
+end
+
+-- Best CPU seconds of fn(...) over `runs` calls, each after a full collection, and what the last call returned
+function bench.best(runs, fn, ...)
+    local fastest, result = math.huge, nil
+    for _ = 1, runs do
+        result = nil
+        collectgarbage("collect")
+        local start = os.clock()
+        result = fn(...)
+        local elapsed = os.clock() - start
+        if elapsed < fastest then fastest = elapsed end
+    end
+    return fastest, result
+end
+
+-- CPU seconds and KB allocated by one call of fn with the collector stopped, then its first two results
+function bench.measure(fn, ...)
+    collectgarbage("collect")
+    collectgarbage("stop")
+    local before = collectgarbage("count")
+    local start = os.clock()
+    local result, err = fn(...)
+    local elapsed = os.clock() - start
+    local allocated = collectgarbage("count") - before
+    collectgarbage("restart")
+    return elapsed, allocated, result, err
+end
+
+if not (arg and arg[0] and arg[0]:match("harness%.lua$")) then
+    return bench
+end
+
+bench.usage("<script.lua> [runs]", 1)
+local path, runs = arg[1], tonumber(arg[2]) or 1
+local _, source = bench.compile(path)
+
+local loadTime, loadMem = bench.measure(bench.load, source, "@" .. path)
+
+local runTime, runMem = 0, 0
+for _ = 1, runs do
+    local elapsed, allocated = bench.measure(bench.load(source, "@" .. path))
+    runTime = runTime + elapsed
+    runMem = runMem + allocated
+end
+
+print(string.format("%-40s size=%10d  load=%8.3fs %10.0fKB  run=%8.3fs %10.0fKB",
+    path, #source, loadTime, loadMem, runTime / runs, runMem / runs))
@@ -0,0 +1,20 @@
+-- Run time of a script natively and under the bytecode interpreter (obfuscator --vm).
+-- Usage: lua bench/interpreter.lua <original.lua> <protected.lua> [runs]
+-- Times are the best CPU seconds over all runs; print() is silenced while timing.
+
+local bench = dofile((arg[0]:gsub("[^/\\]+$", "harness.lua")))
+bench.usage("<original.lua> <protected.lua> [runs]", 2)
+local original, protected, runs = arg[1], arg[2], tonumber(arg[3]) or 3
+
+local function best(path)
+    local chunk = bench.compile(path)
+    return bench.quiet(bench.best, runs, function()
+        local ok, err = pcall(chunk)
+        if not ok then bench.fail(path .. ": " .. tostring(err)) end
+    end)
+end
+
+local native = best(original)
+local vm = best(protected)
+
+print(string.format("native=%8.3fs  vm=%8.3fs  slowdown=%6.2fx", native, vm, vm / native))
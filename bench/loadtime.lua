@@ -0,0 +1,42 @@
+-- Load cost of protected scripts written as source or as binary chunks (obfuscator --bytecode).
+-- Usage: lua bench/loadtime.lua <file> [file...]
+-- For each file: size, best load() time over 20 runs and the memory the loaded chunk keeps. Source files get a
+-- second row for the same program dumped as a stripped binary chunk, which is what --bytecode writes.
+
+local bench = dofile((arg[0]:gsub("[^/\\]+$", "harness.lua")))
+bench.usage("<file> [file...]", 1)
+local runs = 20
+
+local function measure(data, name)
+    local chunk, err = bench.load(data, "=" .. name)
+    if not chunk then bench.fail(name .. ": " .. tostring(err)) end
+    local fastest = bench.best(runs, bench.load, data, "=" .. name)
+
+    chunk = nil
+    collectgarbage("collect")
+    local before = collectgarbage("count")
+    chunk = bench.load(data, "=" .. name)
+    collectgarbage("collect")
+    local kept = collectgarbage("count") - before
+    return fastest, kept, chunk
+end
+
+local function report(name, kind, data, seconds, kept)
+    print(string.format("%-28s %-7s %10d bytes  %9.3f ms  %9.1f KB", name, kind, #data, seconds * 1000, kept))
+end
+
+for i = 1, #arg do
+    local path = arg[i]
+    local data = bench.read(path)
+    local name = path:match("[^/\\]+$")
+    local binary = data:sub(1, 1) == "\27"
+    local seconds, kept, chunk = measure(data, name)
+    report(name, binary and "binary" or "source", data, seconds, kept)
+
+    if not binary and string.dump then
+        local ok, dumped = pcall(string.dump, chunk, true)
+        if ok then
+            report(name, "dumped", dumped, measure(dumped, name))
+        end
+    end
+end
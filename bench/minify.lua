@@ -0,0 +1,44 @@
+-- Size reduction and throughput of `obfuscator minify` over a corpus, checking each result still behaves the same.
+-- Usage: lua bench/minify.lua <path to obfuscator> <file.lua> [file.lua...]
+-- Each file is minified, then the original and minified chunks are run with print captured; outputs must match.
+
+local bench = dofile((arg[0]:gsub("[^/\\]+$", "harness.lua")))
+bench.usage("<path to obfuscator> <file.lua> [file.lua...]", 2)
+local obfuscator = arg[1]
+local output = os.tmpname()
+
+-- Printed output of a chunk, or its error
+local function run(source, name)
+    local chunk, err = bench.load(source, "=" .. name)
+    if not chunk then return "load error: " .. tostring(err) end
+    local lines, realPrint = {}, print
+    print = function(...)
+        local parts = {...}
+        for i = 1, select("#", ...) do parts[i] = tostring(parts[i]) end
+        lines[#lines + 1] = table.concat(parts, "\t")
+    end
+    local ok, runErr = pcall(chunk)
+    print = realPrint
+    if not ok then lines[#lines + 1] = "error: " .. tostring(runErr):gsub("^[^:]*:%d+: ", "") end
+    return table.concat(lines, "\n")
+end
+
+local totalIn, totalOut, totalSeconds, failures = 0, 0, 0, 0
+for i = 2, #arg do
+    local path = arg[i]
+    local log = io.popen('"' .. obfuscator .. '" minify "' .. path .. '" "' .. output .. '" 2>&1'):read("*a")
+    local ms = tonumber(log:match("in ([%d%.]+) ms"))
+    local original, minified = bench.read(path), bench.read(output)
+    local same = run(original, path) == run(minified, path)
+    if not same then failures = failures + 1 end
+
+    totalIn, totalOut = totalIn + #original, totalOut + #minified
+    totalSeconds = totalSeconds + (ms or 0) / 1000
+    print(string.format("%-40s %9d -> %9d bytes  %5.1f%%  %s", path:match("[^/\\]+$"), #original, #minified,
+        (1 - #minified / #original) * 100, same and "same output" or "OUTPUT DIFFERS"))
+end
+os.remove(output)
+
+print(string.format("total %d -> %d bytes (%.1f%% smaller), %.1f MB/s, %d mismatches",
+    totalIn, totalOut, (1 - totalOut / totalIn) * 100, totalSeconds > 0 and totalIn / totalSeconds / 1e6 or 0, failures))
+if failures > 0 then os.exit(1) end
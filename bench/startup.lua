@@ -0,0 +1,287 @@
+-- Startup workload for bench/coldstart.lua: a utility library of which a typical run touches little.
+-- Usage: lua bench/startup.lua [full]
+-- Without arguments only the banner and one small helper run; "full" exercises every function.
+
+local util = {}
+
+function util.trim(s)
+    return (s:gsub("^%s+", ""):gsub("%s+$", ""))
+end
+
+function util.split(s, sep)
+    local parts, start = {}, 1
+    while true do
+        local i, j = s:find(sep, start, true)
+        if not i then
+            parts[#parts + 1] = s:sub(start)
+            return parts
+        end
+        parts[#parts + 1] = s:sub(start, i - 1)
+        start = j + 1
+    end
+end
+
+function util.pad(s, width, fill)
+    fill = fill or " "
+    while #s < width do
+        s = fill .. s
+    end
+    return s
+end
+
+function util.escape(s)
+    local replacements = {["\""] = "\\\"", ["\\"] = "\\\\", ["\n"] = "\\n", ["\r"] = "\\r", ["\t"] = "\\t"}
+    return (s:gsub("[\"\\\n\r\t]", replacements))
+end
+
+function util.encode(value, indent, depth)
+    depth = depth or 0
+    local kind = type(value)
+    if kind == "nil" then
+        return "null"
+    elseif kind == "boolean" or kind == "number" then
+        return tostring(value)
+    elseif kind == "string" then
+        return "\"" .. util.escape(value) .. "\""
+    elseif kind == "table" then
+        local isArray = #value > 0
+        local items = {}
+        if isArray then
+            for i = 1, #value do
+                items[i] = util.encode(value[i], indent, depth + 1)
+            end
+            return "[" .. table.concat(items, ",") .. "]"
+        end
+        local keys = {}
+        for k in pairs(value) do
+            keys[#keys + 1] = tostring(k)
+        end
+        table.sort(keys)
+        for i, k in ipairs(keys) do
+            items[i] = "\"" .. util.escape(k) .. "\":" .. util.encode(value[k], indent, depth + 1)
+        end
+        return "{" .. table.concat(items, ",") .. "}"
+    end
+    error("cannot encode " .. kind)
+end
+
+function util.decode(text)
+    local pos = 1
+    local parseValue
+
+    local function skip()
+        pos = text:find("[^ \t\r\n]", pos) or #text + 1
+    end
+
+    local function parseString()
+        local out = {}
+        pos = pos + 1
+        while true do
+            local c = text:sub(pos, pos)
+            if c == "\"" then
+                pos = pos + 1
+                return table.concat(out)
+            elseif c == "\\" then
+                local n = text:sub(pos + 1, pos + 1)
+                local map = {n = "\n", r = "\r", t = "\t"}
+                out[#out + 1] = map[n] or n
+                pos = pos + 2
+            elseif c == "" then
+                error("unterminated string")
+            else
+                out[#out + 1] = c
+                pos = pos + 1
+            end
+        end
+    end
+
+    function parseValue()
+        skip()
+        local c = text:sub(pos, pos)
+        if c == "{" then
+            local result = {}
+            pos = pos + 1
+            skip()
+            if text:sub(pos, pos) == "}" then
+                pos = pos + 1
+                return result
+            end
+            while true do
+                skip()
+                local key = parseString()
+                skip()
+                pos = pos + 1
+                result[key] = parseValue()
+                skip()
+                local sep = text:sub(pos, pos)
+                pos = pos + 1
+                if sep == "}" then return result end
+            end
+        elseif c == "[" then
+            local result = {}
+            pos = pos + 1
+            skip()
+            if text:sub(pos, pos) == "]" then
+                pos = pos + 1
+                return result
+            end
+            while true do
+                result[#result + 1] = parseValue()
+                skip()
+                local sep = text:sub(pos, pos)
+                pos = pos + 1
+                if sep == "]" then return result end
+            end
+        elseif c == "\"" then
+            return parseString()
+        elseif text:sub(pos, pos + 3) == "true" then
+            pos = pos + 4
+            return true
+        elseif text:sub(pos, pos + 4) == "false" then
+            pos = pos + 5
+            return false
+        elseif text:sub(pos, pos + 3) == "null" then
+            pos = pos + 4
+            return nil
+        end
+        local number = text:match("^-?%d+%.?%d*[eE]?[-+]?%d*", pos)
+        pos = pos + #number
+        return tonumber(number)
+    end
+
+    return parseValue()
+end
+
+function util.base64(s)
+    local alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"
+    local out = {}
+    for i = 1, #s, 3 do
+        local a, b, c = s:byte(i, i + 2)
+        local n = a * 65536 + (b or 0) * 256 + (c or 0)
+        local chars = {}
+        for j = 4, 1, -1 do
+            local index = n % 64
+            chars[j] = alphabet:sub(index + 1, index + 1)
+            n = (n - index) / 64
+        end
+        if not b then chars[3] = "=" end
+        if not c then chars[4] = "=" end
+        out[#out + 1] = table.concat(chars)
+    end
+    return table.concat(out)
+end
+
+function util.sort(list, less)
+    less = less or function(a, b) return a < b end
+    local function merge(lo, mid, hi)
+        local left, right = {}, {}
+        for i = lo, mid do left[#left + 1] = list[i] end
+        for i = mid + 1, hi do right[#right + 1] = list[i] end
+        local i, j, k = 1, 1, lo
+        while i <= #left and j <= #right do
+            if less(right[j], left[i]) then
+                list[k] = right[j]
+                j = j + 1
+            else
+                list[k] = left[i]
+                i = i + 1
+            end
+            k = k + 1
+        end
+        while i <= #left do
+            list[k] = left[i]
+            i, k = i + 1, k + 1
+        end
+        while j <= #right do
+            list[k] = right[j]
+            j, k = j + 1, k + 1
+        end
+    end
+    local function sort(lo, hi)
+        if lo >= hi then return end
+        local mid = (lo + hi) // 2
+        sort(lo, mid)
+        sort(mid + 1, hi)
+        merge(lo, mid, hi)
+    end
+    sort(1, #list)
+    return list
+end
+
+function util.matrix(rows, cols, fill)
+    local m = {}
+    for i = 1, rows do
+        m[i] = {}
+        for j = 1, cols do
+            m[i][j] = fill and fill(i, j) or 0
+        end
+    end
+    return m
+end
+
+function util.multiply(a, b)
+    local result = util.matrix(#a, #b[1])
+    for i = 1, #a do
+        for j = 1, #b[1] do
+            local sum = 0
+            for k = 1, #b do
+                sum = sum + a[i][k] * b[k][j]
+            end
+            result[i][j] = sum
+        end
+    end
+    return result
+end
+
+function util.queue()
+    local first, last, items = 1, 0, {}
+    local q = {}
+    function q.push(v)
+        last = last + 1
+        items[last] = v
+    end
+    function q.pop()
+        if first > last then return nil end
+        local v = items[first]
+        items[first] = nil
+        first = first + 1
+        return v
+    end
+    function q.size()
+        return last - first + 1
+    end
+    return q
+end
+
+function util.shortestPath(graph, from, to)
+    local dist, q = {[from] = 0}, util.queue()
+    q.push(from)
+    while q.size() > 0 do
+        local node = q.pop()
+        if node == to then return dist[node] end
+        for _, nxt in ipairs(graph[node] or {}) do
+            if not dist[nxt] then
+                dist[nxt] = dist[node] + 1
+                q.push(nxt)
+            end
+        end
+    end
+    return nil
+end
+
+function util.banner(name)
+    return "[" .. util.pad(name, 10, ".") .. "]"
+end
+
+print(util.banner("startup"))
+
+if arg and arg[1] == "full" then
+    print(util.trim("  spaced  "), #util.split("a,b,c,d", ","))
+    local text = util.encode({name = "obf", list = {1, 2, 3}, nested = {flag = true}})
+    print(text, util.decode(text).nested.flag)
+    print(util.base64("obfuscator"))
+    print(table.concat(util.sort({5, 3, 9, 1, 7}), " "))
+    local m = util.multiply(util.matrix(3, 3, function(i, j) return i + j end), util.matrix(3, 3, function(i, j) return i == j and 1 or 0 end))
+    print(m[2][3])
+    print(util.shortestPath({a = {"b", "c"}, b = {"d"}, c = {"d"}, d = {"e"}}, "a", "e"))
+end
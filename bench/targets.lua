@@ -0,0 +1,83 @@
+-- Overhead of a protected script on the runtime it was built for (obfuscator --target).
+-- Usage: <lua|luajit> bench/targets.lua <original.lua> <protected.lua> [runs]
+-- Reports best CPU seconds for both scripts and the throughput of the emitted __decrypt. Under LuaJIT it also
+-- counts the traces each script completes and aborts, with the abort reasons, to show hot paths stay compiled.
+
+local bench = dofile((arg[0]:gsub("[^/\\]+$", "harness.lua")))
+bench.usage("<original.lua> <protected.lua> [runs]", 2)
+local original, protected, runs = arg[1], arg[2], tonumber(arg[3]) or 3
+
+local jit = rawget(_G, "jit")
+local ok, vmdef = pcall(require, "jit.vmdef")
+local traceErrors = ok and vmdef.traceerr or {}
+
+-- Trace events from the JIT compiler while `fn` runs; nil when not running under LuaJIT
+local function traces(fn)
+    if not (jit and jit.attach) then
+        fn()
+        return nil
+    end
+    local stats = {started = 0, completed = 0, aborted = 0, reasons = {}}
+    local function onTrace(what, tr, func, pc, otr, oex)
+        if what == "start" then
+            stats.started = stats.started + 1
+        elseif what == "stop" then
+            stats.completed = stats.completed + 1
+        elseif what == "abort" then
+            stats.aborted = stats.aborted + 1
+            local reason = traceErrors[otr] and string.format(traceErrors[otr], oex) or tostring(otr)
+            stats.reasons[reason] = (stats.reasons[reason] or 0) + 1
+        end
+    end
+    jit.flush()
+    jit.attach(onTrace, "trace")
+    fn()
+    jit.attach(onTrace)
+    return stats
+end
+
+local function best(path)
+    local chunk = bench.compile(path)
+    local fastest
+    local stats = bench.quiet(traces, function()
+        fastest = bench.best(runs, function()
+            local ok, err = pcall(chunk)
+            if not ok then bench.fail(path .. ": " .. tostring(err)) end
+        end)
+    end)
+    return fastest, stats
+end
+
+local function report(name, seconds, stats)
+    local line = string.format("%-9s %8.3fs", name, seconds)
+    if stats then
+        line = line .. string.format("  traces: %d completed, %d aborted", stats.completed, stats.aborted)
+        for reason, count in pairs(stats.reasons) do
+            line = line .. string.format("\n          abort x%-4d %s", count, reason)
+        end
+    end
+    print(line)
+end
+
+local native, nativeStats = best(original)
+local protectedTime, protectedStats = best(protected)
+
+print("runtime   " .. (jit and jit.version or _VERSION))
+report("native", native, nativeStats)
+report("protected", protectedTime, protectedStats)
+print(string.format("slowdown  %8.2fx", protectedTime / native))
+
+-- The decryptor is left as a global by string encryption; time it on 1 MB with a 32-byte key
+local decrypt = rawget(_G, "__decrypt")
+if decrypt then
+    local key, bytes = {}, {}
+    for i = 1, 32 do key[i] = (i * 37) % 256 end
+    for i = 1, 1024 do bytes[i] = string.char((i * 13) % 256) end
+    local data = string.rep(table.concat(bytes), 1024)
+    decrypt(data, key)
+    local start = os.clock()
+    local stats = traces(function() decrypt(data, key) end)
+    local elapsed = os.clock() - start
+    report("decrypt", elapsed, stats)
+    print(string.format("          %8.1f MB/s", #data / elapsed / 1e6))
+end
@@ -0,0 +1,117 @@
+// Native counterpart of the generated __decrypt: obfdecrypt.decrypt(str, key) undoes PayloadEncoder::encrypt
+// (byte ^ key, rotate left 3) and returns exactly what the pure Lua decryptor returns.
+#include <lua.h>
+#include <lauxlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OBF_SSE2 1
+#endif
+
+#if defined(_WIN32)
+#define OBF_EXPORT __declspec(dllexport)
+#else
+#define OBF_EXPORT __attribute__((visibility("default")))
+#endif
+
+#if LUA_VERSION_NUM >= 502
+#define obf_rawlen lua_rawlen
+#else
+#define obf_rawlen lua_objlen
+#endif
+
+#define MAX_KEY 256
+// The key stream repeats the key this many times, so its length is a multiple of the vector width
+#define LANES 16
+
+static unsigned char rotr3(unsigned char b) {
+    return (unsigned char)((b >> 3) | (b << 5));
+}
+
+// `offset` is the position of in[0] in the whole string; the stream holds LANES bytes past `period` for vectors
+// that start near its end
+static void decrypt(const unsigned char* in, unsigned char* out, size_t n, const unsigned char* stream, size_t period,
+                    size_t offset) {
+    size_t i = 0, s = offset % period;
+
+#if defined(OBF_SSE2)
+    // No 8-bit shifts in SSE2: shift 16-bit lanes and mask off the bits that crossed into the neighbour byte
+    const __m128i low = _mm_set1_epi8(0x1F);
+    const __m128i high = _mm_set1_epi8((char)0xE0);
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i k = _mm_loadu_si128((const __m128i*)(stream + s));
+        __m128i r = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 3), low), _mm_and_si128(_mm_slli_epi16(x, 5), high));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(r, k));
+        s += 16;
+        if (s >= period) s -= period;
+    }
+#else
+    // Portable fallback: the same masks on eight bytes at a time
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x, k, r;
+        memcpy(&x, in + i, 8);
+        memcpy(&k, stream + s, 8);
+        r = ((x >> 3) & 0x1F1F1F1F1F1F1F1FULL) | ((x << 5) & 0xE0E0E0E0E0E0E0E0ULL);
+        r ^= k;
+        memcpy(out + i, &r, 8);
+        s += 8;
+        if (s >= period) s -= period;
+    }
+#endif
+
+    for (; i < n; ++i, ++s) {
+        out[i] = rotr3(in[i]) ^ stream[s];
+    }
+}
+
+static int l_decrypt(lua_State* L) {
+    size_t n, keyLen, i;
+    const char* str;
+    unsigned char key[MAX_KEY];
+    unsigned char stream[MAX_KEY * LANES + LANES];
+    luaL_Buffer b;
+
+    // Same contract as the Lua version: anything but a non-empty string decrypts to ""
+    if (lua_type(L, 1) != LUA_TSTRING) {
+        lua_pushliteral(L, "");
+        return 1;
+    }
+    str = lua_tolstring(L, 1, &n);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    keyLen = obf_rawlen(L, 2);
+    luaL_argcheck(L, keyLen > 0 && keyLen <= MAX_KEY, 2, "key must have 1-256 bytes");
+
+    for (i = 0; i < keyLen; ++i) {
+        lua_rawgeti(L, 2, (int)i + 1);
+        key[i] = (unsigned char)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+    }
+    for (i = 0; i < keyLen * LANES + LANES; ++i) {
+        stream[i] = key[i % keyLen];
+    }
+
+    // Decrypt straight into the result string's buffer
+#if LUA_VERSION_NUM >= 502
+    decrypt((const unsigned char*)str, (unsigned char*)luaL_buffinitsize(L, &b, n), n, stream, keyLen * LANES, 0);
+    luaL_pushresultsize(&b, n);
+#else
+    luaL_buffinit(L, &b);
+    for (i = 0; i < n; i += LUAL_BUFFERSIZE) {
+        size_t len = n - i < LUAL_BUFFERSIZE ? n - i : LUAL_BUFFERSIZE;
+        decrypt((const unsigned char*)str + i, (unsigned char*)luaL_prepbuffer(&b), len, stream, keyLen * LANES, i);
+        luaL_addsize(&b, len);
+    }
+    luaL_pushresult(&b);
+#endif
+    return 1;
+}
+
+OBF_EXPORT int luaopen_obfdecrypt(lua_State* L) {
+    lua_createtable(L, 0, 1);
+    lua_pushcfunction(L, l_decrypt);
+    lua_setfield(L, -2, "decrypt");
+    return 1;
+}
@@ -3,9 +3,17 @@
 #include "components/protections/VMProtection.hpp"
 #include "components/protections/JunkCode.hpp"
 #include "components/protections/Compression.hpp"
+#include "components/protections/ControlFlow.hpp"
 #include <fstream>
 #include <sstream>
+#include <stdexcept>
 #include "components/Logger.hpp"
+#include "components/Target.hpp"
+#include "components/BinaryChunk.hpp"
+#include "components/PayloadCompressor.hpp"
+#include "components/PayloadEncoder.hpp"
+#include "components/Profile.hpp"
+#include "components/Annotations.hpp"
 
 LuaObfuscator::LuaObfuscator() : gen(rd()), ARRAY_CHUNK_SIZE(20) {
     generateEncryptionKey();
@@ -40,53 +48,110 @@ bool LuaObfuscator::loadFile(const std::string& filename) {
 }
 
 bool LuaObfuscator::saveToFile(const std::string& filename) {
-    std::ofstream file(filename);
+    std::ofstream file(filename, std::ios::binary);
     if (!file.is_open()) return false;
     
     file << sourceCode;
     return true;
 }
 
-void LuaObfuscator::obfuscate(bool useStrings, bool useJunk, bool useVM) {
+void LuaObfuscator::resolveProtections(bool& useStrings, bool& useJunk, bool& useVM, bool& useFlow) const {
+    // Override configuration if --all flag is used
+    if (useStrings) {
+        Logger::debug("Overriding config: Enabling string encryption");
+    } else {
+        useStrings = config.getBoolValue("Strings", "enabled", false);
+    }
+
+    if (useJunk) {
+        Logger::debug("Overriding config: Enabling junk code generation");
+    } else {
+        useJunk = config.getBoolValue("Junk", "enabled", false);
+    }
+
+    if (useVM) {
+        Logger::debug("Overriding config: Enabling VM protection");
+    } else {
+        useVM = config.getBoolValue("VM", "enabled", false);
+    }
+
+    if (useFlow) {
+        Logger::debug("Overriding config: Enabling control flow flattening");
+    } else {
+        useFlow = config.getBoolValue("ControlFlow", "enabled", false);
+    }
+}
+
+void LuaObfuscator::obfuscate(bool useStrings, bool useJunk, bool useVM, bool useFlow) {
     try {
-        // Override configuration if --all flag is used
-        if (useStrings) {
-            Logger::debug("Overriding config: Enabling string encryption");
-        } else {
-            useStrings = config.getBoolValue("Strings", "enabled", false);
-        }
+        resolveProtections(useStrings, useJunk, useVM, useFlow);
+
+        Target::Kind target = Target::fromName(config.getValue("Output", "target", "lua54"));
+        Logger::info("Target runtime: " + Target::name(target));
+        const std::string original = sourceCode;
+
+        // Profile lines refer to the original source, so hot functions are marked before anything rewrites it
+        Profile::apply(sourceCode, config, target);
+
+        // --@obf:max code gets every protection, also the ones the config leaves off
+        Annotations::Coverage tiers = Annotations::apply(sourceCode, target);
+        bool maxTier = tiers.any(Annotations::Tier::Max);
 
-        if (useJunk) {
-            Logger::debug("Overriding config: Enabling junk code generation");
-        } else {
-            useJunk = config.getBoolValue("Junk", "enabled", false);
+        // The settings every pass below reads are fitted to [CostModel] max_slowdown
+        CostModel::fit(sourceCode, original, config, {useStrings, useFlow, useJunk, useVM}, target);
+
+        // Folding first leaves less code for every protection below to process
+        if (Compression::fromConfig(config).foldConstants) {
+            Logger::debug("Folding constants...");
+            sourceCode = Compression::optimizeAst(sourceCode, target);
         }
 
-        if (useVM) {
-            Logger::debug("Overriding config: Enabling VM protection");
-        } else {
-            useVM = config.getBoolValue("VM", "enabled", false);
+        // Flattening needs the original source, so it runs before anything rewrites it as text
+        if (useFlow || maxTier) {
+            Logger::debug("Flattening control flow...");
+            ControlFlow::flatten(sourceCode, config, target, !useFlow);
         }
 
-        if (useStrings) {
+        if (useStrings || maxTier) {
             size_t chunkSize = config.getIntValue("Encryption", "chunk_size", 20);
-            StringEncryption::processString(sourceCode, key, chunkSize);
+            bool hoistLoops = config.getBoolValue("Strings", "hoist_loops", true);
+            std::string nativeModule = config.getValue("Encryption", "native_module", "");
+            StringEncryption::processString(sourceCode, key, chunkSize, target, nativeModule, hoistLoops, !useStrings);
         }
 
-        if (useJunk) {
+        if (useJunk || maxTier) {
             Logger::debug("Adding junk code...");
-            int junkCount = config.getIntValue("Junk", "junk_count", 3);
-            std::string junkCode = JunkCode::generate(junkCount);
-            size_t insertPos = sourceCode.find("\n");
-            if (insertPos != std::string::npos) {
-                sourceCode.insert(insertPos + 1, junkCode);
-            }
+            JunkCode::insert(sourceCode, config.getIntValue("Junk", "junk_count", 3), config.getIntValue("Junk", "budget_percent", 10), target, !useJunk);
         }
 
-        if (useVM) {
+        // Without [VM], max functions still get the interpreter and everything else runs natively, which needs load()
+        bool vmForMax = !useVM && maxTier && Target::hasLoad(target);
+        if (!useVM && maxTier && !vmForMax) {
+            Logger::warning("--@obf:max functions stay outside the VM: " + Target::name(target) + " cannot run the rest natively");
+        }
+        if (useVM || vmForMax) {
             Logger::debug("Applying VM protection...");
             size_t codeChunkSize = config.getIntValue("VM", "code_chunk_size", 100);
-            sourceCode = VMProtection::wrapCode(sourceCode, key, codeChunkSize, config);
+            sourceCode = VMProtection::wrapCode(sourceCode, key, codeChunkSize, config, &payloadStats, vmForMax);
+        }
+
+        // The VM was the last pass to read the tiers
+        Annotations::strip(sourceCode, target);
+
+        // Runs last so it also strips the generated wrappers
+        sourceCode = Compression::compress(sourceCode, config, target, &minifyStats);
+
+        // Binary chunks skip the parser on the client, which matters for the large generated wrappers
+        if (config.getValue("Output", "format", "source") == "bytecode") {
+            bool strip = config.getBoolValue("Output", "strip_debug", true);
+            try {
+                size_t sourceSize = sourceCode.length();
+                sourceCode = BinaryChunk::compile(sourceCode, target, strip);
+                Logger::info("Compiled to a " + BinaryChunk::runtime() + " binary chunk" + (strip ? " without debug info" : "") + ": " +
+                             std::to_string(sourceSize) + " -> " + std::to_string(sourceCode.length()) + " bytes");
+            } catch (const std::exception& e) {
+                Logger::warning("Writing source instead of a binary chunk: " + std::string(e.what()));
+            }
         }
 
     } catch (const std::exception& e) {
@@ -95,18 +160,60 @@ void LuaObfuscator::obfuscate(bool useStrings, bool useJunk, bool useVM) {
     }
 }
 
+std::string LuaObfuscator::estimate(bool useStrings, bool useJunk, bool useVM, bool useFlow) {
+    resolveProtections(useStrings, useJunk, useVM, useFlow);
+    Target::Kind target = Target::fromName(config.getValue("Output", "target", "lua54"));
+
+    // The same annotation and fitting steps as obfuscate, on copies
+    std::string code = sourceCode;
+    ConfigParser fitted = config;
+    Profile::apply(code, fitted, target);
+    Annotations::apply(code, target);
+    CostModel::Protections protections{useStrings, useFlow, useJunk, useVM};
+    CostModel::fit(code, sourceCode, fitted, protections, target);
+
+    CostModel::Rates rates = CostModel::rates(target, fitted);
+    CostModel::Settings settings = CostModel::settings(fitted);
+    CostModel::Shape shape = CostModel::measure(code, sourceCode, fitted, target);
+    costEstimate = CostModel::estimate(shape, protections, settings, rates, target);
+    return "Estimated cost on " + Target::name(target) + " (" +
+           (shape.profiled ? "from the profile" : "static: loops without literal bounds run 8 times") + "):\n" +
+           CostModel::report(shape, costEstimate, settings, rates);
+}
+
+bool LuaObfuscator::calibrate(const std::string& outputFile) {
+    Target::Kind target = Target::fromName(config.getValue("Output", "target", "lua54"));
+    if (!Target::hasLoad(target)) {
+        Logger::error("Calibration needs load(), which " + Target::name(target) + " does not provide");
+        return false;
+    }
+    sourceCode = CostModel::benchmark(target, config);
+    if (!BinaryChunk::matches(target)) {
+        Logger::info("No embedded " + Target::name(target) + " to run the benchmark; writing it instead (run it with `lua " +
+                     outputFile + " > costmodel.ini`)");
+        return true;
+    }
+    try {
+        Logger::info("Running the cost model benchmark on the embedded " + BinaryChunk::runtime() + "...");
+        sourceCode = BinaryChunk::run(sourceCode, "embedded");
+        Logger::info("Rates measured; point [CostModel] calibration at " + outputFile + " to use them");
+        return true;
+    } catch (const std::exception& e) {
+        Logger::error("Benchmark failed: " + std::string(e.what()));
+        return false;
+    }
+}
+
 bool LuaObfuscator::loadConfig(const std::string& filename) {
     Logger::init();
     Logger::info("Loading configuration from: " + filename);
     
-    if (!config.load(filename)) {
+    ConfigParser parsed;
+    if (!parsed.load(filename)) {
         Logger::error("Failed to load config file");
         return false;
     }
-
-    ARRAY_CHUNK_SIZE = config.getIntValue("Encryption", "chunk_size", 20);
-    key.resize(config.getIntValue("Strings", "key_size", 16));
-    generateEncryptionKey();
+    setConfig(parsed);
     
     Logger::setEnabled(config.getBoolValue("Logging", "enabled", true));
     Logger::setDebug(config.getBoolValue("Logging", "debug", false));
@@ -115,6 +222,17 @@ bool LuaObfuscator::loadConfig(const std::string& filename) {
     return true;
 }
 
+void LuaObfuscator::setConfig(const ConfigParser& parsed) {
+    config = parsed;
+    ARRAY_CHUNK_SIZE = config.getIntValue("Encryption", "chunk_size", 20);
+    key.resize(config.getIntValue("Strings", "key_size", 16));
+    generateEncryptionKey();
+}
+
+const ConfigParser& LuaObfuscator::getConfig() const {
+    return config;
+}
+
 void LuaObfuscator::setArrayChunkSize(size_t size) {
     ARRAY_CHUNK_SIZE = size;
 }
@@ -129,4 +247,65 @@ int LuaObfuscator::getConfigInt(const std::string& section, const std::string& k
 
 std::string LuaObfuscator::getConfigString(const std::string& section, const std::string& key, const std::string& defaultValue) const {
     return config.getValue(section, key, defaultValue);
-}
\ No newline at end of file
+}
+
+void LuaObfuscator::minify() {
+    Target::Kind target = Target::fromName(config.getValue("Output", "target", "lua54"));
+    Compression::Stats stats;
+    sourceCode = Compression::minify(sourceCode, stats, target, Compression::tier(config.getIntValue("Compression", "level", 6)).renameLocals);
+    Compression::report(stats);
+}
+
+void LuaObfuscator::compressPayload(int level) {
+    Target::Kind target = Target::fromName(config.getValue("Output", "target", "lua54"));
+    PayloadCompressor::Stats stats;
+    std::vector<std::string> blocks = PayloadCompressor::compress(sourceCode, level, stats);
+    PayloadCompressor::report(stats, level);
+
+    std::string restored;
+    for (const auto& block : blocks) restored += PayloadCompressor::decompress(block);
+    if (restored != sourceCode) {
+        throw std::runtime_error("decompressed blocks do not match the input");
+    }
+
+    // The same decompressor the VM runtime embeds, returned as a function so its cost can be timed on its own
+    std::stringstream ss;
+    ss << PayloadCompressor::generateDecompressor(target);
+    ss << "local blocks = {\n";
+    for (const auto& block : blocks) {
+        ss << "    " << PayloadEncoder::toLuaLiteral(block) << ",\n";
+    }
+    ss << "}\n\n";
+    ss << "return function()\n";
+    ss << "    local out = {}\n";
+    ss << "    for i = 1, #blocks do\n";
+    ss << "        out[i] = __decompress(blocks[i])\n";
+    ss << "    end\n";
+    ss << "    return table.concat(out)\n";
+    ss << "end\n";
+    sourceCode = ss.str();
+}
+
+void LuaObfuscator::setConfigValue(const std::string& section, const std::string& key, const std::string& value) {
+    config.setValue(section, key, value);
+}
+
+size_t LuaObfuscator::getOutputSize() const {
+    return sourceCode.length();
+}
+
+const std::string& LuaObfuscator::getOutput() const {
+    return sourceCode;
+}
+
+const Compression::Stats& LuaObfuscator::getMinifyStats() const {
+    return minifyStats;
+}
+
+const PayloadCompressor::Stats& LuaObfuscator::getPayloadStats() const {
+    return payloadStats;
+}
+
+const CostModel::Estimate& LuaObfuscator::getCostEstimate() const {
+    return costEstimate;
+}
@@ -1,5 +1,8 @@
 #pragma once
 #include "components/ConfigParser.hpp"
+#include "components/CostModel.hpp"
+#include "components/PayloadCompressor.hpp"
+#include "components/protections/Compression.hpp"
 #include <string>
 #include <vector>
 #include <random>
@@ -12,18 +15,38 @@ private:
     std::vector<uint8_t> key;
     size_t ARRAY_CHUNK_SIZE;
     ConfigParser config;
+    Compression::Stats minifyStats;
+    PayloadCompressor::Stats payloadStats;
+    CostModel::Estimate costEstimate;
 
     void generateEncryptionKey();
     std::string generateRandomString(int length);
+    void resolveProtections(bool& useStrings, bool& useJunk, bool& useVM, bool& useFlow) const;
 
 public:
     LuaObfuscator();
     bool loadConfig(const std::string& filename);
+    // Settings already loaded elsewhere, without touching the logger
+    void setConfig(const ConfigParser& parsed);
+    const ConfigParser& getConfig() const;
     bool loadFile(const std::string& filename);
     bool saveToFile(const std::string& filename);
-    void obfuscate(bool useStrings, bool useJunk, bool useVM);
+    void obfuscate(bool useStrings, bool useJunk, bool useVM, bool useFlow = false);
+    // Cost model table for the current source and settings, without protecting anything
+    std::string estimate(bool useStrings, bool useJunk, bool useVM, bool useFlow = false);
+    // Writes the cost model rates measured on the embedded Lua, or the benchmark script when there is none
+    bool calibrate(const std::string& outputFile);
+    void minify();
+    void compressPayload(int level);
     void setArrayChunkSize(size_t size);
     bool getConfigBool(const std::string& section, const std::string& key, bool defaultValue = false) const;
     int getConfigInt(const std::string& section, const std::string& key, int defaultValue = 0) const;
     std::string getConfigString(const std::string& section, const std::string& key, const std::string& defaultValue = "") const;
+    void setConfigValue(const std::string& section, const std::string& key, const std::string& value);
+    size_t getOutputSize() const;
+    const std::string& getOutput() const;
+    const Compression::Stats& getMinifyStats() const;
+    const PayloadCompressor::Stats& getPayloadStats() const;
+    // Set by estimate()
+    const CostModel::Estimate& getCostEstimate() const;
 }; 
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "Annotations.hpp"
+#include <algorithm>
+#include <set>
+#include "Logger.hpp"
+#include "parser/AstWalker.hpp"
+#include "parser/LuaParser.hpp"
+#include "parser/LuaPrinter.hpp"
+
+Annotations::Tier Annotations::tier(const std::string& annotation) {
+    if (annotation == "fast") return Tier::Fast;
+    if (annotation == "none") return Tier::None;
+    if (annotation == "max") return Tier::Max;
+    return Tier::Default;
+}
+
+Annotations::Tier Annotations::tierOf(const Function& func) {
+    return tier(func.annotation);
+}
+
+std::string Annotations::name(Tier tier) {
+    switch (tier) {
+        case Tier::Fast: return "fast";
+        case Tier::None: return "none";
+        case Tier::Max: return "max";
+        default: return "default";
+    }
+}
+
+bool Annotations::contains(const Function& func, Tier tier) {
+    bool found = false;
+    AstWalker::forEachFunction(*func.body, [&](Function& inner) {
+        if (tierOf(inner) == tier) found = true;
+    });
+    return found;
+}
+
+void Annotations::spreadFunction(Function& func, const std::string& inherited, std::vector<Region>& regions) {
+    if (func.annotation.empty()) func.annotation = inherited;
+    if (!func.annotation.empty()) regions.push_back({func.line, func.endLine, tier(func.annotation)});
+    spreadBlock(*func.body, func.annotation, regions);
+}
+
+void Annotations::spreadExpr(ExprPtr& expr, const std::string& inherited, std::vector<Region>& regions) {
+    if (expr->func) {
+        spreadFunction(*expr->func, inherited, regions);
+        return;
+    }
+    AstWalker::children(*expr, [&](ExprPtr& child) { spreadExpr(child, inherited, regions); }, [](BlockPtr&) {});
+}
+
+void Annotations::spreadBlock(Block& block, const std::string& inherited, std::vector<Region>& regions) {
+    for (auto& stat : block.stats) {
+        // Statements keep their own tags only; the functions in them are what the per-function passes look at
+        const std::string& tag = stat->annotation.empty() ? inherited : stat->annotation;
+        if (!stat->annotation.empty()) regions.push_back({stat->line, std::max(stat->line, stat->endLine), tier(tag)});
+        for (auto& target : stat->targets) spreadExpr(target, tag, regions);
+        for (auto& expr : stat->exprs) spreadExpr(expr, tag, regions);
+        if (stat->expr) spreadExpr(stat->expr, tag, regions);
+        for (auto& body : stat->blocks) spreadBlock(*body, tag, regions);
+        if (stat->func) spreadFunction(*stat->func, tag, regions);
+    }
+}
+
+std::vector<Annotations::Region> Annotations::spread(Block& chunk) {
+    std::vector<Region> regions;
+    spreadBlock(chunk, "", regions);
+    return regions;
+}
+
+Annotations::Coverage Annotations::apply(std::string& code, Target::Kind target) {
+    Coverage coverage;
+    if (code.find("@obf:") == std::string::npos) {
+        coverage.lines[0] = std::count(code.begin(), code.end(), '\n') + 1;
+        return coverage;
+    }
+
+    try {
+        LuaParser parser(code, target);
+        BlockPtr chunk = parser.parse();
+        // A statement and the function it defines share a tag, so each line is reported once
+        std::set<int> reported;
+        auto check = [&](std::string& annotation, int line) {
+            if (annotation.empty() || name(tier(annotation)) == annotation) return;
+            if (reported.insert(line).second) {
+                Logger::warning("Unknown annotation --@obf:" + annotation + " on line " + std::to_string(line) + " ignored");
+            }
+            annotation.clear();
+        };
+        AstWalker::walk(*chunk, [&](Stat& stat) { check(stat.annotation, stat.line); }, nullptr);
+        AstWalker::forEachFunction(*chunk, [&](Function& func) { check(func.annotation, func.line); });
+        spread(*chunk);
+        code = LuaPrinter::print(*chunk, true);
+
+        // Counted on the printed code, which is what the protections see
+        LuaParser printed(code, target);
+        chunk = printed.parse();
+        size_t lines = std::count(code.begin(), code.end(), '\n') + 1;
+        std::vector<Tier> tiers(lines + 1, Tier::Default);
+        for (const auto& region : spread(*chunk)) {
+            std::fill(tiers.begin() + region.line, tiers.begin() + std::min<size_t>(region.endLine, lines) + 1, region.tier);
+        }
+        for (size_t line = 1; line <= lines; ++line) ++coverage.lines[static_cast<int>(tiers[line])];
+        AstWalker::forEachFunction(*chunk, [&](Function& func) { ++coverage.functions[static_cast<int>(tierOf(func))]; });
+
+        std::string summary;
+        for (int i = 0; i < TIERS; ++i) {
+            summary += (i > 0 ? ", " : "") + name(static_cast<Tier>(i)) + " " +
+                       std::to_string(static_cast<int>(100.0 * coverage.lines[i] / lines + 0.5)) + "% (" +
+                       std::to_string(coverage.lines[i]) + " lines, " + std::to_string(coverage.functions[i]) + " functions)";
+        }
+        Logger::info("Protection tiers: " + summary);
+    } catch (const std::exception& e) {
+        Logger::warning("Annotations ignored: " + std::string(e.what()));
+        coverage = Coverage();
+        coverage.lines[0] = std::count(code.begin(), code.end(), '\n') + 1;
+    }
+    return coverage;
+}
+
+std::vector<Annotations::Region> Annotations::regions(const std::string& code, Target::Kind target) {
+    if (code.find("@obf:") == std::string::npos) return {};
+    try {
+        LuaParser parser(code, target);
+        BlockPtr chunk = parser.parse();
+        return spread(*chunk);
+    } catch (const std::exception& e) {
+        Logger::warning("Annotated regions not found: " + std::string(e.what()));
+        return {};
+    }
+}
+
+void Annotations::strip(std::string& code, Target::Kind target) {
+    if (code.find("@obf:") == std::string::npos) return;
+    try {
+        LuaParser parser(code, target);
+        BlockPtr chunk = parser.parse();
+        code = LuaPrinter::print(*chunk);
+    } catch (const std::exception& e) {
+        Logger::warning("Annotations left in the output: " + std::string(e.what()));
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Target.hpp"
+#include "parser/LuaAst.hpp"
+
+// Protection tiers chosen in the source with a comment right before a statement or a function expression:
+//   --@obf:fast  hot code: not flattened, strings decrypted once and cached, run natively by the VM
+//   --@obf:none  no protection: not flattened, strings left as written, run natively by the VM
+//   --@obf:max   full protection even where [Strings], [VM], [ControlFlow] or [Junk] are disabled: flattened
+//                whatever its cost, strings encrypted, kept in the VM and padded with junk code
+// A tag covers the statement after it, functions inside included, until an inner tag says otherwise. Flattening and
+// the VM work on whole functions, so a tagged block reaches them through the functions it contains.
+class Annotations {
+public:
+    enum class Tier { Default, Fast, None, Max };
+    static constexpr int TIERS = 4;
+
+    struct Region {
+        int line = 0;
+        int endLine = 0;
+        Tier tier = Tier::Default;
+    };
+
+    struct Coverage {
+        size_t lines[TIERS] = {};
+        size_t functions[TIERS] = {};
+
+        bool any(Tier tier) const { return lines[static_cast<int>(tier)] > 0; }
+    };
+
+    static Tier tier(const std::string& annotation);
+    static Tier tierOf(const Function& func);
+    static std::string name(Tier tier);
+    static bool contains(const Function& func, Tier tier);
+
+    // Hands every tag down to the functions it covers; returns the tagged regions in source order
+    static std::vector<Region> spread(Block& chunk);
+    // Drops unknown tags, spreads the others and logs how much of the code each tier covers
+    static Coverage apply(std::string& code, Target::Kind target);
+    // Tagged regions of `code`, outer ones before the regions nested in them
+    static std::vector<Region> regions(const std::string& code, Target::Kind target);
+    // Prints `code` again without its tags, once no pass reads them any more
+    static void strip(std::string& code, Target::Kind target);
+
+private:
+    static void spreadBlock(Block& block, const std::string& inherited, std::vector<Region>& regions);
+    static void spreadFunction(Function& func, const std::string& inherited, std::vector<Region>& regions);
+    static void spreadExpr(ExprPtr& expr, const std::string& inherited, std::vector<Region>& regions);
+};
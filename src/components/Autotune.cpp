@@ -0,0 +1,283 @@
+#include "Autotune.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include "BinaryChunk.hpp"
+#include "Logger.hpp"
+#include "Target.hpp"
+#include "../LuaObfuscator.hpp"
+
+bool Autotune::validObjective(const std::string& objective) {
+    const std::vector<std::string> objectives = {"size", "load", "run", "total", "balanced"};
+    return std::find(objectives.begin(), objectives.end(), objective) != objectives.end();
+}
+
+Autotune::Sample Autotune::median(const std::vector<Sample>& samples) {
+    auto middle = [&](double Sample::*field) {
+        std::vector<double> values;
+        for (const auto& sample : samples) values.push_back(sample.*field);
+        std::sort(values.begin(), values.end());
+        size_t half = values.size() / 2;
+        return values.size() % 2 ? values[half] : (values[half - 1] + values[half]) / 2;
+    };
+    Sample result;
+    result.obfuscateSeconds = middle(&Sample::obfuscateSeconds);
+    result.bytes = middle(&Sample::bytes);
+    result.loadSeconds = middle(&Sample::loadSeconds);
+    result.runSeconds = middle(&Sample::runSeconds);
+    return result;
+}
+
+// Relative to the configured values, so the objectives mixing units weigh them equally
+double Autotune::score(const Sample& sample, const Sample& baseline, const std::string& objective) {
+    double time = (sample.loadSeconds + sample.runSeconds) / std::max(baseline.loadSeconds + baseline.runSeconds, 1e-9);
+    if (objective == "size") return sample.bytes / baseline.bytes;
+    if (objective == "load") return sample.loadSeconds / std::max(baseline.loadSeconds, 1e-9);
+    if (objective == "run") return sample.runSeconds / std::max(baseline.runSeconds, 1e-9);
+    if (objective == "total") return time;
+    return std::cbrt(sample.bytes / baseline.bytes * time * sample.obfuscateSeconds / std::max(baseline.obfuscateSeconds, 1e-9));
+}
+
+// A gain within the spread of either setting's runs may be noise alone
+bool Autotune::better(const Score& candidate, const Score& current) {
+    double gain = current.median - candidate.median;
+    double spread = std::max(candidate.high - candidate.low, current.high - current.low);
+    return gain > spread && gain > current.median * MARGIN;
+}
+
+Autotune::Score Autotune::score(const Result& result, const Sample& baseline, const std::string& objective) {
+    std::vector<double> scores;
+    for (const auto& sample : result.runs) scores.push_back(score(sample, baseline, objective));
+    std::sort(scores.begin(), scores.end());
+    size_t half = scores.size() / 2;
+    Score total;
+    total.median = scores.size() % 2 ? scores[half] : (scores[half - 1] + scores[half]) / 2;
+    total.low = scores.front();
+    total.high = scores.back();
+    return total;
+}
+
+std::string Autotune::describe(const std::vector<Parameter>& parameters) {
+    std::string text;
+    for (const auto& parameter : parameters) {
+        text += (text.empty() ? "" : " ") + parameter.key + "=" + std::to_string(parameter.value);
+    }
+    return text;
+}
+
+// Copies config.ini to outputFile with the tuned values in place, keeping its comments and layout
+bool Autotune::writeConfig(const std::string& outputFile, const std::vector<Parameter>& parameters) {
+    std::ifstream in("config.ini");
+    if (!in) {
+        Logger::error("Failed to read config.ini");
+        return false;
+    }
+    std::vector<bool> written(parameters.size(), false);
+    std::stringstream out;
+    std::string line;
+    std::string section;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line[0] == '[') {
+            section = line.substr(1, line.find(']') - 1);
+        }
+        for (size_t i = 0; i < parameters.size(); ++i) {
+            if (section == parameters[i].section && line.compare(0, parameters[i].key.size() + 1, parameters[i].key + "=") == 0) {
+                line = parameters[i].key + "=" + std::to_string(parameters[i].value);
+                written[i] = true;
+            }
+        }
+        out << line << "\n";
+    }
+    for (size_t i = 0; i < parameters.size(); ++i) {
+        if (!written[i]) out << "\n[" << parameters[i].section << "]\n" << parameters[i].key << "=" << parameters[i].value << "\n";
+    }
+
+    std::ofstream file(outputFile);
+    if (!file) {
+        Logger::error("Failed to write " + outputFile);
+        return false;
+    }
+    file << out.str();
+    return true;
+}
+
+bool Autotune::run(const std::string& outputFile, const std::vector<std::string>& corpus, const Options& options) {
+    const std::string& objective = options.objective;
+    if (!validObjective(objective)) {
+        Logger::error("Unknown objective " + objective + " (size, load, run, total or balanced)");
+        return false;
+    }
+
+    // Read once: every candidate starts from a copy instead of loading and logging the file again
+    LuaObfuscator base;
+    if (!base.loadConfig("config.ini")) return false;
+    if (!options.target.empty()) base.setConfigValue("Output", "target", options.target);
+    if (!options.profile.empty()) base.setConfigValue("Profile", "file", options.profile);
+    // The fit would pick the chunk sizes itself
+    base.setConfigValue("CostModel", "max_slowdown", "0");
+    const ConfigParser& config = base.getConfig();
+
+    Target::Kind kind = Target::fromName(config.getValue("Output", "target", "lua54"));
+    bool strings = options.useStrings || config.getBoolValue("Strings", "enabled", false);
+    bool vm = options.useVM || config.getBoolValue("VM", "enabled", false);
+
+    std::vector<Parameter> parameters;
+    if (strings) {
+        parameters.push_back({"Encryption", "chunk_size", {1, 4, 8, 16, 20, 32, 48, 64, 100}, config.getIntValue("Encryption", "chunk_size", 20)});
+    }
+    if (vm) {
+        parameters.push_back({"VM", "code_chunk_size", {100, 200, 300, 400, 600, 800, 1000}, config.getIntValue("VM", "code_chunk_size", 100)});
+        parameters.push_back({"ControlFlow", "fake_states", {5, 10, 15, 25, 35, 50}, config.getIntValue("ControlFlow", "fake_states", 15)});
+        parameters.push_back({"ControlFlow", "jump_table_size", {5, 10, 15, 20}, config.getIntValue("ControlFlow", "jump_table_size", 10)});
+    }
+    if (parameters.empty()) {
+        Logger::error("Nothing to tune: enable string encryption or the VM (--strings, --vm, --all or config.ini)");
+        return false;
+    }
+    if (options.runs < 3) {
+        Logger::warning("With fewer than 3 runs the spread of the measurements is unknown; only the " +
+                        std::to_string(static_cast<int>(MARGIN * 100)) + "% margin guards against noise");
+    }
+
+    // What the originals print and how long they take, to check and compare the protected outputs against
+    std::vector<std::string> expected;
+    double nativeLoad = 0;
+    double nativeRun = 0;
+    bool embedded = BinaryChunk::matches(kind) && Target::hasLoad(kind);
+    for (size_t i = 0; embedded && i < corpus.size(); ++i) {
+        std::ifstream file(corpus[i], std::ios::binary);
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        try {
+            BinaryChunk::Timing timing = BinaryChunk::time(buffer.str(), options.runs);
+            expected.push_back(timing.output);
+            nativeLoad += timing.loadSeconds;
+            nativeRun += timing.runSeconds;
+        } catch (const std::exception& e) {
+            Logger::warning(corpus[i] + " does not run on the embedded " + BinaryChunk::runtime() + " (" + e.what() + ")");
+            embedded = false;
+        }
+    }
+    if (embedded) {
+        Logger::info("Timing " + std::to_string(corpus.size()) + " scripts on the embedded " + BinaryChunk::runtime() +
+                     " (originals: load " + std::to_string(nativeLoad * 1000) + " ms, run " + std::to_string(nativeRun * 1000) + " ms)");
+    } else {
+        Logger::info("No embedded " + Target::name(kind) + " to run the corpus on; load and run times are cost model estimates");
+    }
+
+    // Every run obfuscates the whole corpus again, since the random key and layout change the size and times too
+    auto measure = [&](const std::vector<Parameter>& setting) {
+        Result result;
+        result.runs.resize(options.runs);
+        bool logging = Logger::isEnabled();
+        Logger::setEnabled(false);
+        for (size_t i = 0; i < corpus.size() && result.ok; ++i) {
+            double loadEstimate = 0;
+            double runEstimate = 0;
+            for (int run = 0; run < options.runs && result.ok; ++run) {
+                LuaObfuscator obfuscator;
+                obfuscator.setConfig(config);
+                for (const auto& parameter : setting) {
+                    obfuscator.setConfigValue(parameter.section, parameter.key, std::to_string(parameter.value));
+                }
+                if (!obfuscator.loadFile(corpus[i])) {
+                    result = Result{false, "cannot read " + corpus[i], {}};
+                    break;
+                }
+                Sample& sample = result.runs[run];
+                try {
+                    // The estimate leaves out the random parts, so one per script serves every run
+                    if (!embedded && run == 0) {
+                        obfuscator.estimate(options.useStrings, options.useJunk, options.useVM, options.useFlow);
+                        loadEstimate = obfuscator.getCostEstimate().protectedLoad() * 1e-9;
+                        runEstimate = obfuscator.getCostEstimate().protectedRun() * 1e-9;
+                    }
+                    auto start = std::chrono::steady_clock::now();
+                    obfuscator.obfuscate(options.useStrings, options.useJunk, options.useVM, options.useFlow);
+                    sample.obfuscateSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    sample.bytes += static_cast<double>(obfuscator.getOutputSize());
+                    if (embedded) {
+                        BinaryChunk::Timing timing = BinaryChunk::time(obfuscator.getOutput(), 1);
+                        sample.loadSeconds += timing.loadSeconds;
+                        sample.runSeconds += timing.runSeconds;
+                        if (timing.output != expected[i]) result = Result{false, corpus[i] + " printed something else", {}};
+                    } else {
+                        sample.loadSeconds += loadEstimate;
+                        sample.runSeconds += runEstimate;
+                    }
+                } catch (const std::exception& e) {
+                    result = Result{false, corpus[i] + ": " + e.what(), {}};
+                }
+            }
+        }
+        Logger::setEnabled(logging);
+        return result;
+    };
+
+    Sample baseline;
+    std::map<std::vector<int>, Result> measured;
+    auto evaluate = [&]() {
+        std::vector<int> values;
+        for (const auto& parameter : parameters) values.push_back(parameter.value);
+        auto found = measured.find(values);
+        if (found != measured.end()) return found->second;
+        Result result = measure(parameters);
+        measured[values] = result;
+        if (measured.size() == 1 && result.ok) baseline = median(result.runs);
+        if (!result.ok) {
+            std::cout << describe(parameters) << "  rejected: " << result.failure << "\n";
+        } else {
+            Sample typical = median(result.runs);
+            Score total = score(result, baseline, objective);
+            char row[200];
+            std::snprintf(row, sizeof(row), "  obfuscate %8.1f ms  %10.0f bytes  load %8.2f ms  run %9.2f ms  score %.3f (%.3f-%.3f)",
+                          typical.obfuscateSeconds * 1000, typical.bytes, typical.loadSeconds * 1000, typical.runSeconds * 1000,
+                          total.median, total.low, total.high);
+            std::cout << describe(parameters) << row << "\n";
+        }
+        return result;
+    };
+
+    // The first obfuscations run slower while caches and allocators warm up, which would flatter every later setting
+    measure(parameters);
+    Result best = evaluate();
+    if (!best.ok) {
+        Logger::error("The configured values already fail: " + best.failure);
+        return false;
+    }
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t index = 0; index < parameters.size(); ++index) {
+            Parameter& parameter = parameters[index];
+            int chosen = parameter.value;
+            for (int value : parameter.values) {
+                parameter.value = value;
+                Result result = evaluate();
+                if (!result.ok) continue;
+                Score candidate = score(result, baseline, objective);
+                if (!better(candidate, score(best, baseline, objective))) continue;
+                // Measured again right away, so a machine that got faster since cannot pass for a better setting
+                std::vector<Parameter> previous = parameters;
+                previous[index].value = chosen;
+                Result again = measure(previous);
+                if (again.ok && better(candidate, score(again, baseline, objective))) {
+                    best = result;
+                    chosen = value;
+                    changed = true;
+                }
+            }
+            parameter.value = chosen;
+        }
+    }
+
+    std::cout << "Best for " << objective << ": " << describe(parameters) << " (score " << score(best, baseline, objective).median
+              << " of the configured values, " << measured.size() << " settings measured" << (embedded ? "" : ", times estimated") << ")\n";
+    if (!writeConfig(outputFile, parameters)) return false;
+    Logger::info("Tuned configuration written to " + outputFile);
+    return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "ConfigParser.hpp"
+
+// Searches the string and VM payload chunk sizes and the VM state table sizes one at a time, keeping whatever
+// improves the objective, until a pass over all of them changes nothing. Each setting is measured on the whole corpus
+// `runs` times: obfuscation time and output size here, load and run time in the embedded interpreter when it is the
+// target runtime (outputs that print something else than the original are rejected), the cost model estimate otherwise.
+// A setting replaces the best one only when its median score beats it by more than the spread of either's runs, also
+// against the best one measured again right after it.
+class Autotune {
+public:
+    struct Options {
+        std::string objective = "balanced";
+        int runs = 3;
+        bool useStrings = false;
+        bool useJunk = false;
+        bool useVM = false;
+        bool useFlow = false;
+        std::string target;
+        std::string profile;
+    };
+
+    // Writes config.ini with the best values found on `corpus` to outputFile
+    static bool run(const std::string& outputFile, const std::vector<std::string>& corpus, const Options& options);
+
+private:
+    // A knob the search tries, over the range config.ini documents for it
+    struct Parameter {
+        std::string section;
+        std::string key;
+        std::vector<int> values;
+        int value;
+    };
+
+    // Totals over the corpus for one run of one setting
+    struct Sample {
+        double obfuscateSeconds = 0;
+        double bytes = 0;
+        double loadSeconds = 0;
+        double runSeconds = 0;
+    };
+
+    struct Result {
+        bool ok = true;
+        std::string failure;
+        std::vector<Sample> runs;
+    };
+
+    // Median and extremes of a setting's per-run scores
+    struct Score {
+        double median = 0;
+        double low = 0;
+        double high = 0;
+    };
+
+    // Relative improvement a setting needs over the best one so far even when its runs agree
+    static constexpr double MARGIN = 0.02;
+
+    static bool validObjective(const std::string& objective);
+    static Sample median(const std::vector<Sample>& samples);
+    static double score(const Sample& sample, const Sample& baseline, const std::string& objective);
+    static Score score(const Result& result, const Sample& baseline, const std::string& objective);
+    static bool better(const Score& candidate, const Score& current);
+    static std::string describe(const std::vector<Parameter>& parameters);
+    static bool writeConfig(const std::string& outputFile, const std::vector<Parameter>& parameters);
+};
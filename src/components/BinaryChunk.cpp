@@ -0,0 +1,147 @@
+#include "BinaryChunk.hpp"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef OBFUSCATOR_HAVE_LUA
+#include <lua.hpp>
+
+namespace {
+int appendChunk(lua_State*, const void* data, size_t size, void* out) {
+    static_cast<std::string*>(out)->append(static_cast<const char*>(data), size);
+    return 0;
+}
+
+}
+
+bool BinaryChunk::matches(Target::Kind target) {
+#if defined(LUAJIT_VERSION)
+    return target == Target::LuaJIT;
+#elif LUA_VERSION_NUM == 501
+    return target == Target::Lua51;
+#else
+    return target == Target::Lua54;
+#endif
+}
+
+bool BinaryChunk::available() {
+    return true;
+}
+
+std::string BinaryChunk::runtime() {
+#if defined(LUAJIT_VERSION)
+    return LUAJIT_VERSION;
+#else
+    return LUA_RELEASE;
+#endif
+}
+
+std::string BinaryChunk::compile(const std::string& source, Target::Kind target, bool strip) {
+    // Bytecode formats differ between every minor version, so a mismatched chunk would just fail to load
+    if (!matches(target)) {
+        throw std::runtime_error("embedded compiler is " + runtime() + ", which cannot produce chunks for " + Target::name(target));
+    }
+
+    lua_State* L = luaL_newstate();
+    if (!L) throw std::runtime_error("cannot create Lua state");
+
+    std::string chunk;
+    if (luaL_loadbuffer(L, source.data(), source.size(), "=obfuscated") != 0) {
+        std::string message = lua_tostring(L, -1);
+        lua_close(L);
+        throw std::runtime_error("compile error: " + message);
+    }
+#if LUA_VERSION_NUM >= 503
+    int status = lua_dump(L, appendChunk, &chunk, strip ? 1 : 0);
+#else
+    // Older dump APIs always keep debug info
+    (void)strip;
+    int status = lua_dump(L, appendChunk, &chunk);
+#endif
+    lua_close(L);
+
+    if (status != 0) throw std::runtime_error("lua_dump failed");
+    return chunk;
+}
+
+std::string BinaryChunk::run(const std::string& source, const std::string& argument) {
+    lua_State* L = luaL_newstate();
+    if (!L) throw std::runtime_error("cannot create Lua state");
+    luaL_openlibs(L);
+
+    if (luaL_loadbuffer(L, source.data(), source.size(), "=benchmark") != 0 ||
+        (lua_pushlstring(L, argument.data(), argument.size()), lua_pcall(L, 1, 1, 0)) != 0) {
+        std::string message = lua_tostring(L, -1) ? lua_tostring(L, -1) : "unknown error";
+        lua_close(L);
+        throw std::runtime_error(message);
+    }
+    size_t length = 0;
+    const char* result = lua_tolstring(L, -1, &length);
+    std::string output = result ? std::string(result, length) : "";
+    lua_close(L);
+    return output;
+}
+
+#else
+
+bool BinaryChunk::available() {
+    return false;
+}
+
+std::string BinaryChunk::runtime() {
+    return "none";
+}
+
+std::string BinaryChunk::compile(const std::string&, Target::Kind, bool) {
+    throw std::runtime_error("built without an embedded Lua compiler (configure with Lua installed or -DLUA_SOURCE_DIR=<lua source tree>)");
+}
+
+bool BinaryChunk::matches(Target::Kind) {
+    return false;
+}
+
+std::string BinaryChunk::run(const std::string&, const std::string&) {
+    throw std::runtime_error("built without an embedded Lua (configure with Lua installed or -DLUA_SOURCE_DIR=<lua source tree>)");
+}
+
+#endif
+
+BinaryChunk::Timing BinaryChunk::time(const std::string& source, int runs) {
+    std::stringstream ss;
+    ss << "local source = ...\n";
+    ss << "local load, clock, concat = loadstring or load, os.clock, table.concat\n";
+    ss << "local print, write = print, io.write\n";
+    ss << "local output, bestLoad, bestRun = {}, math.huge, math.huge\n";
+    ss << "for run = 1, " << std::max(runs, 1) << " do\n";
+    ss << "    local lines = {}\n";
+    ss << "    _G.print = function(...)\n";
+    ss << "        local parts = {...}\n";
+    ss << "        for i = 1, select('#', ...) do parts[i] = tostring(parts[i]) end\n";
+    ss << "        lines[#lines + 1] = concat(parts, '\\t') .. '\\n'\n";
+    ss << "    end\n";
+    ss << "    io.write = function(...)\n";
+    ss << "        for i = 1, select('#', ...) do lines[#lines + 1] = tostring((select(i, ...))) end\n";
+    ss << "    end\n";
+    ss << "    collectgarbage('collect')\n";
+    ss << "    local start = clock()\n";
+    ss << "    local chunk, err = load(source, '=protected')\n";
+    ss << "    local loaded = clock()\n";
+    ss << "    if not chunk then error(err, 0) end\n";
+    ss << "    local ok, failure = pcall(chunk)\n";
+    ss << "    local finished = clock()\n";
+    ss << "    _G.print, io.write = print, write\n";
+    ss << "    if not ok then error(tostring(failure), 0) end\n";
+    ss << "    if run == 1 then output = lines end\n";
+    ss << "    bestLoad = math.min(bestLoad, loaded - start)\n";
+    ss << "    bestRun = math.min(bestRun, finished - loaded)\n";
+    ss << "end\n";
+    ss << "return string.format('%.9f %.9f\\n', bestLoad, bestRun) .. concat(output)\n";
+
+    std::string result = run(ss.str(), source);
+    Timing timing;
+    size_t newline = result.find('\n');
+    std::istringstream times(result.substr(0, newline));
+    times >> timing.loadSeconds >> timing.runSeconds;
+    if (newline != std::string::npos) timing.output = result.substr(newline + 1);
+    return timing;
+}
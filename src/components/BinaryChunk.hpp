@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include "Target.hpp"
+
+// Compiles the finished program with the embedded Lua compiler and returns it as a binary chunk; the same
+// interpreter also runs calibration benchmarks.
+// Only built in when CMake found Lua (OBFUSCATOR_HAVE_LUA); otherwise available() is false and compile() throws.
+class BinaryChunk {
+public:
+    static bool available();
+    // Version of the embedded compiler, e.g. "Lua 5.4.6"; binary chunks only load on that version
+    static std::string runtime();
+    // Throws when the compiler is missing, does not match the target or rejects the source
+    static std::string compile(const std::string& source, Target::Kind target, bool strip);
+    // Whether the embedded runtime is the one `target` names
+    static bool matches(Target::Kind target);
+    // Runs source with the standard libraries, passing `argument` as `...`, and returns its first result
+    static std::string run(const std::string& source, const std::string& argument);
+
+    struct Timing {
+        double loadSeconds = 0;
+        double runSeconds = 0;
+        // What the script printed on its first run
+        std::string output;
+    };
+    // Best load and run time of `source` over `runs` runs, each in the same fresh state with print and io.write
+    // captured; throws when the script fails
+    static Timing time(const std::string& source, int runs);
+};
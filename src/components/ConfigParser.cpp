@@ -77,4 +77,8 @@ bool ConfigParser::getBoolValue(const std::string& section, const std::string& k
     }
     
     return defaultValue;
-} 
\ No newline at end of file
+}
+
+void ConfigParser::setValue(const std::string& section, const std::string& key, const std::string& value) {
+    sections[section][key] = value;
+}
@@ -13,4 +13,5 @@ public:
     std::string getValue(const std::string& section, const std::string& key, const std::string& defaultValue = "") const;
     int getIntValue(const std::string& section, const std::string& key, int defaultValue = 0) const;
     bool getBoolValue(const std::string& section, const std::string& key, bool defaultValue = false) const;
+    void setValue(const std::string& section, const std::string& key, const std::string& value);
 }; 
\ No newline at end of file
@@ -0,0 +1,705 @@
+#include "CostModel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <sstream>
+#include "Logger.hpp"
+#include "PayloadEncoder.hpp"
+#include "Profile.hpp"
+#include "parser/AstWalker.hpp"
+#include "parser/LuaParser.hpp"
+#include "parser/LuaPrinter.hpp"
+#include "protections/BlockFlattener.hpp"
+#include "protections/JunkCode.hpp"
+#include "protections/VMProtection.hpp"
+
+namespace {
+struct RateKey {
+    const char* key;
+    double CostModel::Rates::*field;
+};
+
+const RateKey RATE_KEYS[] = {
+    {"instruction", &CostModel::Rates::instruction},
+    {"call", &CostModel::Rates::call},
+    {"decrypt_call", &CostModel::Rates::decryptCall},
+    {"decrypt_byte", &CostModel::Rates::decryptByte},
+    {"decrypt_block", &CostModel::Rates::decryptBlock},
+    {"dispatch", &CostModel::Rates::dispatch},
+    {"vm_factor", &CostModel::Rates::vmFactor},
+    {"load_byte", &CostModel::Rates::loadByte},
+    {"junk_statement", &CostModel::Rates::junkStatement},
+};
+
+// Knob values the fit tries, lightest first
+const int CHUNK_SIZES[] = {8, 16, 24, 32, 48, 64, 100};
+const int CODE_CHUNK_SIZES[] = {100, 200, 400, 600, 800, 1000};
+const std::vector<int> FAKE_STATES = {5, 10, 15, 25, 50};
+const std::vector<int> JUMP_TABLE_SIZES = {5, 10, 15, 20};
+const std::vector<int> JUNK_COUNTS = {1, 2, 3, 5, 8, 10};
+const std::vector<int> FLATTEN_BUDGETS = {0, 25, 50, 100, 150, 300, 600};
+const std::vector<int> FAKE_BLOCK_PERCENTS = {0, 25, 50, 100};
+
+// Bytes of generated code, measured on the outputs of the sample scripts
+constexpr double STATE_BYTES = 170;
+constexpr double SITE_BYTES = 30;
+constexpr double DECRYPTOR_BYTES = 1850;
+constexpr double JUNK_BYTES = 45;
+constexpr double VM_RUNTIME_BYTES = 14000;
+constexpr double NODE_BYTES = 7;
+constexpr double STATE_NODES = 6;
+constexpr double SITE_NODES = 3;
+constexpr double DECRYPTOR_NODES = 700;
+constexpr double JUNK_NODES = 5;
+constexpr double LITERAL_RATIO = 1.4;
+constexpr double SCRAMBLE_BYTES = 25;
+
+double parseDouble(const std::string& text, double fallback) {
+    try {
+        return text.empty() ? fallback : std::stod(text);
+    } catch (const std::exception&) {
+        return fallback;
+    }
+}
+
+// Bytes each decryptor loop iteration handles for a configured chunk size
+double blockBytes(int chunkSize, Target::Kind target) {
+    size_t size = std::max(chunkSize, 1);
+    if (target == Target::Lua54) return std::max<size_t>(size / 8, 1) * 8.0;
+    return static_cast<double>(size);
+}
+
+std::string lastName(const std::string& name) {
+    size_t pos = name.find_last_of(".:");
+    return pos == std::string::npos ? name : name.substr(pos + 1);
+}
+
+std::string format(const char* pattern, double value) {
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), pattern, value);
+    return buffer;
+}
+}
+
+double CostModel::Estimate::protectedRun() const {
+    double total = run;
+    for (double added : addedRun) total += added;
+    return total;
+}
+
+double CostModel::Estimate::protectedLoad() const {
+    double total = load;
+    for (double added : addedLoad) total += added;
+    return total;
+}
+
+double CostModel::Estimate::protectedBytes() const {
+    double total = bytes;
+    for (double added : addedBytes) total += added;
+    return total;
+}
+
+double CostModel::Estimate::slowdown() const {
+    double before = run + load;
+    return before > 0 ? (protectedRun() + protectedLoad()) / before : 1;
+}
+
+CostModel::Rates CostModel::rates(Target::Kind target, const ConfigParser& config) {
+    // Measured with the benchmark below; Luau cannot run it (no load()) and is assumed to be no faster than Lua 5.1
+    Rates rates;
+    switch (target) {
+        case Target::Lua54:
+            rates = {5.5, 18, 2700, 28, 780, 5.8, 22, 33, 180};
+            break;
+        case Target::LuaJIT:
+            rates = {0.52, 0.52, 97, 7.5, 5.5, 0.52, 34, 36, 24};
+            break;
+        default:
+            rates = {5.7, 27, 1400, 150, 520, 4.5, 17.5, 39, 210};
+            break;
+    }
+
+    std::string path = config.getValue("CostModel", "calibration", "");
+    if (path.empty()) return rates;
+    ConfigParser calibration;
+    if (!calibration.load(path)) {
+        Logger::warning("Cost model calibration " + path + " not found; using the built-in rates");
+        return rates;
+    }
+    std::string measured = calibration.getValue("CostModel", "target", "");
+    if (measured != Target::name(target)) {
+        Logger::warning("Cost model calibration " + path + " was measured on " + (measured.empty() ? "an unknown runtime" : measured) +
+                        "; using the built-in rates for " + Target::name(target));
+        return rates;
+    }
+    for (const auto& rate : RATE_KEYS) {
+        rates.*rate.field = parseDouble(calibration.getValue("CostModel", rate.key, ""), rates.*rate.field);
+    }
+    return rates;
+}
+
+CostModel::Settings CostModel::settings(const ConfigParser& config) {
+    Settings settings;
+    settings.chunkSize = config.getIntValue("Encryption", "chunk_size", 20);
+    settings.codeChunkSize = config.getIntValue("VM", "code_chunk_size", 100);
+    settings.fakeStates = config.getIntValue("ControlFlow", "fake_states", 15);
+    settings.jumpTableSize = config.getIntValue("ControlFlow", "jump_table_size", 10);
+    settings.junkCount = config.getIntValue("Junk", "junk_count", 3);
+    settings.junkBudgetPercent = config.getIntValue("Junk", "budget_percent", 10);
+    settings.flattenBudget = config.getIntValue("ControlFlow", "flatten_budget", 150);
+    settings.fakeBlockPercent = config.getIntValue("ControlFlow", "fake_block_percent", 50);
+    settings.hoistLoops = config.getBoolValue("Strings", "hoist_loops", true);
+    return settings;
+}
+
+CostModel::Protections CostModel::protections(const ConfigParser& config) {
+    Protections protections;
+    protections.strings = config.getBoolValue("Strings", "enabled", false);
+    protections.flow = config.getBoolValue("ControlFlow", "enabled", false);
+    protections.junk = config.getBoolValue("Junk", "enabled", false);
+    protections.vm = config.getBoolValue("VM", "enabled", false);
+    return protections;
+}
+
+void CostModel::countExpr(const Expr& expr, double weight, double entry, bool encrypted, FunctionShape& shape, std::vector<std::pair<std::string, double>>& sites) {
+    switch (expr.kind) {
+        case ExprKind::Nil: case ExprKind::True: case ExprKind::False: case ExprKind::Number:
+        case ExprKind::Vararg: case ExprKind::Name:
+            return;
+        case ExprKind::String:
+            // StringEncryption only takes quoted literals outside call arguments, table constructors and plain assignments
+            if (encrypted && !expr.literal.empty() && expr.literal[0] != '[' && !expr.value.empty() && expr.value.find("__") == std::string::npos) {
+                shape.strings += weight;
+                shape.stringBytes += weight * expr.value.length();
+                // Hoisting decrypts a literal once per entry into its outermost loop
+                if (entry > 0) {
+                    shape.loopStrings += weight;
+                    shape.hoistedStrings += entry;
+                }
+                ++shape.literals;
+                shape.literalBytes += expr.value.length();
+            }
+            return;
+        case ExprKind::Function:
+            shape.ops += weight;
+            ++shape.nodes;
+            return;
+        case ExprKind::Call:
+            if (expr.lhs->kind == ExprKind::Name) sites.emplace_back(expr.lhs->value, weight);
+            if (expr.lhs->kind == ExprKind::Index && expr.lhs->rhs->kind == ExprKind::String) sites.emplace_back(expr.lhs->rhs->value, weight);
+            break;
+        case ExprKind::Method:
+            sites.emplace_back(expr.value, weight);
+            break;
+        default:
+            break;
+    }
+    shape.ops += weight;
+    ++shape.nodes;
+    if (expr.lhs) countExpr(*expr.lhs, weight, entry, encrypted, shape, sites);
+    if (expr.rhs) countExpr(*expr.rhs, weight, entry, encrypted, shape, sites);
+    for (const auto& arg : expr.args) countExpr(*arg, weight, entry, false, shape, sites);
+    for (const auto& field : expr.fields) {
+        if (field.key) countExpr(*field.key, weight, entry, false, shape, sites);
+        if (field.value) countExpr(*field.value, weight, entry, false, shape, sites);
+    }
+}
+
+double CostModel::work(const Function& func) {
+    FunctionShape shape;
+    std::vector<std::pair<std::string, double>> sites;
+    countBlock(*func.body, 1, 0, shape, sites);
+    return shape.ops;
+}
+
+double CostModel::iterations(const Stat& stat) {
+    // Numeric loops with literal bounds run a known number of times
+    if (stat.kind == StatKind::NumericFor) {
+        std::vector<double> bounds;
+        for (const auto& expr : stat.exprs) {
+            if (expr->kind != ExprKind::Number) break;
+            bounds.push_back(parseDouble(expr->value, std::nan("")));
+        }
+        if (bounds.size() == stat.exprs.size() && bounds.size() >= 2) {
+            double step = bounds.size() > 2 ? bounds[2] : 1;
+            if (step != 0 && !std::isnan(bounds[0] + bounds[1] + step)) return std::max(std::floor((bounds[1] - bounds[0]) / step) + 1, 0.0);
+        }
+    }
+    return LOOP_ITERATIONS;
+}
+
+void CostModel::countBlock(const Block& block, double weight, double entry, FunctionShape& shape, std::vector<std::pair<std::string, double>>& sites) {
+    for (const auto& stat : block.stats) {
+        shape.ops += weight;
+        ++shape.nodes;
+        bool loop = stat->kind == StatKind::While || stat->kind == StatKind::Repeat ||
+                    stat->kind == StatKind::NumericFor || stat->kind == StatKind::GenericFor;
+        double inner = loop ? weight * iterations(*stat) : weight;
+        double innerEntry = loop && entry == 0 ? weight : entry;
+        // Conditions of while and repeat loops are evaluated on every iteration
+        bool conditionInside = stat->kind == StatKind::While || stat->kind == StatKind::Repeat;
+        bool assignment = stat->kind == StatKind::Local || stat->kind == StatKind::Assign;
+        for (const auto& target : stat->targets) countExpr(*target, weight, entry, true, shape, sites);
+        for (const auto& expr : stat->exprs) {
+            countExpr(*expr, conditionInside ? inner : weight, conditionInside ? innerEntry : entry, !assignment, shape, sites);
+        }
+        if (stat->expr) countExpr(*stat->expr, weight, entry, true, shape, sites);
+        for (const auto& body : stat->blocks) countBlock(*body, inner, innerEntry, shape, sites);
+    }
+}
+
+CostModel::Shape CostModel::measure(const std::string& code, const std::string& original, const ConfigParser& config, Target::Kind target) {
+    Shape shape;
+    shape.sourceBytes = code.length();
+
+    LuaParser parser(code, target);
+    BlockPtr chunk = parser.parse();
+    Annotations::spread(*chunk);
+    std::vector<Function*> functions;
+    AstWalker::forEachFunction(*chunk, [&](Function& func) { functions.push_back(&func); });
+    Function main;
+    main.name = "main chunk";
+    main.vararg = true;
+    main.body = chunk;
+    functions.push_back(&main);
+
+    std::vector<std::vector<std::pair<std::string, double>>> sites(functions.size());
+    for (size_t i = 0; i < functions.size(); ++i) {
+        Function& func = *functions[i];
+        FunctionShape function;
+        function.name = func.name.empty() ? "<anonymous>" : func.name;
+        function.line = func.line;
+        function.tier = Annotations::tierOf(func);
+        function.main = &func == &main;
+        countBlock(*func.body, 1, 0, function, sites[i]);
+        for (const auto& report : BlockFlattener::estimate(func, 0)) {
+            function.levels.push_back({report.dispatches, report.realStates});
+        }
+        shape.functions.push_back(function);
+    }
+
+    // Without a profile, calls flow down the call graph from the main chunk: each call site runs as often as its
+    // caller times the loops around it. Recursion is followed for a few rounds only.
+    std::vector<double> calls(functions.size(), 0);
+    calls.back() = 1;
+    for (int round = 0; round < CALL_ROUNDS; ++round) {
+        std::map<std::string, double> byName;
+        for (size_t i = 0; i < functions.size(); ++i) {
+            for (const auto& [name, weight] : sites[i]) {
+                if (name != lastName(functions[i]->name)) byName[name] += weight * calls[i];
+            }
+        }
+        for (size_t i = 0; i + 1 < functions.size(); ++i) {
+            auto it = functions[i]->name.empty() ? byName.end() : byName.find(lastName(functions[i]->name));
+            calls[i] = std::max(it != byName.end() ? it->second : 0.0, 1.0);
+        }
+    }
+    for (size_t i = 0; i < functions.size(); ++i) shape.functions[i].calls = calls[i];
+
+    std::string path = config.getValue("Profile", "file", "");
+    if (path.empty()) return shape;
+    try {
+        int period = 0;
+        std::vector<Profile::Entry> entries = Profile::load(path, period);
+        // Profile lines refer to the original source; its functions come in the same order as the annotated ones
+        LuaParser originalParser(original, target);
+        BlockPtr originalChunk = originalParser.parse();
+        std::vector<Function*> originals;
+        AstWalker::forEachFunction(*originalChunk, [&](Function& func) { originals.push_back(&func); });
+        if (originals.size() + 1 != functions.size()) {
+            Logger::warning("Profile " + path + " ignored by the cost model: the source changed shape");
+            return shape;
+        }
+        for (size_t i = 0; i < originals.size(); ++i) {
+            FunctionShape& function = shape.functions[i];
+            const Profile::Entry* entry = Profile::find(*originals[i], entries);
+            if (!entry) {
+                function.calls = 0;
+                continue;
+            }
+            function.calls = static_cast<double>(entry->calls);
+            if (entry->calls > 0) function.ops = static_cast<double>(entry->hits) * period / entry->calls;
+        }
+        shape.profiled = true;
+    } catch (const std::exception& e) {
+        Logger::warning("Profile ignored by the cost model: " + std::string(e.what()));
+    }
+    return shape;
+}
+
+CostModel::Estimate CostModel::estimate(const Shape& shape, const Protections& protections, const Settings& settings, const Rates& rates, Target::Kind target) {
+    using Tier = Annotations::Tier;
+    Estimate estimate;
+    estimate.bytes = static_cast<double>(shape.sourceBytes);
+    estimate.load = estimate.bytes * rates.loadByte;
+
+    bool anyMax = std::any_of(shape.functions.begin(), shape.functions.end(), [](const FunctionShape& f) { return f.tier == Tier::Max; });
+    bool hasLoad = Target::hasLoad(target);
+    bool vm = protections.vm || (anyMax && hasLoad);
+    double perStringByte = rates.decryptByte + rates.decryptBlock / blockBytes(settings.chunkSize, target);
+    size_t encryptedLiterals = 0;
+    // The VM payload grows with the code it compiles, counted in statements and operations
+    double nodes = 0;
+
+    for (const auto& f : shape.functions) {
+        double base = f.calls * (f.ops * rates.instruction + (f.main ? 0 : rates.call));
+        double added[PARTS] = {};
+        estimate.run += base;
+        nodes += f.nodes;
+
+        // The budget picks the most aggressive level that fits, as BlockFlattener does
+        bool flattened = f.tier == Tier::Max || (protections.flow && f.tier == Tier::Default);
+        double limit = f.tier == Tier::Max ? std::numeric_limits<double>::infinity() : settings.flattenBudget;
+        for (const auto& level : flattened ? f.levels : std::vector<FlattenLevel>()) {
+            size_t fakes = level.states * std::max(settings.fakeBlockPercent, 0) / 100;
+            double cost = level.dispatches * (std::ceil(std::log2(static_cast<double>(level.states + fakes))) + 1);
+            if (cost > limit) continue;
+            added[Flow] = f.calls * cost * rates.dispatch;
+            estimate.addedBytes[Flow] += (level.states + fakes) * STATE_BYTES;
+            nodes += (level.states + fakes) * STATE_NODES;
+            break;
+        }
+
+        bool encrypted = f.tier == Tier::Max || (protections.strings && f.tier == Tier::Default);
+        bool cached = protections.strings && f.tier == Tier::Fast;
+        if (encrypted && f.strings > 0) {
+            double evaluations = settings.hoistLoops ? f.strings - f.loopStrings + f.hoistedStrings : f.strings;
+            added[Strings] = f.calls * evaluations * (rates.decryptCall + f.stringBytes / f.strings * perStringByte);
+        } else if (cached) {
+            added[Strings] = f.calls * f.strings * rates.instruction;
+        }
+        if (encrypted || cached) {
+            encryptedLiterals += f.literals;
+            estimate.addedBytes[Strings] += f.literals * SITE_BYTES + f.literalBytes * (LITERAL_RATIO - 1);
+        }
+
+        // Max functions take junk_count statements, the others only what their share of budget_percent pays for
+        if (f.tier == Tier::Max) {
+            added[Junk] = f.calls * settings.junkCount * rates.junkStatement;
+            estimate.addedBytes[Junk] += settings.junkCount * JUNK_BYTES;
+            nodes += settings.junkCount * JUNK_NODES;
+        } else if (protections.junk && f.tier == Tier::Default) {
+            double budget = f.ops * settings.junkBudgetPercent / 100.0;
+            size_t placed = budget >= 1 ? settings.junkCount : 0;
+            added[Junk] = f.calls * std::min(settings.junkCount * JunkCode::averageCost(), budget) * rates.instruction;
+            estimate.addedBytes[Junk] += placed * JUNK_BYTES;
+            nodes += placed * JUNK_NODES;
+        }
+
+        // Fast and unprotected functions run natively where the runtime can load them; whatever the other passes
+        // added to an interpreted function is interpreted too, the decryptor included unless only max code is in the VM
+        bool interpreted = f.main || f.tier == Tier::Max || (protections.vm && (f.tier == Tier::Default || !hasLoad));
+        if (vm && interpreted) {
+            added[VM] = (base + added[Flow] + added[Junk] + (protections.vm ? added[Strings] : 0)) * (rates.vmFactor - 1);
+        }
+        for (int part = 0; part < PARTS; ++part) estimate.addedRun[part] += added[part];
+    }
+
+    // The decryptor is emitted whether or not any literal is left to encrypt
+    if (protections.strings || anyMax) {
+        estimate.addedBytes[Strings] += DECRYPTOR_BYTES;
+        estimate.addedLoad[Strings] += encryptedLiterals * rates.call;
+        nodes += DECRYPTOR_NODES + encryptedLiterals * SITE_NODES;
+    }
+    if (vm) {
+        // The payload carries everything the passes before it added, and replaces the source
+        double source = estimate.bytes + estimate.addedBytes[Strings] + estimate.addedBytes[Flow] + estimate.addedBytes[Junk];
+        double payload = nodes * NODE_BYTES;
+        double scrambled = settings.fakeStates + settings.jumpTableSize;
+        estimate.addedLoad[VM] += payload * (rates.decryptByte + rates.decryptBlock / blockBytes(settings.codeChunkSize, target)) +
+                                  scrambled * rates.call;
+        estimate.addedBytes[VM] += VM_RUNTIME_BYTES + payload * LITERAL_RATIO + scrambled * SCRAMBLE_BYTES - source;
+    }
+    for (int part = 0; part < PARTS; ++part) {
+        estimate.addedLoad[part] += estimate.addedBytes[part] * rates.loadByte;
+    }
+    return estimate;
+}
+
+void CostModel::fit(std::string& code, const std::string& original, ConfigParser& config, const Protections& protections, Target::Kind target) {
+    double limit = parseDouble(config.getValue("CostModel", "max_slowdown", "0"), 0);
+    if (limit <= 0) return;
+    if (limit < 1) {
+        Logger::warning("[CostModel] max_slowdown " + format("%.2f", limit) + " is below 1; settings left as configured");
+        return;
+    }
+
+    Shape shape;
+    try {
+        shape = measure(code, original, config, target);
+    } catch (const std::exception& e) {
+        Logger::warning("Cost model skipped: " + std::string(e.what()));
+        return;
+    }
+    Rates rates = CostModel::rates(target, config);
+    Settings chosen = settings(config);
+    auto cost = [&](const Settings& candidate) { return estimate(shape, protections, candidate, rates, target); };
+
+    // Chunk sizes only change speed, so each takes its cheapest value
+    auto cheapest = [&](int Settings::*field, const int* values, size_t count) {
+        double best = std::numeric_limits<double>::infinity();
+        Settings candidate = chosen;
+        for (size_t i = 0; i < count; ++i) {
+            candidate.*field = values[i];
+            Estimate e = cost(candidate);
+            double total = e.protectedRun() + e.protectedLoad();
+            if (total < best) {
+                best = total;
+                chosen.*field = values[i];
+            }
+        }
+    };
+    cheapest(&Settings::chunkSize, CHUNK_SIZES, std::size(CHUNK_SIZES));
+    cheapest(&Settings::codeChunkSize, CODE_CHUNK_SIZES, std::size(CODE_CHUNK_SIZES));
+
+    // Only the knobs of protections that run are searched; each counts the same towards strength
+    bool anyMax = std::any_of(shape.functions.begin(), shape.functions.end(), [](const FunctionShape& f) { return f.tier == Annotations::Tier::Max; });
+    bool vm = protections.vm || (anyMax && Target::hasLoad(target));
+    std::vector<std::pair<int Settings::*, const std::vector<int>*>> knobs;
+    if (protections.flow || anyMax) {
+        knobs.emplace_back(&Settings::flattenBudget, &FLATTEN_BUDGETS);
+        knobs.emplace_back(&Settings::fakeBlockPercent, &FAKE_BLOCK_PERCENTS);
+    }
+    if (protections.junk || anyMax) knobs.emplace_back(&Settings::junkCount, &JUNK_COUNTS);
+    if (vm) {
+        knobs.emplace_back(&Settings::fakeStates, &FAKE_STATES);
+        knobs.emplace_back(&Settings::jumpTableSize, &JUMP_TABLE_SIZES);
+    }
+
+    auto search = [&](Settings& best) {
+        double bestStrength = -1, bestSlowdown = 0;
+        std::vector<size_t> index(knobs.size(), 0);
+        Settings candidate = chosen;
+        while (true) {
+            double strength = 0;
+            for (size_t k = 0; k < knobs.size(); ++k) {
+                candidate.*knobs[k].first = (*knobs[k].second)[index[k]];
+                strength += static_cast<double>(index[k]) / (knobs[k].second->size() - 1);
+            }
+            double slowdown = cost(candidate).slowdown();
+            if (slowdown <= limit && (strength > bestStrength || (strength == bestStrength && slowdown < bestSlowdown))) {
+                best = candidate;
+                bestStrength = strength;
+                bestSlowdown = slowdown;
+            }
+            size_t k = 0;
+            while (k < knobs.size() && ++index[k] == knobs[k].second->size()) index[k++] = 0;
+            if (k == knobs.size()) break;
+        }
+        return bestStrength >= 0;
+    };
+
+    Settings best = chosen;
+    for (const auto& [field, values] : knobs) best.*field = values->front();
+    std::vector<size_t> marked;
+    if (!search(best)) {
+        // The lightest settings are over budget: the costliest default functions are protected as fast code instead
+        std::vector<size_t> order;
+        for (size_t i = 0; i < shape.functions.size(); ++i) {
+            if (!shape.functions[i].main && shape.functions[i].tier == Annotations::Tier::Default) order.push_back(i);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            const FunctionShape& x = shape.functions[a];
+            const FunctionShape& y = shape.functions[b];
+            return x.calls * (x.ops + 1) > y.calls * (y.ops + 1);
+        });
+        for (size_t i : order) {
+            shape.functions[i].tier = Annotations::Tier::Fast;
+            marked.push_back(i);
+            if (cost(best).slowdown() <= limit) break;
+        }
+        if (!search(best)) {
+            Logger::warning("Cost model: even the lightest settings are estimated at " + format("%.2f", cost(best).slowdown()) +
+                            "x, over the " + format("%.2f", limit) + "x budget");
+        }
+    }
+
+    if (!marked.empty()) {
+        LuaParser parser(code, target);
+        BlockPtr chunk = parser.parse();
+        Annotations::spread(*chunk);
+        std::vector<Function*> functions;
+        AstWalker::forEachFunction(*chunk, [&](Function& func) { functions.push_back(&func); });
+        std::string names;
+        for (size_t i : marked) {
+            functions[i]->annotation = Annotations::name(Annotations::Tier::Fast);
+            names += (names.empty() ? "" : ", ") + shape.functions[i].name + " (line " + std::to_string(shape.functions[i].line) + ")";
+        }
+        code = LuaPrinter::print(*chunk, true);
+        Logger::info("Cost model: " + std::to_string(marked.size()) + " functions protected as fast code to fit the budget");
+        Logger::debug("Fitted as fast: " + names);
+    }
+
+    config.setValue("Encryption", "chunk_size", std::to_string(best.chunkSize));
+    config.setValue("VM", "code_chunk_size", std::to_string(best.codeChunkSize));
+    config.setValue("ControlFlow", "fake_states", std::to_string(best.fakeStates));
+    config.setValue("ControlFlow", "jump_table_size", std::to_string(best.jumpTableSize));
+    config.setValue("Junk", "junk_count", std::to_string(best.junkCount));
+    config.setValue("ControlFlow", "flatten_budget", std::to_string(best.flattenBudget));
+    config.setValue("ControlFlow", "fake_block_percent", std::to_string(best.fakeBlockPercent));
+    double slowdown = cost(best).slowdown();
+    Logger::info("Cost model: estimated slowdown " + format("%.2f", slowdown) + "x " + (slowdown <= limit ? "within" : "over") + " the " +
+                 format("%.2f", limit) + "x budget (" + (shape.profiled ? "profiled" : "static") + " estimate)");
+}
+
+std::string CostModel::report(const Shape& shape, const Estimate& estimate, const Settings& settings, const Rates& rates) {
+    static const char* NAMES[PARTS] = {"strings", "control flow", "junk code", "vm"};
+    std::stringstream ss;
+    char row[160];
+    size_t nodes = 0, literals = 0, flattenable = 0;
+    for (const auto& f : shape.functions) {
+        nodes += f.nodes;
+        literals += f.literals;
+        if (!f.levels.empty()) ++flattenable;
+    }
+    ss << shape.functions.size() << " functions (" << flattenable << " flattenable), " << nodes << " statements and operations, "
+       << literals << " encryptable string literals\n";
+    ss << "                     run ms     load ms        bytes\n";
+    std::snprintf(row, sizeof(row), "%-14s %11.3f %11.3f %12.0f\n", "original", estimate.run * 1e-6, estimate.load * 1e-6, estimate.bytes);
+    ss << row;
+    for (int part = 0; part < PARTS; ++part) {
+        if (estimate.addedRun[part] == 0 && estimate.addedLoad[part] == 0 && estimate.addedBytes[part] == 0) continue;
+        std::snprintf(row, sizeof(row), "%-14s %+11.3f %+11.3f %+12.0f\n", NAMES[part],
+                      estimate.addedRun[part] * 1e-6, estimate.addedLoad[part] * 1e-6, estimate.addedBytes[part]);
+        ss << row;
+    }
+    std::snprintf(row, sizeof(row), "%-14s %11.3f %11.3f %12.0f   slowdown %.2fx\n", "protected",
+                  estimate.protectedRun() * 1e-6, estimate.protectedLoad() * 1e-6, estimate.protectedBytes(), estimate.slowdown());
+    ss << row;
+    ss << "settings: chunk_size=" << settings.chunkSize << " code_chunk_size=" << settings.codeChunkSize
+       << " fake_states=" << settings.fakeStates << " jump_table_size=" << settings.jumpTableSize
+       << " junk_count=" << settings.junkCount << " junk_budget_percent=" << settings.junkBudgetPercent << " flatten_budget=" << settings.flattenBudget
+       << " fake_block_percent=" << settings.fakeBlockPercent << "\n";
+    ss << "rates (ns):";
+    for (const auto& rate : RATE_KEYS) ss << " " << rate.key << "=" << format("%.3g", rates.*rate.field);
+    ss << "\n";
+    return ss.str();
+}
+
+std::string CostModel::benchmark(Target::Kind target, const ConfigParser& config) {
+    std::vector<uint8_t> key(16);
+    for (size_t i = 0; i < key.size(); ++i) key[i] = static_cast<uint8_t>(i * 37 + 11);
+    std::string text;
+    for (size_t i = 0; i < 1024; ++i) text += static_cast<char>('a' + (i * 7 + i / 26) % 26);
+    std::string small = text.substr(0, 16);
+
+    // The same function plain and flattened at the most aggressive level
+    const std::string sample =
+        "function(n)\n"
+        "    local total = 0\n"
+        "    for i = 1, n do\n"
+        "        if i % 3 == 0 then\n"
+        "            total = total + i\n"
+        "        elseif i % 3 == 1 then\n"
+        "            total = total - 1\n"
+        "        else\n"
+        "            total = total * 2\n"
+        "        end\n"
+        "    end\n"
+        "    local j = 0\n"
+        "    while j < n do\n"
+        "        j = j + 2\n"
+        "        if j > 4 then total = total + j end\n"
+        "    end\n"
+        "    return total\n"
+        "end";
+    LuaParser parser("local plain = " + sample + "\nlocal flat = " + sample + "\n", target);
+    BlockPtr samples = parser.parse();
+    std::mt19937 gen(1);
+    BlockFlattener::Report flattened = BlockFlattener::flatten(*samples->stats[1]->exprs[0]->func, std::numeric_limits<double>::infinity(), 0, gen);
+
+    // Work for the interpreter: calls, arithmetic, table reads and writes
+    const std::string workload =
+        "local function fib(n) if n < 2 then return n end return fib(n - 1) + fib(n - 2) end\n"
+        "local t, s = {}, 0\n"
+        "for i = 1, 2000 do t[i] = (i * 7) % 13 end\n"
+        "for r = 1, 20 do for i = 1, #t do s = s + t[i] end end\n"
+        "return fib(16) + s\n";
+    ConfigParser vmConfig = config;
+    vmConfig.setValue("Output", "target", Target::name(target));
+    vmConfig.setValue("VM", "mode", "bytecode");
+    vmConfig.setValue("Compression", "enabled", "false");
+    bool logging = Logger::isEnabled();
+    Logger::setEnabled(false);
+    std::string wrapped = VMProtection::wrapCode(workload, key, 100, vmConfig);
+    std::string junk = JunkCode::generate(100);
+    Logger::setEnabled(logging);
+
+    std::stringstream ss;
+    ss << "-- Cost model rates for " << Target::name(target) << ", generated by `obfuscator calibrate`\n"
+       << "-- Usage: lua <this file> > costmodel.ini, then point [CostModel] calibration at costmodel.ini\n"
+       << "local embedded = ...\n"
+       << "local clock = os.clock\n"
+       << "local loadstring = loadstring or load\n\n"
+       << "-- Nanoseconds per iteration of fn(n), best of five runs\n"
+       << "local function best(fn, n)\n"
+       << "    local fastest = math.huge\n"
+       << "    for _ = 1, 5 do\n"
+       << "        collectgarbage('collect')\n"
+       << "        local start = clock()\n"
+       << "        fn(n)\n"
+       << "        local elapsed = clock() - start\n"
+       << "        if elapsed < fastest then fastest = elapsed end\n"
+       << "    end\n"
+       << "    return fastest / n * 1e9\n"
+       << "end\n\n"
+       << "local rates = {}\n\n";
+
+    // An iteration is two counted operations: the statement and the addition
+    ss << "rates.instruction = best(function(n) local x = 0 for i = 1, n do x = x + i end return x end, 2000000) / 2\n"
+       << "local function id(a) return a end\n"
+       << "-- A JIT can optimize a call or a dispatch away completely; they still cost at least an instruction\n"
+       << "rates.call = math.max(best(function(n) local x for i = 1, n do x = id(i) end return x end, 1000000) - 3 * rates.instruction, rates.instruction)\n\n";
+
+    ss << PayloadEncoder::generateDecryptor(8, target, "")
+       << "local decryptSmall = __decrypt\n"
+       << PayloadEncoder::generateDecryptor(64, target, "")
+       << "local decryptLarge = __decrypt\n"
+       << "local key = " << "{";
+    for (size_t i = 0; i < key.size(); ++i) ss << (i > 0 ? "," : "") << static_cast<int>(key[i]);
+    ss << "}\n"
+       << "local short, long = " << PayloadEncoder::toLuaLiteral(PayloadEncoder::encrypt(small, key)) << ", "
+       << PayloadEncoder::toLuaLiteral(PayloadEncoder::encrypt(text, key)) << "\n"
+       << "assert(decryptSmall(long, key) == " << PayloadEncoder::toLuaLiteral(text) << " and decryptLarge(short, key) == "
+       << PayloadEncoder::toLuaLiteral(small) << ", 'decryptor mismatch')\n"
+       << "local longSmall = best(function(n) for _ = 1, n do decryptSmall(long, key) end end, 200)\n"
+       << "local longLarge = best(function(n) for _ = 1, n do decryptLarge(long, key) end end, 200)\n"
+       << "local shortLarge = best(function(n) for _ = 1, n do decryptLarge(short, key) end end, 20000)\n"
+       << "local smallBlock, largeBlock = " << blockBytes(8, target) << ", " << blockBytes(64, target) << "\n"
+       << "rates.decrypt_block = math.max((longSmall - longLarge) / (1024 / smallBlock - 1024 / largeBlock), 0)\n"
+       << "rates.decrypt_byte = math.max((longLarge - shortLarge - (1024 - 16) / largeBlock * rates.decrypt_block) / (1024 - 16), 0)\n"
+       << "rates.decrypt_call = math.max(shortLarge - 16 * rates.decrypt_byte, 0)\n\n";
+
+    // Dispatch cost per unit of the flattener's estimate, for which the sample's loops run about eight times
+    ss << "local plain, flat = (function()\n" << LuaPrinter::print(*samples) << "return plain, flat\nend)()\n"
+       << "local plainTime = best(function(n) for _ = 1, n do plain(8) end end, 20000)\n"
+       << "local flatTime = best(function(n) for _ = 1, n do flat(8) end end, 20000)\n"
+       << "rates.dispatch = math.max((flatTime - plainTime) / " << std::max(flattened.cost, 1.0) << ", rates.instruction)\n\n";
+
+    ss << "local workload = " << PayloadEncoder::toLuaLiteral(workload) << "\n"
+       << "local wrapped = " << PayloadEncoder::toLuaLiteral(wrapped) << "\n"
+       << "local nativeChunk, vmChunk = assert(loadstring(workload)), assert(loadstring(wrapped))\n"
+       << "rates.vm_factor = best(function(n) for _ = 1, n do vmChunk() end end, 3) / best(function(n) for _ = 1, n do nativeChunk() end end, 3)\n"
+       << "local source = string.rep('do\\n' .. workload:gsub('return ', 'local _ = ') .. 'end\\n', 20)\n"
+       << "rates.load_byte = best(function(n) for _ = 1, n do loadstring(source) end end, 20) / #source\n"
+       << "local junk = assert(loadstring(" << PayloadEncoder::toLuaLiteral(junk) << "))\n"
+       << "rates.junk_statement = best(function(n) for _ = 1, n do junk() end end, 2000) / 100\n\n";
+
+    ss << "local lines = {'[CostModel]', 'target=" << Target::name(target) << "'}\n"
+       << "for _, name in ipairs({";
+    bool first = true;
+    for (const auto& rate : RATE_KEYS) {
+        ss << (first ? "" : ", ") << "'" << rate.key << "'";
+        first = false;
+    }
+    ss << "}) do\n"
+       << "    lines[#lines + 1] = string.format('%s=%.3f', name, rates[name])\n"
+       << "end\n"
+       << "local ini = table.concat(lines, '\\n') .. '\\n'\n"
+       << "if not embedded then io.write(ini) end\n"
+       << "return ini\n";
+    return ss.str();
+}
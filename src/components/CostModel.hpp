@@ -0,0 +1,122 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Annotations.hpp"
+#include "ConfigParser.hpp"
+#include "Target.hpp"
+#include "parser/LuaAst.hpp"
+
+// Estimates what each protection adds to the run time, load time and size of a script, from the shape of its
+// functions and per-target rates measured by a benchmark (`obfuscator calibrate`). Execution counts come from the
+// [Profile] file when there is one; otherwise numeric loops with literal bounds run their count, other loops
+// LOOP_ITERATIONS times, and a function as often as its call sites do. With [CostModel] max_slowdown set, the strongest settings whose estimate stays within it are
+// written back into the config before the protections run.
+class CostModel {
+public:
+    // Nanoseconds, except vmFactor which multiplies the run time of code the VM interprets
+    struct Rates {
+        double instruction = 0;
+        double call = 0;
+        double decryptCall = 0;
+        double decryptByte = 0;
+        double decryptBlock = 0;
+        double dispatch = 0;
+        double vmFactor = 1;
+        double loadByte = 0;
+        double junkStatement = 0;
+    };
+
+    struct Protections {
+        bool strings = false;
+        bool flow = false;
+        bool junk = false;
+        bool vm = false;
+    };
+
+    // The knobs the fit chooses; the chunk sizes only trade speed, the others also strength
+    struct Settings {
+        int chunkSize = 20;
+        int codeChunkSize = 100;
+        int fakeStates = 15;
+        int jumpTableSize = 10;
+        int junkCount = 3;
+        int junkBudgetPercent = 10;
+        int flattenBudget = 150;
+        int fakeBlockPercent = 50;
+        bool hoistLoops = true;
+    };
+
+    // Flattening levels as BlockFlattener::estimate reports them, most aggressive first
+    struct FlattenLevel {
+        double dispatches = 0;
+        size_t states = 0;
+    };
+
+    struct FunctionShape {
+        std::string name;
+        int line = 0;
+        Annotations::Tier tier = Annotations::Tier::Default;
+        bool main = false;
+        double calls = 1;
+        // Per call, weighted by the loops around them
+        double ops = 0;
+        double strings = 0;
+        double stringBytes = 0;
+        double loopStrings = 0;
+        double hoistedStrings = 0;
+        // Static counts, for the size estimate
+        size_t nodes = 0;
+        size_t literals = 0;
+        size_t literalBytes = 0;
+        std::vector<FlattenLevel> levels;
+    };
+
+    struct Shape {
+        std::vector<FunctionShape> functions;
+        size_t sourceBytes = 0;
+        bool profiled = false;
+    };
+
+    enum Part { Strings, Flow, Junk, VM, PARTS };
+
+    struct Estimate {
+        double run = 0;
+        double load = 0;
+        double bytes = 0;
+        double addedRun[PARTS] = {};
+        double addedLoad[PARTS] = {};
+        double addedBytes[PARTS] = {};
+
+        double protectedRun() const;
+        double protectedLoad() const;
+        double protectedBytes() const;
+        // Run plus load time of the protected script over the original's
+        double slowdown() const;
+    };
+
+    static Rates rates(Target::Kind target, const ConfigParser& config);
+    static Settings settings(const ConfigParser& config);
+    static Protections protections(const ConfigParser& config);
+
+    // `original` is the source the [Profile] lines refer to, `code` the annotated source the protections will see
+    static Shape measure(const std::string& code, const std::string& original, const ConfigParser& config, Target::Kind target);
+    static Estimate estimate(const Shape& shape, const Protections& protections, const Settings& settings, const Rates& rates, Target::Kind target);
+    // Applies [CostModel] max_slowdown to the config; functions that still do not fit are tagged fast in `code`
+    static void fit(std::string& code, const std::string& original, ConfigParser& config, const Protections& protections, Target::Kind target);
+    static std::string report(const Shape& shape, const Estimate& estimate, const Settings& settings, const Rates& rates);
+
+    // Lua benchmark printing the [CostModel] rates of the runtime it runs on; returns them too when run embedded
+    static std::string benchmark(Target::Kind target, const ConfigParser& config);
+
+    // Weighted operations one call of `func` runs, not counting the functions it calls
+    static double work(const Function& func);
+    // Expected iterations of a loop statement
+    static double iterations(const Stat& stat);
+
+private:
+    static constexpr double LOOP_ITERATIONS = 8.0;
+    static constexpr int CALL_ROUNDS = 4;
+
+    static void countBlock(const Block& block, double weight, double entry, FunctionShape& shape, std::vector<std::pair<std::string, double>>& sites);
+    static void countExpr(const Expr& expr, double weight, double entry, bool encrypted, FunctionShape& shape, std::vector<std::pair<std::string, double>>& sites);
+};
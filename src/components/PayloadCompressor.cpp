@@ -0,0 +1,344 @@
+#include "PayloadCompressor.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include "Logger.hpp"
+
+PayloadCompressor::Params PayloadCompressor::forLevel(int level) {
+    switch (std::clamp(level, 1, MAX_LEVEL)) {
+        case 1: return {1, false, false, 0};
+        case 2: return {4, false, false, 32};
+        case 3: return {8, false, false, 64};
+        case 4: return {16, false, false, 128};
+        case 5: return {32, true, false, 128};
+        case 6: return {128, true, false, 256};
+        case 7: return {64, false, true, 128};
+        case 8: return {256, false, true, 256};
+        default: return {1024, false, true, 1024};
+    }
+}
+
+uint32_t PayloadCompressor::hash(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+size_t PayloadCompressor::matchLength(const uint8_t* a, const uint8_t* b, const uint8_t* limit) {
+    const uint8_t* from = b;
+    while (b + 8 <= limit) {
+        uint64_t x, y;
+        std::memcpy(&x, a, 8);
+        std::memcpy(&y, b, 8);
+        if (x != y) break;
+        a += 8;
+        b += 8;
+    }
+    while (b < limit && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return static_cast<size_t>(b - from);
+}
+
+void PayloadCompressor::writeLength(std::string& out, size_t value) {
+    for (; value >= 255; value -= 255) out += static_cast<char>(255);
+    out += static_cast<char>(value);
+}
+
+void PayloadCompressor::writeSequence(std::string& out, size_t literals, size_t count, size_t offset, size_t length) {
+    size_t extra = length ? length - MIN_MATCH : 0;
+    out += static_cast<char>(std::min<size_t>(count, 15) << 4 | std::min<size_t>(extra, 15));
+    if (count >= 15) writeLength(out, count - 15);
+    out.append(reinterpret_cast<const char*>(data + literals), count);
+    if (!length) return;
+    out += static_cast<char>(offset & 0xFF);
+    out += static_cast<char>(offset >> 8);
+    if (extra >= 15) writeLength(out, extra - 15);
+    ++stats->matches;
+}
+
+// Positions are absolute; anything before the current block reads as empty, so tables survive across blocks
+void PayloadCompressor::insertUpTo(size_t pos) {
+    for (; inserted < pos && inserted + MIN_MATCH <= end; ++inserted) {
+        uint32_t& bucket = head[hash(data + inserted)];
+        chain[inserted - start] = bucket;
+        bucket = static_cast<uint32_t>(inserted + 1);
+    }
+}
+
+size_t PayloadCompressor::findMatch(size_t pos, size_t& offset) {
+    insertUpTo(pos);
+    size_t best = MIN_MATCH - 1;
+    uint32_t candidate = head[hash(data + pos)];
+    for (size_t probes = 0; candidate > start && probes < params.depth; ++probes) {
+        size_t from = candidate - 1;
+        // A longer match has to agree at the current best length first
+        if (data[from + best] == data[pos + best]) {
+            size_t length = matchLength(data + from, data + pos, data + end);
+            if (length > best) {
+                best = length;
+                offset = pos - from;
+                if (length >= params.nice) break;
+            }
+        }
+        candidate = chain[from - start];
+    }
+    insertUpTo(pos + 1);
+    return best >= MIN_MATCH ? best : 0;
+}
+
+std::string PayloadCompressor::compressFast() {
+    std::string out;
+    size_t pos = start, anchor = start, misses = 0;
+    while (pos + MIN_MATCH <= end) {
+        uint32_t& bucket = head[hash(data + pos)];
+        size_t from = bucket > start ? bucket - 1 : pos;
+        bucket = static_cast<uint32_t>(pos + 1);
+        if (from == pos || std::memcmp(data + from, data + pos, MIN_MATCH) != 0) {
+            // Incompressible stretches are skipped faster the longer they run
+            pos += 1 + (misses++ >> 5);
+            continue;
+        }
+        misses = 0;
+        size_t length = matchLength(data + from, data + pos, data + end);
+        writeSequence(out, anchor, pos - anchor, pos - from, length);
+        pos += length;
+        anchor = pos;
+        if (pos - 2 >= start && pos - 2 + MIN_MATCH <= end) head[hash(data + pos - 2)] = static_cast<uint32_t>(pos - 1);
+    }
+    writeSequence(out, anchor, end - anchor, 0, 0);
+    return out;
+}
+
+std::string PayloadCompressor::compressGreedy() {
+    std::string out;
+    size_t pos = start, anchor = start;
+    while (pos + MIN_MATCH <= end) {
+        size_t offset = 0;
+        size_t length = findMatch(pos, offset);
+        if (!length) {
+            ++pos;
+            continue;
+        }
+        // Lazy evaluation: give up this match when the next position starts a longer one
+        while (params.lazy && length < params.nice && pos + 1 + MIN_MATCH <= end) {
+            size_t nextOffset = 0;
+            size_t next = findMatch(pos + 1, nextOffset);
+            if (next <= length) break;
+            ++pos;
+            length = next;
+            offset = nextOffset;
+        }
+        writeSequence(out, anchor, pos - anchor, offset, length);
+        pos += length;
+        anchor = pos;
+    }
+    writeSequence(out, anchor, end - anchor, 0, 0);
+    return out;
+}
+
+std::string PayloadCompressor::compressOptimal() {
+    // Cheapest encoding of every prefix in bytes, literals costing 1 and matches their token, offset and extensions
+    size_t size = end - start;
+    std::vector<uint32_t> cost(size + 1, UINT32_MAX), length(size + 1, 0), offsets(size + 1, 0);
+    cost[0] = 0;
+    auto matchCost = [](size_t matched) {
+        size_t extra = matched - MIN_MATCH;
+        return static_cast<uint32_t>(3 + (extra >= 15 ? 1 + (extra - 15) / 255 : 0));
+    };
+
+    for (size_t i = 0; i < size; ++i) {
+        if (cost[i] + 1 < cost[i + 1]) {
+            cost[i + 1] = cost[i] + 1;
+            length[i + 1] = 1;
+        }
+        size_t pos = start + i;
+        if (pos + MIN_MATCH > end) continue;
+
+        insertUpTo(pos);
+        size_t best = MIN_MATCH - 1;
+        uint32_t candidate = head[hash(data + pos)];
+        for (size_t probes = 0; candidate > start && probes < params.depth; ++probes) {
+            size_t from = candidate - 1;
+            if (data[from + best] == data[pos + best]) {
+                size_t found = matchLength(data + from, data + pos, data + end);
+                // Every length the previous candidates could not reach is priced with this offset
+                for (size_t l = best + 1; l <= found; ++l) {
+                    uint32_t total = cost[i] + matchCost(l);
+                    if (total < cost[i + l]) {
+                        cost[i + l] = total;
+                        length[i + l] = static_cast<uint32_t>(l);
+                        offsets[i + l] = static_cast<uint32_t>(pos - from);
+                    }
+                }
+                best = std::max(best, found);
+                if (best >= params.nice) break;
+            }
+            candidate = chain[from - start];
+        }
+        insertUpTo(pos + 1);
+        // Past the nice length the match is taken as is and the positions it covers are not searched
+        if (best >= params.nice) {
+            insertUpTo(pos + best);
+            i += best - 1;
+        }
+    }
+
+    std::vector<std::pair<size_t, size_t>> steps;
+    for (size_t i = size; i > 0; i -= length[i]) steps.emplace_back(length[i], offsets[i]);
+    std::string out;
+    size_t pos = start, anchor = start;
+    for (auto it = steps.rbegin(); it != steps.rend(); ++it) {
+        if (it->first >= MIN_MATCH) {
+            writeSequence(out, anchor, pos - anchor, it->second, it->first);
+            anchor = pos + it->first;
+        }
+        pos += it->first;
+    }
+    writeSequence(out, anchor, end - anchor, 0, 0);
+    return out;
+}
+
+std::vector<std::string> PayloadCompressor::compress(const std::string& input, int level, Stats& stats) {
+    auto began = std::chrono::steady_clock::now();
+    PayloadCompressor compressor;
+    compressor.data = reinterpret_cast<const uint8_t*>(input.data());
+    compressor.head.assign(size_t(1) << HASH_BITS, 0);
+    compressor.chain.assign(std::min(BLOCK_SIZE, input.length()), 0);
+    compressor.params = forLevel(level);
+    compressor.stats = &stats;
+
+    std::vector<std::string> blocks;
+    for (size_t offset = 0; offset < input.length(); offset += BLOCK_SIZE) {
+        compressor.start = compressor.inserted = offset;
+        compressor.end = std::min(offset + BLOCK_SIZE, input.length());
+        std::string packed = compressor.params.optimal ? compressor.compressOptimal()
+                           : compressor.params.depth > 1 ? compressor.compressGreedy()
+                           : compressor.compressFast();
+
+        size_t size = compressor.end - compressor.start;
+        if (packed.length() < size) {
+            blocks.push_back('\1' + packed);
+        } else {
+            blocks.push_back('\0' + input.substr(offset, size));
+            ++stats.stored;
+        }
+        stats.outputBytes += blocks.back().length();
+    }
+
+    stats.inputBytes += input.length();
+    stats.blocks += blocks.size();
+    stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+    return blocks;
+}
+
+std::string PayloadCompressor::decompress(const std::string& block) {
+    if (block.empty() || block[0] == '\0') return block.empty() ? block : block.substr(1);
+
+    auto in = reinterpret_cast<const uint8_t*>(block.data());
+    size_t p = 1, size = block.length();
+    auto readLength = [&](size_t value) {
+        for (uint8_t extra = 255; value >= 15 && extra == 255; value += extra) {
+            if (p >= size) throw std::runtime_error("truncated length");
+            extra = in[p++];
+        }
+        return value;
+    };
+
+    std::string out;
+    while (p < size) {
+        uint8_t token = in[p++];
+        size_t count = readLength(token >> 4);
+        if (p + count > size) throw std::runtime_error("truncated literals");
+        out.append(block, p, count);
+        p += count;
+        if (p >= size) break;
+
+        if (p + 2 > size) throw std::runtime_error("truncated offset");
+        size_t offset = in[p] | in[p + 1] << 8;
+        p += 2;
+        size_t length = readLength(token & 15) + MIN_MATCH;
+        if (offset == 0 || offset > out.length()) throw std::runtime_error("offset out of range");
+        for (size_t from = out.length() - offset; length > 0; --length) out += out[from++];
+    }
+    return out;
+}
+
+void PayloadCompressor::report(const Stats& stats, int level) {
+    double ratio = stats.inputBytes ? static_cast<double>(stats.outputBytes) / stats.inputBytes * 100 : 0;
+    double throughput = stats.seconds > 0 ? stats.inputBytes / stats.seconds / 1e6 : 0;
+    Logger::info("Compressed payload " + std::to_string(stats.inputBytes) + " -> " + std::to_string(stats.outputBytes) +
+                 " bytes (" + std::to_string(static_cast<int>(ratio + 0.5)) + "%) at level " + std::to_string(level) + ": " +
+                 std::to_string(stats.blocks) + " blocks (" + std::to_string(stats.stored) + " stored), " +
+                 std::to_string(stats.matches) + " matches, " + std::to_string(static_cast<int>(throughput + 0.5)) + " MB/s");
+}
+
+double PayloadCompressor::estimateUnpackSeconds(const Stats& stats, Target::Kind target) {
+    // Nanoseconds per decompressed byte from bench/compress.lua; the cost barely depends on the level, and Luau is
+    // assumed to be no faster than Lua 5.1
+    double perByte = 110;
+    if (target == Target::Lua54) perByte = 80;
+    if (target == Target::LuaJIT) perByte = 28;
+    return stats.inputBytes * perByte * 1e-9;
+}
+
+std::string PayloadCompressor::generateDecompressor(Target::Kind target) {
+    // Lua 5.4 has integer shifts; the other runtimes split the token arithmetically
+    bool integers = target == Target::Lua54;
+    std::string high = integers ? "token >> 4" : "floor(token / 16)";
+    std::string low = integers ? "token & 15" : "token % 16";
+
+    std::stringstream ss;
+    ss << "local __decompress\n"
+       << "do\n"
+       << "    local byte, char, concat, floor = string.byte, string.char, table.concat, math.floor\n"
+       << "    local unpack = table.unpack or unpack\n"
+       << "    __decompress = function(data)\n"
+       << "        if byte(data, 1) == 0 then return data:sub(2) end\n"
+       << "        local out, n, p, size = {}, 0, 2, #data\n"
+       << "        while p <= size do\n"
+       << "            local token = byte(data, p)\n"
+       << "            p = p + 1\n"
+       << "            local count = " << high << "\n"
+       << "            if count == 15 then\n"
+       << "                repeat\n"
+       << "                    local extra = byte(data, p)\n"
+       << "                    p = p + 1\n"
+       << "                    count = count + extra\n"
+       << "                until extra ~= 255\n"
+       << "            end\n"
+       << "            for i = p, p + count - 1 do\n"
+       << "                n = n + 1\n"
+       << "                out[n] = byte(data, i)\n"
+       << "            end\n"
+       << "            p = p + count\n"
+       << "            if p > size then break end\n"
+       << "            local lo, hi = byte(data, p, p + 1)\n"
+       << "            p = p + 2\n"
+       << "            local length = " << low << "\n"
+       << "            if length == 15 then\n"
+       << "                repeat\n"
+       << "                    local extra = byte(data, p)\n"
+       << "                    p = p + 1\n"
+       << "                    length = length + extra\n"
+       << "                until extra ~= 255\n"
+       << "            end\n"
+       // Copied forward one byte at a time, so a match may overlap the bytes it produces
+       << "            local from = n - lo - hi * 256\n"
+       << "            for i = from + 1, from + length + 4 do\n"
+       << "                n = n + 1\n"
+       << "                out[n] = out[i]\n"
+       << "            end\n"
+       << "        end\n"
+       << "        local parts = {}\n"
+       << "        for i = 1, n, 4096 do\n"
+       << "            parts[#parts + 1] = char(unpack(out, i, i + 4095 < n and i + 4095 or n))\n"
+       << "        end\n"
+       << "        return concat(parts)\n"
+       << "    end\n"
+       << "end\n\n";
+    return ss.str();
+}
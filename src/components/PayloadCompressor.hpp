@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Target.hpp"
+
+// LZ77 compression for VM payloads, in an LZ4-style byte format that decodes quickly in plain Lua. Input is cut into
+// independent blocks so each encrypted piece decompresses on its own. The level picks the match finder: a single
+// probe per position (1), hash chains searched greedily (2-4) or lazily (5-6), and optimal parsing (7-9).
+//
+// Block: 0 followed by the raw bytes, or 1 followed by sequences of
+//   token (literal count << 4 | match length - 4), [count extension], literals, offset (2 bytes LE), [length extension]
+// where a nibble of 15 continues in extension bytes that each add 0-255 until one is below 255. The last sequence of a
+// block may end after its literals.
+class PayloadCompressor {
+public:
+    static constexpr size_t BLOCK_SIZE = 65535;
+    static constexpr int MAX_LEVEL = 9;
+
+    struct Stats {
+        size_t inputBytes = 0;
+        size_t outputBytes = 0;
+        size_t blocks = 0;
+        size_t stored = 0;
+        size_t matches = 0;
+        double seconds = 0;
+    };
+
+    static std::vector<std::string> compress(const std::string& input, int level, Stats& stats);
+    static std::string decompress(const std::string& block);
+    static void report(const Stats& stats, int level);
+    // Time the generated decompressor needs for the payload, from its measured per-byte cost on each runtime
+    static double estimateUnpackSeconds(const Stats& stats, Target::Kind target);
+    static std::string generateDecompressor(Target::Kind target);
+
+private:
+    static constexpr size_t MIN_MATCH = 4;
+    static constexpr int HASH_BITS = 16;
+
+    struct Params {
+        size_t depth;
+        bool lazy;
+        bool optimal;
+        size_t nice;
+    };
+
+    const uint8_t* data = nullptr;
+    size_t start = 0;
+    size_t end = 0;
+    size_t inserted = 0;
+    std::vector<uint32_t> head;
+    std::vector<uint32_t> chain;
+    Params params{};
+    Stats* stats = nullptr;
+
+    static Params forLevel(int level);
+    static uint32_t hash(const uint8_t* p);
+    static size_t matchLength(const uint8_t* a, const uint8_t* b, const uint8_t* limit);
+    static void writeLength(std::string& out, size_t value);
+    void writeSequence(std::string& out, size_t literals, size_t count, size_t offset, size_t length);
+
+    void insertUpTo(size_t pos);
+    size_t findMatch(size_t pos, size_t& offset);
+    std::string compressFast();
+    std::string compressGreedy();
+    std::string compressOptimal();
+};
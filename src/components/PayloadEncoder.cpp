@@ -0,0 +1,242 @@
+#include "PayloadEncoder.hpp"
+#include <algorithm>
+#include <sstream>
+
+std::string PayloadEncoder::encrypt(const std::string& input, const std::vector<uint8_t>& key) {
+    std::string encrypted(input.length(), '\0');
+    for (size_t i = 0; i < input.length(); ++i) {
+        uint8_t byte = static_cast<uint8_t>(input[i]);
+        byte ^= key[i % key.size()];
+        byte = (byte << 3) | (byte >> 5);
+        encrypted[i] = static_cast<char>(byte);
+    }
+    return encrypted;
+}
+
+std::string PayloadEncoder::toLuaLiteral(const std::string& bytes) {
+    std::string result;
+    result.reserve(bytes.length() + bytes.length() / 4 + 2);
+    result += '"';
+
+    for (size_t i = 0; i < bytes.length(); ++i) {
+        uint8_t byte = static_cast<uint8_t>(bytes[i]);
+
+        if (byte == '"' || byte == '\\') {
+            result += '\\';
+            result += static_cast<char>(byte);
+        } else if (byte == '\n') {
+            result += "\\n";
+        } else if (byte < 0x20 || byte == 0x7F || byte == ']') {
+            // Control bytes would be mangled by text-mode I/O, and ']' could close an enclosing long bracket
+            bool digitFollows = i + 1 < bytes.length() && bytes[i + 1] >= '0' && bytes[i + 1] <= '9';
+            std::string digits = std::to_string(byte);
+            result += '\\';
+            if (digitFollows) result.append(3 - digits.length(), '0');
+            result += digits;
+        } else {
+            result += static_cast<char>(byte);
+        }
+    }
+
+    result += '"';
+    return result;
+}
+
+std::string PayloadEncoder::toLuaList(const std::vector<size_t>& values) {
+    std::string result = "{";
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (i > 0) result += ",";
+        result += std::to_string(values[i]);
+    }
+    result += "}";
+    return result;
+}
+
+std::vector<std::string> PayloadEncoder::toLuaPieces(const std::string& bytes, size_t keySize) {
+    // Pieces start on a key boundary so each one decrypts independently with the same key phase
+    size_t pieceSize = std::max<size_t>(PIECE_SIZE - PIECE_SIZE % keySize, keySize);
+    std::vector<std::string> pieces;
+    for (size_t i = 0; i < bytes.length(); i += pieceSize) {
+        pieces.push_back(toLuaLiteral(bytes.substr(i, pieceSize)));
+    }
+    return pieces;
+}
+
+std::string PayloadEncoder::generateDecryptor(size_t blockSize, Target::Kind target, const std::string& nativeModule, bool compact) {
+    std::stringstream ss;
+    blockSize = std::max<size_t>(blockSize, 1);
+
+    switch (target) {
+        case Target::Lua54: {
+            // string.unpack reads eight bytes at a time; the rotate is done on all of them at once with masks
+            size_t words = std::max<size_t>(blockSize / 8, 1);
+            ss << "do\n"
+               << "    local byte, char, spack, sunpack = string.byte, string.char, string.pack, string.unpack\n"
+               << "    local concat, unpack = table.concat, table.unpack\n"
+               << "    local FORMAT, WORDS, BLOCK = '<' .. string.rep('i8', " << words << "), " << words << ", " << words * 8 << "\n"
+               << "    local cache = setmetatable({}, {__mode = 'k'})\n"
+               << "    local function keyWords(key)\n"
+               << "        local words = cache[key]\n"
+               << "        if words then return words end\n"
+               << "        words = {}\n"
+               << "        local keyLen = #key\n"
+               << "        for phase = 0, keyLen - 1 do\n"
+               << "            local w = 0\n"
+               << "            for i = 7, 0, -1 do\n"
+               << "                w = (w << 8) | key[(phase + i) % keyLen + 1]\n"
+               << "            end\n"
+               << "            words[phase] = w\n"
+               << "        end\n"
+               << "        cache[key] = words\n"
+               << "        return words\n"
+               << "    end\n"
+               << "    local function decrypt(str, key)\n"
+               << "        if type(str) ~= 'string' or #str == 0 then return \"\" end\n"
+               << "        local n, keyLen, parts, base = #str, #key, {}, 1\n"
+               << "        local words = keyWords(key)\n"
+               << "        while base + BLOCK - 1 <= n do\n"
+               << "            local w = {sunpack(FORMAT, str, base)}\n"
+               << "            for j = 1, WORDS do\n"
+               << "                local v = w[j]\n"
+               << "                w[j] = ((v >> 3) & 0x1F1F1F1F1F1F1F1F | (v << 5) & 0xE0E0E0E0E0E0E0E0) ~ words[(base + j * 8 - 9) % keyLen]\n"
+               << "            end\n"
+               << "            parts[#parts + 1] = spack(FORMAT, unpack(w, 1, WORDS))\n"
+               << "            base = base + BLOCK\n"
+               << "        end\n"
+               << "        if base <= n then\n"
+               << "            local bytes = {byte(str, base, n)}\n"
+               << "            for j = 1, #bytes do\n"
+               << "                local b = bytes[j]\n"
+               << "                bytes[j] = ((b >> 3) | (b << 5) & 0xFF) ~ key[(base + j - 2) % keyLen + 1]\n"
+               << "            end\n"
+               << "            parts[#parts + 1] = char(unpack(bytes))\n"
+               << "        end\n"
+               << "        return concat(parts)\n"
+               << "    end\n";
+            break;
+        }
+
+        case Target::Lua51:
+            // No bitwise operators: one 256-entry table per key byte, built once per key with arithmetic
+            ss << "do\n"
+               << "    local byte, char, concat, unpack = string.byte, string.char, table.concat, unpack or table.unpack\n"
+               << "    local cache = setmetatable({}, {__mode = 'k'})\n"
+               << "    local function xor(a, b)\n"
+               << "        local result, bit = 0, 1\n"
+               << "        while a > 0 or b > 0 do\n"
+               << "            local x, y = a % 2, b % 2\n"
+               << "            if x ~= y then result = result + bit end\n"
+               << "            a, b, bit = (a - x) / 2, (b - y) / 2, bit * 2\n"
+               << "        end\n"
+               << "        return result\n"
+               << "    end\n"
+               << "    local function rows(key)\n"
+               << "        local r = cache[key]\n"
+               << "        if r then return r end\n"
+               << "        r = {}\n"
+               << "        for i = 1, #key do\n"
+               << "            local row = {}\n"
+               << "            for b = 0, 255 do\n"
+               << "                local low = b % 8\n"
+               << "                row[b] = xor((b - low) / 8 + low * 32, key[i])\n"
+               << "            end\n"
+               << "            r[i] = row\n"
+               << "        end\n"
+               << "        cache[key] = r\n"
+               << "        return r\n"
+               << "    end\n"
+               << "    local function decrypt(str, key)\n"
+               << "        if type(str) ~= 'string' or #str == 0 then return \"\" end\n"
+               << "        local r, keyLen, parts = rows(key), #key, {}\n"
+               << "        for base = 1, #str, " << blockSize << " do\n"
+               << "            local bytes = {byte(str, base, base + " << blockSize - 1 << ")}\n"
+               << "            for j = 1, #bytes do\n"
+               << "                bytes[j] = r[(base + j - 2) % keyLen + 1][bytes[j]]\n"
+               << "            end\n"
+               << "            parts[#parts + 1] = char(unpack(bytes))\n"
+               << "        end\n"
+               << "        return concat(parts)\n"
+               << "    end\n";
+            break;
+
+        case Target::LuaJIT:
+        case Target::Luau: {
+            // LuaJIT fills an FFI buffer and Luau a buffer object, so the byte loop stays free of table
+            // churn and unpack() (which aborts LuaJIT traces); both fall back to string.char blocks
+            bool jit = target == Target::LuaJIT;
+            std::string lib = jit ? "bit" : "bit32";
+            ss << "do\n"
+               << "    local band, bor, bxor = " << lib << ".band, " << lib << ".bor, " << lib << ".bxor\n"
+               << "    local rshift, lshift = " << lib << ".rshift, " << lib << ".lshift\n"
+               << "    local byte, char, concat, unpack = string.byte, string.char, table.concat, unpack or table.unpack\n";
+            if (jit) {
+                ss << "    local ok, ffi = pcall(require, 'ffi')\n"
+                   << "    if not ok then ffi = nil end\n";
+            }
+            ss << "    local function decrypt(str, key)\n"
+               << "        if type(str) ~= 'string' or #str == 0 then return \"\" end\n"
+               << "        local n, keyLen = #str, #key\n";
+            if (jit) {
+                ss << "        if ffi then\n"
+                   << "            local buf = ffi.new('uint8_t[?]', n)\n"
+                   << "            for i = 0, n - 1 do\n"
+                   << "                local b = byte(str, i + 1)\n"
+                   << "                buf[i] = bxor(bor(rshift(b, 3), band(lshift(b, 5), 0xFF)), key[i % keyLen + 1])\n"
+                   << "            end\n"
+                   << "            return ffi.string(buf, n)\n"
+                   << "        end\n";
+            } else {
+                ss << "        if buffer then\n"
+                   << "            local buf = buffer.fromstring(str)\n"
+                   << "            for i = 0, n - 1 do\n"
+                   << "                local b = buffer.readu8(buf, i)\n"
+                   << "                buffer.writeu8(buf, i, bxor(bor(rshift(b, 3), band(lshift(b, 5), 0xFF)), key[i % keyLen + 1]))\n"
+                   << "            end\n"
+                   << "            return buffer.tostring(buf)\n"
+                   << "        end\n";
+            }
+            ss << "        local parts = {}\n"
+               << "        for base = 1, n, " << blockSize << " do\n"
+               << "            local bytes = {byte(str, base, base + " << blockSize - 1 << ")}\n"
+               << "            for j = 1, #bytes do\n"
+               << "                local b = bytes[j]\n"
+               << "                bytes[j] = bxor(bor(rshift(b, 3), band(lshift(b, 5), 0xFF)), key[(base + j - 2) % keyLen + 1])\n"
+               << "            end\n"
+               << "            parts[#parts + 1] = char(unpack(bytes))\n"
+               << "        end\n"
+               << "        return concat(parts)\n"
+               << "    end\n";
+            break;
+        }
+    }
+
+    // A native module, when the host can load one, replaces the Lua loop; both produce identical bytes. It is looked up
+    // with the C searcher only: require would try package.path first and hand the key to any Lua file of that name
+    if (!nativeModule.empty() && target != Target::Luau) {
+        ss << "    local searchers = type(package) == 'table' and (package.searchers or package.loaders)\n"
+           << "    local search = type(searchers) == 'table' and searchers[3]\n"
+           << "    if type(search) == 'function' then\n"
+           << "        local found, open, path = pcall(search, '" << nativeModule << "')\n"
+           << "        if found and type(open) == 'function' then\n"
+           << "            local ok, native = pcall(open, '" << nativeModule << "', path)\n"
+           << "            if ok and type(native) == 'table' and type(native.decrypt) == 'function' then\n"
+           << "                decrypt = native.decrypt\n"
+           << "            end\n"
+           << "        end\n"
+           << "    end\n";
+    }
+    ss << "    " << (target == Target::Luau ? "" : "_G.") << "__decrypt = decrypt\n"
+       << "end\n\n";
+
+    if (!compact) return ss.str();
+
+    std::string line;
+    std::string result;
+    while (std::getline(ss, line)) {
+        size_t first = line.find_first_not_of(' ');
+        if (first == std::string::npos) continue;
+        if (!result.empty()) result += ' ';
+        result += line.substr(first);
+    }
+    return result + "\n";
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "Target.hpp"
+
+class PayloadEncoder {
+public:
+    static constexpr size_t PIECE_SIZE = 65536;
+
+
+    static std::string encrypt(const std::string& input, const std::vector<uint8_t>& key);
+    static std::string toLuaLiteral(const std::string& bytes);
+    static std::string toLuaList(const std::vector<size_t>& values);
+    static std::vector<std::string> toLuaPieces(const std::string& bytes, size_t keySize);
+    static std::string generateDecryptor(size_t blockSize, Target::Kind target, const std::string& nativeModule, bool compact = false);
+};
@@ -0,0 +1,124 @@
+#include "Profile.hpp"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "Annotations.hpp"
+#include "Logger.hpp"
+#include "parser/AstWalker.hpp"
+#include "parser/LuaParser.hpp"
+#include "parser/LuaPrinter.hpp"
+
+std::vector<Profile::Entry> Profile::load(const std::string& path, int& period) {
+    std::ifstream file(path);
+    if (!file.is_open()) throw std::runtime_error("cannot open " + path);
+
+    std::vector<Entry> entries;
+    period = DEFAULT_PERIOD;
+    std::string line;
+    int number = 0;
+    while (std::getline(file, line)) {
+        ++number;
+        std::istringstream fields(line);
+        std::string name;
+        if (!(fields >> name) || name[0] == '#') continue;
+        if (name == "period") {
+            if (!(fields >> period) || period <= 0) throw std::runtime_error(path + ":" + std::to_string(number) + ": bad period");
+            continue;
+        }
+
+        Entry entry;
+        entry.name = name;
+        std::string first, last;
+        if (!(fields >> first >> last >> entry.calls >> entry.hits)) {
+            throw std::runtime_error(path + ":" + std::to_string(number) + ": expected <name> <first> <last> <calls> <hits>");
+        }
+        if (first != "-") entry.firstLine = std::stoi(first);
+        if (last != "-") entry.lastLine = std::stoi(last);
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+const Profile::Entry* Profile::find(const Function& func, const std::vector<Entry>& entries) {
+    for (const auto& entry : entries) {
+        if (entry.firstLine > 0) {
+            if (entry.firstLine == func.line && entry.lastLine == func.endLine) return &entry;
+            continue;
+        }
+        // debug.getinfo only knows the last part of a dotted or method name
+        const std::string& name = func.name;
+        if (name == entry.name) return &entry;
+        if (name.length() > entry.name.length() &&
+            name.compare(name.length() - entry.name.length(), entry.name.length(), entry.name) == 0) {
+            char separator = name[name.length() - entry.name.length() - 1];
+            if (separator == '.' || separator == ':') return &entry;
+        }
+    }
+    return nullptr;
+}
+
+Profile::Report Profile::mark(Block& chunk, const std::vector<Entry>& entries, int period, double hotPercent) {
+    Report report;
+    std::vector<std::pair<uint64_t, Function*>> costs;
+    uint64_t total = 0;
+    int lastLine = 0;
+
+    // Tags written in the source, inherited ones included, win over the profile
+    Annotations::spread(chunk);
+    AstWalker::forEachFunction(chunk, [&](Function& func) {
+        ++report.functions;
+        lastLine = std::max(lastLine, func.endLine);
+        const Entry* entry = find(func, entries);
+        if (!entry) return;
+        ++report.matched;
+        uint64_t cost = entry->hits * static_cast<uint64_t>(period) + entry->calls * CALL_INSTRUCTIONS;
+        total += cost;
+        if (cost > 0) costs.emplace_back(cost, &func);
+    });
+
+    std::stable_sort(costs.begin(), costs.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    std::vector<bool> covered(lastLine + 1, false);
+    uint64_t hot = 0;
+    for (const auto& [cost, func] : costs) {
+        if (hot >= total * hotPercent / 100) break;
+        hot += cost;
+        if (!func->annotation.empty()) continue;
+        func->annotation = Annotations::name(Annotations::Tier::Fast);
+        ++report.hot;
+        std::fill(covered.begin() + func->line, covered.begin() + func->endLine + 1, true);
+        report.names += (report.names.empty() ? "" : ", ") + (func->name.empty() ? "<anonymous>" : func->name) +
+                        " (line " + std::to_string(func->line) + ")";
+    }
+
+    report.hotShare = total > 0 ? static_cast<double>(hot) / total : 0;
+    report.hotLines = std::count(covered.begin(), covered.end(), true);
+    return report;
+}
+
+void Profile::apply(std::string& code, const ConfigParser& config, Target::Kind target) {
+    std::string path = config.getValue("Profile", "file", "");
+    if (path.empty()) return;
+
+    try {
+        int period = DEFAULT_PERIOD;
+        std::vector<Entry> entries = load(path, period);
+        LuaParser parser(code, target);
+        BlockPtr chunk = parser.parse();
+        Report report = mark(*chunk, entries, period, config.getIntValue("Profile", "hot_percent", 80));
+        report.lines = std::count(code.begin(), code.end(), '\n') + 1;
+        if (report.matched == 0) {
+            Logger::warning("Profile " + path + " matches no function of this source; protecting uniformly");
+            return;
+        }
+        Logger::info("Profile: " + std::to_string(report.hot) + "/" + std::to_string(report.functions) + " functions hot (" +
+                     std::to_string(static_cast<int>(report.hotShare * 100 + 0.5)) + "% of the profiled cost, " +
+                     std::to_string(report.hotLines) + "/" + std::to_string(report.lines) + " lines), " +
+                     std::to_string(report.matched) + " profiled");
+        if (report.hot == 0) return;
+        Logger::debug("Hot functions: " + report.names);
+        code = LuaPrinter::print(*chunk, true);
+    } catch (const std::exception& e) {
+        Logger::warning("Profile ignored: " + std::string(e.what()));
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ConfigParser.hpp"
+#include "Target.hpp"
+#include "parser/LuaAst.hpp"
+
+// Runtime profiles written by tools/profile.lua, one line per function of the profiled script:
+//   <name> <first line> <last line> <calls> <hits>
+// where hits are samples of a count hook taken every `period` VM instructions (given on a `period <n>` line).
+// Functions are matched to the source by line range, or by name when the range is `- -`. The functions that cover
+// hot_percent of the profiled cost are annotated `fast` (see Annotations) unless the source already tags them.
+class Profile {
+public:
+    struct Entry {
+        std::string name;
+        int firstLine = 0;
+        int lastLine = 0;
+        uint64_t calls = 0;
+        uint64_t hits = 0;
+    };
+
+    struct Report {
+        size_t functions = 0;
+        size_t matched = 0;
+        size_t hot = 0;
+        double hotShare = 0;
+        size_t hotLines = 0;
+        size_t lines = 0;
+        std::string names;
+    };
+
+    static std::vector<Entry> load(const std::string& path, int& period);
+    static const Entry* find(const Function& func, const std::vector<Entry>& entries);
+    static Report mark(Block& chunk, const std::vector<Entry>& entries, int period, double hotPercent);
+    // Annotates the hottest functions of the source from [Profile] file; without a profile the code is left alone
+    static void apply(std::string& code, const ConfigParser& config, Target::Kind target);
+
+private:
+    // Call-heavy functions also pay the per-call cost of closures and state machines, counted as this many instructions
+    static constexpr uint64_t CALL_INSTRUCTIONS = 20;
+    static constexpr int DEFAULT_PERIOD = 1000;
+};
@@ -75,7 +75,7 @@ void ProgressBar::update(size_t newCurrent) {
 void ProgressBar::finish(const std::string& message) {
     current = total;
     render();
-    std::cout << std::endl;
+    if (Logger::isEnabled()) std::cout << std::endl;
     
     #ifdef _WIN32
     lastLinePos = -1;
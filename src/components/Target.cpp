@@ -0,0 +1,41 @@
+#include "Target.hpp"
+#include <algorithm>
+#include "Logger.hpp"
+
+Target::Kind Target::fromName(const std::string& name) {
+    std::string lower = name;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+    // 5.3 shares the 5.4 operators and string.pack
+    if (lower == "lua54" || lower == "lua53") return Lua54;
+    if (lower == "lua51") return Lua51;
+    if (lower == "luajit") return LuaJIT;
+    if (lower == "luau") return Luau;
+
+    Logger::warning("Unknown target '" + name + "', using lua54");
+    return Lua54;
+}
+
+std::string Target::name(Kind target) {
+    switch (target) {
+        case Lua54: return "lua54";
+        case Lua51: return "lua51";
+        case LuaJIT: return "luajit";
+        case Luau: return "luau";
+    }
+    return "lua54";
+}
+
+bool Target::hasLoad(Kind target) {
+    return target != Luau;
+}
+
+bool Target::hasEscape(Kind target, char escape) {
+    // LuaJIT 2.1 and Luau took all three over from 5.2 and 5.3
+    return target != Lua51 && (escape == 'x' || escape == 'z' || escape == 'u');
+}
+
+std::string Target::environment(Kind target) {
+    // Roblox keeps a script's globals in its function environment; _G there is a separate shared table
+    return target == Luau ? "getfenv()" : "_G";
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+
+// Lua runtime the generated code has to run on; emitters pick operators and libraries per target
+class Target {
+public:
+    enum Kind { Lua54, Lua51, LuaJIT, Luau };
+
+    // Unknown names fall back to Lua54 with a warning
+    static Kind fromName(const std::string& name);
+    static std::string name(Kind target);
+    // Luau (Roblox) has no load(), so source cannot be compiled at run time
+    static bool hasLoad(Kind target);
+    // Whether strings decode \x, \z or \u{} ('x', 'z', 'u'); Lua 5.1 reads them as the plain letter
+    static bool hasEscape(Kind target, char escape);
+    // Expression for the table the protected program sees as its globals
+    static std::string environment(Kind target);
+};
@@ -0,0 +1,81 @@
+#include "AstWalker.hpp"
+
+void AstWalker::children(Stat& stat, const ExprFn& onExpr, const BlockFn& onBlock) {
+    for (auto& target : stat.targets) onExpr(target);
+    for (auto& expr : stat.exprs) onExpr(expr);
+    if (stat.expr) onExpr(stat.expr);
+    for (auto& block : stat.blocks) onBlock(block);
+    if (stat.func) onBlock(stat.func->body);
+}
+
+void AstWalker::children(Expr& expr, const ExprFn& onExpr, const BlockFn& onBlock) {
+    if (expr.lhs) onExpr(expr.lhs);
+    if (expr.rhs) onExpr(expr.rhs);
+    for (auto& arg : expr.args) onExpr(arg);
+    for (auto& field : expr.fields) {
+        if (field.key) onExpr(field.key);
+        onExpr(field.value);
+    }
+    if (expr.func) onBlock(expr.func->body);
+}
+
+void AstWalker::walk(Block& block, const std::function<void(Stat&)>& onStat, const std::function<void(Expr&)>& onExpr, bool intoFunctions) {
+    for (auto& stat : block.stats) {
+        walk(*stat, onStat, onExpr, intoFunctions);
+    }
+}
+
+void AstWalker::walk(Stat& stat, const std::function<void(Stat&)>& onStat, const std::function<void(Expr&)>& onExpr, bool intoFunctions) {
+    if (onStat) onStat(stat);
+
+    std::function<void(ExprPtr&)> visitExpr;
+    BlockFn visitBlock = [&](BlockPtr& block) {
+        walk(*block, onStat, onExpr, intoFunctions);
+    };
+    visitExpr = [&](ExprPtr& expr) {
+        if (onExpr) onExpr(*expr);
+        children(*expr, visitExpr, [&](BlockPtr& body) {
+            if (intoFunctions) visitBlock(body);
+        });
+    };
+
+    for (auto& target : stat.targets) visitExpr(target);
+    for (auto& expr : stat.exprs) visitExpr(expr);
+    if (stat.expr) visitExpr(stat.expr);
+    for (auto& block : stat.blocks) visitBlock(block);
+    if (stat.func && intoFunctions) visitBlock(stat.func->body);
+}
+
+void AstWalker::forEachFunction(Block& block, const std::function<void(Function&)>& fn) {
+    std::function<void(ExprPtr&)> visitExpr;
+    BlockFn visitBlock;
+
+    auto visitFunction = [&](Function& func) {
+        forEachFunction(*func.body, fn);
+        fn(func);
+    };
+
+    visitExpr = [&](ExprPtr& expr) {
+        children(*expr, visitExpr, [](BlockPtr&) {});
+        if (expr->func) visitFunction(*expr->func);
+    };
+    visitBlock = [&](BlockPtr& inner) {
+        forEachFunction(*inner, fn);
+    };
+
+    for (auto& stat : block.stats) {
+        for (auto& target : stat->targets) visitExpr(target);
+        for (auto& expr : stat->exprs) visitExpr(expr);
+        if (stat->expr) visitExpr(stat->expr);
+        for (auto& inner : stat->blocks) visitBlock(inner);
+        if (stat->func) visitFunction(*stat->func);
+    }
+}
+
+std::set<std::string> AstWalker::namesUsed(Stat& stat) {
+    std::set<std::string> names;
+    walk(stat, nullptr, [&](Expr& expr) {
+        if (expr.kind == ExprKind::Name) names.insert(expr.value);
+    });
+    return names;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <functional>
+#include <set>
+#include <string>
+#include "LuaAst.hpp"
+
+class AstWalker {
+public:
+    using ExprFn = std::function<void(ExprPtr&)>;
+    using BlockFn = std::function<void(BlockPtr&)>;
+
+    // Immediate children only; function bodies are reported through onBlock
+    static void children(Stat& stat, const ExprFn& onExpr, const BlockFn& onBlock);
+    static void children(Expr& expr, const ExprFn& onExpr, const BlockFn& onBlock);
+
+    // Pre-order over every statement and expression, optionally descending into nested functions
+    static void walk(Block& block, const std::function<void(Stat&)>& onStat, const std::function<void(Expr&)>& onExpr, bool intoFunctions = true);
+    static void walk(Stat& stat, const std::function<void(Stat&)>& onStat, const std::function<void(Expr&)>& onExpr, bool intoFunctions = true);
+
+    // Post-order over nested functions, so inner functions are visited before the ones enclosing them
+    static void forEachFunction(Block& block, const std::function<void(Function&)>& fn);
+
+    static std::set<std::string> namesUsed(Stat& stat);
+};
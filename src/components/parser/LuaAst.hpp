@@ -0,0 +1,83 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+
+struct Expr;
+struct Stat;
+struct Block;
+struct Function;
+
+using ExprPtr = std::shared_ptr<Expr>;
+using StatPtr = std::shared_ptr<Stat>;
+using BlockPtr = std::shared_ptr<Block>;
+using FunctionPtr = std::shared_ptr<Function>;
+
+enum class ExprKind {
+    Nil, True, False, Number, String, Vararg, Function, Table,
+    Binary, Unary, Name, Index, Call, Method, Paren
+};
+
+enum class StatKind {
+    Local, Assign, Call, Do, While, Repeat, If, NumericFor, GenericFor,
+    Function, LocalFunction, Return, Break, Goto, Label
+};
+
+struct TableField {
+    enum Kind { Positional, Named, Keyed } kind = Positional;
+    std::string name;
+    ExprPtr key;
+    ExprPtr value;
+};
+
+// Name, Number (source text), String (decoded bytes), operator, or method name, depending on kind
+struct Expr {
+    ExprKind kind;
+    std::string value;
+    std::string literal;  // String: the literal as written, empty for generated strings
+    ExprPtr lhs;
+    ExprPtr rhs;
+    std::vector<ExprPtr> args;
+    std::vector<TableField> fields;
+    FunctionPtr func;
+    int line = 0;
+
+    explicit Expr(ExprKind kind, int line = 0) : kind(kind), line(line) {}
+};
+
+struct Function {
+    std::vector<std::string> params;
+    bool vararg = false;
+    BlockPtr body;
+    std::string name;
+    std::string annotation;
+    int line = 0;
+    int endLine = 0;
+};
+
+// Local: names/attribs = exprs          Assign: targets = exprs         Call: expr
+// Do/While/Repeat: blocks[0], exprs[0] is the loop condition
+// If: exprs are the conditions, blocks the bodies, plus a trailing else block when blocks outnumber exprs
+// NumericFor: names[0] = exprs (start, stop[, step])      GenericFor: names in exprs
+// Function: targets[0] is the name path, method marks ':'  LocalFunction: names[0]
+// Return: exprs      Goto/Label: names[0]
+struct Stat {
+    StatKind kind;
+    std::vector<std::string> names;
+    std::vector<std::string> attribs;
+    std::vector<ExprPtr> targets;
+    std::vector<ExprPtr> exprs;
+    std::vector<BlockPtr> blocks;
+    FunctionPtr func;
+    ExprPtr expr;
+    bool method = false;
+    std::string annotation;
+    int line = 0;
+    int endLine = 0;
+
+    explicit Stat(StatKind kind, int line = 0) : kind(kind), line(line) {}
+};
+
+struct Block {
+    std::vector<StatPtr> stats;
+};
@@ -0,0 +1,298 @@
+#include "LuaLexer.hpp"
+#include <cctype>
+#include <stdexcept>
+#include <unordered_set>
+
+LuaLexer::LuaLexer(const std::string& source, Target::Kind target) : source(source), pos(0), line(1), target(target) {}
+
+bool LuaLexer::isKeyword(const std::string& word) {
+    static const std::unordered_set<std::string> keywords = {
+        "and", "break", "do", "else", "elseif", "end", "false", "for",
+        "function", "goto", "if", "in", "local", "nil", "not", "or",
+        "repeat", "return", "then", "true", "until", "while"
+    };
+    return keywords.count(word) > 0;
+}
+
+// "@obf:fast" (after optional spaces) in a comment's text yields "fast"
+static std::string annotationTag(const std::string& comment) {
+    size_t start = comment.find_first_not_of(" \t");
+    if (start == std::string::npos || comment.compare(start, 5, "@obf:") != 0) return "";
+    size_t end = start + 5;
+    while (end < comment.length() && (std::isalnum(static_cast<unsigned char>(comment[end])) || comment[end] == '_')) ++end;
+    return comment.substr(start + 5, end - start - 5);
+}
+
+char LuaLexer::peek(size_t ahead) const {
+    return pos + ahead < source.length() ? source[pos + ahead] : '\0';
+}
+
+void LuaLexer::skipWhitespace() {
+    while (pos < source.length() && std::isspace(static_cast<unsigned char>(source[pos]))) {
+        if (source[pos] == '\n') ++line;
+        ++pos;
+    }
+}
+
+size_t LuaLexer::longBracketLevel() const {
+    if (peek() != '[') return std::string::npos;
+    size_t level = 0;
+    while (peek(level + 1) == '=') ++level;
+    return peek(level + 1) == '[' ? level : std::string::npos;
+}
+
+std::string LuaLexer::readLongBracket(size_t level) {
+    int startLine = line;
+    pos += level + 2;
+    if (peek() == '\r') { ++pos; if (peek() == '\n') ++pos; ++line; }
+    else if (peek() == '\n') { ++pos; if (peek() == '\r') ++pos; ++line; }
+
+    std::string closing = "]" + std::string(level, '=') + "]";
+    size_t end = source.find(closing, pos);
+    if (end == std::string::npos) {
+        throw std::runtime_error("line " + std::to_string(startLine) + ": unfinished long string or comment");
+    }
+
+    std::string content = source.substr(pos, end - pos);
+    for (char c : content) {
+        if (c == '\n') ++line;
+    }
+    pos = end + closing.length();
+    return content;
+}
+
+std::string LuaLexer::readString(char quote) {
+    int startLine = line;
+    ++pos;
+    size_t start = pos;
+    while (pos < source.length() && source[pos] != quote) {
+        if (source[pos] == '\\') {
+            ++pos;
+            if (peek() == '\n') ++line;
+            if (peek() == 'z') {
+                ++pos;
+                skipWhitespace();
+                continue;
+            }
+        } else if (source[pos] == '\n') {
+            throw std::runtime_error("line " + std::to_string(startLine) + ": unfinished string");
+        }
+        ++pos;
+    }
+    if (pos >= source.length()) {
+        throw std::runtime_error("line " + std::to_string(startLine) + ": unfinished string");
+    }
+    std::string content = source.substr(start, pos - start);
+    ++pos;
+    return content;
+}
+
+void LuaLexer::readNumber() {
+    bool hex = peek() == '0' && (peek(1) == 'x' || peek(1) == 'X');
+    if (hex) pos += 2;
+    char exponent = hex ? 'p' : 'e';
+    while (pos < source.length()) {
+        char c = static_cast<char>(std::tolower(static_cast<unsigned char>(source[pos])));
+        if (c == exponent && (peek(1) == '+' || peek(1) == '-')) {
+            pos += 2;
+        } else if (std::isalnum(static_cast<unsigned char>(c)) || c == '.' || c == '_') {
+            ++pos;
+        } else {
+            break;
+        }
+    }
+}
+
+std::vector<Token> LuaLexer::tokenize(bool keepComments) {
+    static const char* symbols[] = {
+        "...", "..", "==", "~=", "<=", ">=", "//", "::", "<<", ">>",
+        "+", "-", "*", "/", "%", "^", "#", "&", "~", "|", "<", ">", "=",
+        "(", ")", "{", "}", "[", "]", ";", ":", ",", "."
+    };
+
+    std::vector<Token> tokens;
+    std::string annotation;
+    pos = 0;
+    line = 1;
+
+    if (source.compare(0, 1, "#") == 0) {
+        pos = source.find('\n');
+        if (pos == std::string::npos) pos = source.length();
+    }
+
+    while (true) {
+        skipWhitespace();
+        Token token;
+        token.line = line;
+        token.offset = pos;
+
+        if (pos >= source.length()) {
+            token.type = TokenType::Eof;
+            token.annotation = annotation;
+            tokens.push_back(token);
+            break;
+        }
+
+        char c = source[pos];
+
+        if (c == '-' && peek(1) == '-') {
+            pos += 2;
+            size_t level = longBracketLevel();
+            if (level != std::string::npos) {
+                token.value = readLongBracket(level);
+            } else {
+                size_t end = source.find('\n', pos);
+                if (end == std::string::npos) end = source.length();
+                token.value = source.substr(pos, end - pos);
+                pos = end;
+            }
+            std::string tag = annotationTag(token.value);
+            if (!tag.empty()) annotation = tag;
+            if (keepComments) {
+                token.type = TokenType::Comment;
+                token.text = source.substr(token.offset, pos - token.offset);
+                tokens.push_back(token);
+            }
+            continue;
+        }
+
+        if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+            size_t start = pos;
+            while (pos < source.length() && (std::isalnum(static_cast<unsigned char>(source[pos])) || source[pos] == '_')) ++pos;
+            token.text = source.substr(start, pos - start);
+            token.value = token.text;
+            token.type = isKeyword(token.text) ? TokenType::Keyword : TokenType::Name;
+        } else if (std::isdigit(static_cast<unsigned char>(c)) || (c == '.' && std::isdigit(static_cast<unsigned char>(peek(1))))) {
+            readNumber();
+            token.type = TokenType::Number;
+            token.text = source.substr(token.offset, pos - token.offset);
+            token.value = token.text;
+        } else if (c == '"' || c == '\'') {
+            token.type = TokenType::String;
+            std::string literal = readString(c);
+            try {
+                token.value = unescape(literal, target);
+            } catch (const std::runtime_error& e) {
+                throw std::runtime_error("line " + std::to_string(token.line) + ": " + e.what());
+            }
+            token.text = source.substr(token.offset, pos - token.offset);
+        } else if (c == '[' && longBracketLevel() != std::string::npos) {
+            token.type = TokenType::String;
+            token.value = readLongBracket(longBracketLevel());
+            token.text = source.substr(token.offset, pos - token.offset);
+        } else {
+            token.type = TokenType::Symbol;
+            for (const char* symbol : symbols) {
+                if (source.compare(pos, std::char_traits<char>::length(symbol), symbol) == 0) {
+                    token.text = symbol;
+                    break;
+                }
+            }
+            if (token.text.empty()) {
+                throw std::runtime_error("line " + std::to_string(line) + ": unexpected character '" + std::string(1, c) + "'");
+            }
+            pos += token.text.length();
+            token.value = token.text;
+        }
+
+        token.annotation = std::move(annotation);
+        annotation.clear();
+        tokens.push_back(token);
+    }
+
+    return tokens;
+}
+
+std::string LuaLexer::unescape(const std::string& literal, Target::Kind target) {
+    std::string result;
+    result.reserve(literal.length());
+    
+    for (size_t i = 0; i < literal.length(); ++i) {
+        char c = literal[i];
+        if (c != '\\' || i + 1 >= literal.length()) {
+            result += c;
+            continue;
+        }
+        
+        char next = literal[++i];
+        // An escape the target does not know stands for its letter
+        if ((next == 'x' || next == 'z' || next == 'u') && !Target::hasEscape(target, next)) {
+            result += next;
+            continue;
+        }
+        switch (next) {
+            case 'a': result += '\a'; break;
+            case 'b': result += '\b'; break;
+            case 'f': result += '\f'; break;
+            case 'n': result += '\n'; break;
+            case 'r': result += '\r'; break;
+            case 't': result += '\t'; break;
+            case 'v': result += '\v'; break;
+            case '\n':
+            case '\r':
+                result += '\n';
+                if (i + 1 < literal.length() && (literal[i + 1] == '\n' || literal[i + 1] == '\r') && literal[i + 1] != next) ++i;
+                break;
+            case 'z':
+                while (i + 1 < literal.length() && std::isspace(static_cast<unsigned char>(literal[i + 1]))) ++i;
+                break;
+            case 'x':
+                if (i + 2 < literal.length() && std::isxdigit(static_cast<unsigned char>(literal[i + 1])) &&
+                    std::isxdigit(static_cast<unsigned char>(literal[i + 2]))) {
+                    result += static_cast<char>(std::stoi(literal.substr(i + 1, 2), nullptr, 16));
+                    i += 2;
+                } else {
+                    result += next;
+                }
+                break;
+            case 'u': {
+                // Code points up to 2^31 like Lua 5.4, which writes the ones past U+10FFFF in five or six bytes
+                if (i + 1 >= literal.length() || literal[i + 1] != '{') throw std::runtime_error("missing '{' in \\u{xxxx}");
+                size_t end = i + 2;
+                unsigned long cp = 0;
+                while (end < literal.length() && std::isxdigit(static_cast<unsigned char>(literal[end]))) {
+                    char digit = static_cast<char>(std::tolower(static_cast<unsigned char>(literal[end++])));
+                    cp = cp * 16 + (std::isdigit(static_cast<unsigned char>(digit)) ? digit - '0' : digit - 'a' + 10);
+                    if (cp > 0x7FFFFFFFUL) throw std::runtime_error("UTF-8 value too large in \\u{xxxx}");
+                }
+                if (end == i + 2) throw std::runtime_error("hexadecimal digit expected in \\u{xxxx}");
+                if (end >= literal.length() || literal[end] != '}') throw std::runtime_error("missing '}' in \\u{xxxx}");
+                if (cp < 0x80) {
+                    result += static_cast<char>(cp);
+                } else {
+                    // Continuation bytes from the end; each one leaves a bit less room in the lead byte
+                    char continuation[5];
+                    int count = 0;
+                    unsigned long leadMax = 0x3F;
+                    do {
+                        continuation[count++] = static_cast<char>(0x80 | (cp & 0x3F));
+                        cp >>= 6;
+                        leadMax >>= 1;
+                    } while (cp > leadMax);
+                    result += static_cast<char>((~leadMax << 1) | cp);
+                    while (count > 0) result += continuation[--count];
+                }
+                i = end;
+                break;
+            }
+            default:
+                if (std::isdigit(static_cast<unsigned char>(next))) {
+                    int value = 0;
+                    size_t digits = 0;
+                    while (digits < 3 && i < literal.length() && std::isdigit(static_cast<unsigned char>(literal[i]))) {
+                        value = value * 10 + (literal[i] - '0');
+                        ++i;
+                        ++digits;
+                    }
+                    --i;
+                    result += static_cast<char>(value & 0xFF);
+                } else {
+                    result += next;
+                }
+                break;
+        }
+    }
+    
+    return result;
+}
+
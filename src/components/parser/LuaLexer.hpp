@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "../Target.hpp"
+
+enum class TokenType { Name, Keyword, Number, String, Symbol, Comment, Eof };
+
+struct Token {
+    TokenType type;
+    std::string text;
+    std::string value;
+    int line = 0;
+    size_t offset = 0;
+    // Tag of an --@obf:<tag> comment right before the token
+    std::string annotation;
+};
+
+class LuaLexer {
+private:
+    const std::string& source;
+    size_t pos;
+    int line;
+    // Runtime whose escapes string literals are decoded with
+    Target::Kind target;
+
+    char peek(size_t ahead = 0) const;
+    void skipWhitespace();
+    size_t longBracketLevel() const;
+    std::string readLongBracket(size_t level);
+    std::string readString(char quote);
+    void readNumber();
+
+public:
+    explicit LuaLexer(const std::string& source, Target::Kind target = Target::Lua54);
+    std::vector<Token> tokenize(bool keepComments = false);
+
+    static bool isKeyword(const std::string& word);
+    // Throws std::runtime_error for a malformed \u{} escape
+    static std::string unescape(const std::string& literal, Target::Kind target = Target::Lua54);
+};
@@ -0,0 +1,499 @@
+#include "LuaParser.hpp"
+#include <stdexcept>
+
+LuaParser::LuaParser(const std::string& source, Target::Kind target) : current(0) {
+    LuaLexer lexer(source, target);
+    tokens = lexer.tokenize();
+}
+
+int LuaParser::leftPriority(const std::string& op) {
+    if (op == "or") return 1;
+    if (op == "and") return 2;
+    if (op == "<" || op == ">" || op == "<=" || op == ">=" || op == "~=" || op == "==") return 3;
+    if (op == "|") return 4;
+    if (op == "~") return 5;
+    if (op == "&") return 6;
+    if (op == "<<" || op == ">>") return 7;
+    if (op == "..") return 9;
+    if (op == "+" || op == "-") return 10;
+    if (op == "*" || op == "/" || op == "//" || op == "%") return 11;
+    if (op == "^") return 14;
+    return -1;
+}
+
+int LuaParser::rightPriority(const std::string& op) {
+    // '..' and '^' are right associative
+    if (op == "..") return 8;
+    if (op == "^") return 13;
+    return leftPriority(op);
+}
+
+const Token& LuaParser::peek(size_t ahead) const {
+    size_t index = current + ahead;
+    return index < tokens.size() ? tokens[index] : tokens.back();
+}
+
+const Token& LuaParser::advance() {
+    const Token& token = tokens[current];
+    if (current + 1 < tokens.size()) ++current;
+    return token;
+}
+
+bool LuaParser::check(const std::string& text) const {
+    const Token& token = peek();
+    return (token.type == TokenType::Symbol || token.type == TokenType::Keyword) && token.text == text;
+}
+
+bool LuaParser::accept(const std::string& text) {
+    if (!check(text)) return false;
+    advance();
+    return true;
+}
+
+void LuaParser::expect(const std::string& text) {
+    if (!accept(text)) fail("'" + text + "' expected");
+}
+
+std::string LuaParser::expectName() {
+    if (peek().type != TokenType::Name) fail("name expected");
+    return advance().text;
+}
+
+void LuaParser::fail(const std::string& message) const {
+    const Token& token = peek();
+    std::string near = token.type == TokenType::Eof ? "<eof>" : token.text;
+    throw std::runtime_error("line " + std::to_string(token.line) + ": " + message + " near '" + near + "'");
+}
+
+// An annotation before a statement also applies to the function the statement defines
+static void annotate(Stat& stat, const std::string& annotation) {
+    if (annotation.empty()) return;
+    stat.annotation = annotation;
+    FunctionPtr func = stat.func;
+    if (!func && (stat.kind == StatKind::Local || stat.kind == StatKind::Assign) && stat.exprs.size() == 1 &&
+        stat.exprs[0]->kind == ExprKind::Function) {
+        func = stat.exprs[0]->func;
+    }
+    if (func && func->annotation.empty()) func->annotation = annotation;
+}
+
+BlockPtr LuaParser::parse() {
+    BlockPtr block = parseBlock();
+    if (peek().type != TokenType::Eof) fail("'<eof>' expected");
+    return block;
+}
+
+bool LuaParser::blockFollows() const {
+    if (peek().type == TokenType::Eof) return true;
+    return check("end") || check("else") || check("elseif") || check("until");
+}
+
+BlockPtr LuaParser::parseBlock() {
+    auto block = std::make_shared<Block>();
+    while (!blockFollows()) {
+        if (check("return")) {
+            auto stat = std::make_shared<Stat>(StatKind::Return, advance().line);
+            if (!blockFollows() && !check(";")) {
+                stat->exprs = parseExprList();
+            }
+            accept(";");
+            block->stats.push_back(stat);
+            break;
+        }
+        std::string annotation = peek().annotation;
+        StatPtr stat = parseStatement();
+        if (!stat) continue;
+        stat->endLine = tokens[current - 1].line;
+        annotate(*stat, annotation);
+        block->stats.push_back(stat);
+    }
+    return block;
+}
+
+StatPtr LuaParser::parseStatement() {
+    int line = peek().line;
+
+    if (accept(";")) return nullptr;
+
+    if (check("if")) return parseIf(line);
+
+    if (accept("while")) {
+        auto stat = std::make_shared<Stat>(StatKind::While, line);
+        stat->exprs.push_back(parseExpr());
+        expect("do");
+        stat->blocks.push_back(parseBlock());
+        expect("end");
+        return stat;
+    }
+
+    if (accept("do")) {
+        auto stat = std::make_shared<Stat>(StatKind::Do, line);
+        stat->blocks.push_back(parseBlock());
+        expect("end");
+        return stat;
+    }
+
+    if (check("for")) return parseFor(line);
+
+    if (accept("repeat")) {
+        auto stat = std::make_shared<Stat>(StatKind::Repeat, line);
+        stat->blocks.push_back(parseBlock());
+        expect("until");
+        stat->exprs.push_back(parseExpr());
+        return stat;
+    }
+
+    if (check("function")) return parseFunctionStat(line);
+
+    if (accept("local")) return parseLocal(line);
+
+    if (accept("::")) {
+        auto stat = std::make_shared<Stat>(StatKind::Label, line);
+        stat->names.push_back(expectName());
+        expect("::");
+        return stat;
+    }
+
+    if (accept("break")) {
+        return std::make_shared<Stat>(StatKind::Break, line);
+    }
+
+    if (accept("goto")) {
+        auto stat = std::make_shared<Stat>(StatKind::Goto, line);
+        stat->names.push_back(expectName());
+        return stat;
+    }
+
+    return parseExprStat(line);
+}
+
+StatPtr LuaParser::parseIf(int line) {
+    auto stat = std::make_shared<Stat>(StatKind::If, line);
+    expect("if");
+    stat->exprs.push_back(parseExpr());
+    expect("then");
+    stat->blocks.push_back(parseBlock());
+
+    while (accept("elseif")) {
+        stat->exprs.push_back(parseExpr());
+        expect("then");
+        stat->blocks.push_back(parseBlock());
+    }
+
+    if (accept("else")) {
+        stat->blocks.push_back(parseBlock());
+    }
+    expect("end");
+    return stat;
+}
+
+StatPtr LuaParser::parseFor(int line) {
+    expect("for");
+    std::string first = expectName();
+
+    if (accept("=")) {
+        auto stat = std::make_shared<Stat>(StatKind::NumericFor, line);
+        stat->names.push_back(first);
+        stat->exprs.push_back(parseExpr());
+        expect(",");
+        stat->exprs.push_back(parseExpr());
+        if (accept(",")) stat->exprs.push_back(parseExpr());
+        expect("do");
+        stat->blocks.push_back(parseBlock());
+        expect("end");
+        return stat;
+    }
+
+    auto stat = std::make_shared<Stat>(StatKind::GenericFor, line);
+    stat->names.push_back(first);
+    while (accept(",")) stat->names.push_back(expectName());
+    expect("in");
+    stat->exprs = parseExprList();
+    expect("do");
+    stat->blocks.push_back(parseBlock());
+    expect("end");
+    return stat;
+}
+
+StatPtr LuaParser::parseFunctionStat(int line) {
+    expect("function");
+    auto stat = std::make_shared<Stat>(StatKind::Function, line);
+
+    auto target = std::make_shared<Expr>(ExprKind::Name, peek().line);
+    target->value = expectName();
+    std::string fullName = target->value;
+
+    while (check(".") || check(":")) {
+        bool method = check(":");
+        advance();
+        auto key = std::make_shared<Expr>(ExprKind::String, peek().line);
+        key->value = expectName();
+        fullName += (method ? ":" : ".") + key->value;
+
+        auto index = std::make_shared<Expr>(ExprKind::Index, key->line);
+        index->lhs = target;
+        index->rhs = key;
+        target = index;
+
+        if (method) {
+            stat->method = true;
+            break;
+        }
+    }
+
+    stat->targets.push_back(target);
+    stat->func = parseFunctionBody(line, fullName);
+    if (stat->method) stat->func->params.insert(stat->func->params.begin(), "self");
+    return stat;
+}
+
+StatPtr LuaParser::parseLocal(int line) {
+    if (accept("function")) {
+        auto stat = std::make_shared<Stat>(StatKind::LocalFunction, line);
+        stat->names.push_back(expectName());
+        stat->func = parseFunctionBody(line, stat->names[0]);
+        return stat;
+    }
+
+    auto stat = std::make_shared<Stat>(StatKind::Local, line);
+    do {
+        stat->names.push_back(expectName());
+        std::string attrib;
+        if (accept("<")) {
+            attrib = expectName();
+            expect(">");
+        }
+        stat->attribs.push_back(attrib);
+    } while (accept(","));
+
+    if (accept("=")) {
+        stat->exprs = parseExprList();
+        if (stat->names.size() == 1 && stat->exprs.size() == 1 && stat->exprs[0]->kind == ExprKind::Function) {
+            stat->exprs[0]->func->name = stat->names[0];
+        }
+    }
+    return stat;
+}
+
+StatPtr LuaParser::parseExprStat(int line) {
+    ExprPtr first = parseSuffixedExpr();
+
+    if (check("=") || check(",")) {
+        auto stat = std::make_shared<Stat>(StatKind::Assign, line);
+        stat->targets.push_back(first);
+        while (accept(",")) stat->targets.push_back(parseSuffixedExpr());
+        expect("=");
+        stat->exprs = parseExprList();
+
+        for (const auto& target : stat->targets) {
+            if (target->kind != ExprKind::Name && target->kind != ExprKind::Index) fail("syntax error");
+        }
+        if (stat->targets.size() == 1 && stat->exprs.size() == 1 && stat->exprs[0]->kind == ExprKind::Function &&
+            stat->targets[0]->kind == ExprKind::Name) {
+            stat->exprs[0]->func->name = stat->targets[0]->value;
+        }
+        return stat;
+    }
+
+    if (first->kind != ExprKind::Call && first->kind != ExprKind::Method) fail("syntax error");
+    auto stat = std::make_shared<Stat>(StatKind::Call, line);
+    stat->expr = first;
+    return stat;
+}
+
+FunctionPtr LuaParser::parseFunctionBody(int line, const std::string& name) {
+    auto func = std::make_shared<Function>();
+    func->line = line;
+    func->name = name;
+
+    expect("(");
+    if (!check(")")) {
+        do {
+            if (accept("...")) {
+                func->vararg = true;
+                break;
+            }
+            func->params.push_back(expectName());
+        } while (accept(","));
+    }
+    expect(")");
+
+    func->body = parseBlock();
+    func->endLine = peek().line;
+    expect("end");
+    return func;
+}
+
+std::vector<ExprPtr> LuaParser::parseExprList() {
+    std::vector<ExprPtr> exprs;
+    exprs.push_back(parseExpr());
+    while (accept(",")) exprs.push_back(parseExpr());
+    return exprs;
+}
+
+ExprPtr LuaParser::parseExpr(int limit) {
+    ExprPtr left;
+    int line = peek().line;
+
+    if (check("not") || check("-") || check("#") || check("~")) {
+        auto unary = std::make_shared<Expr>(ExprKind::Unary, line);
+        unary->value = advance().text;
+        unary->lhs = parseExpr(UNARY_PRIORITY);
+        left = unary;
+    } else {
+        left = parseSimpleExpr();
+    }
+
+    while (true) {
+        const Token& token = peek();
+        if (token.type != TokenType::Symbol && token.type != TokenType::Keyword) break;
+        int priority = leftPriority(token.text);
+        if (priority < 0 || priority <= limit) break;
+
+        auto binary = std::make_shared<Expr>(ExprKind::Binary, token.line);
+        binary->value = advance().text;
+        binary->lhs = left;
+        binary->rhs = parseExpr(rightPriority(binary->value));
+        left = binary;
+    }
+
+    return left;
+}
+
+ExprPtr LuaParser::parseSimpleExpr() {
+    const Token& token = peek();
+    int line = token.line;
+
+    switch (token.type) {
+        case TokenType::Number: {
+            auto expr = std::make_shared<Expr>(ExprKind::Number, line);
+            expr->value = advance().text;
+            return expr;
+        }
+        case TokenType::String: {
+            auto expr = std::make_shared<Expr>(ExprKind::String, line);
+            expr->literal = peek().text;
+            expr->value = advance().value;
+            return expr;
+        }
+        default:
+            break;
+    }
+
+    if (accept("nil")) return std::make_shared<Expr>(ExprKind::Nil, line);
+    if (accept("true")) return std::make_shared<Expr>(ExprKind::True, line);
+    if (accept("false")) return std::make_shared<Expr>(ExprKind::False, line);
+    if (accept("...")) return std::make_shared<Expr>(ExprKind::Vararg, line);
+    if (check("{")) return parseTable();
+
+    if (check("function")) {
+        std::string annotation = advance().annotation;
+        auto expr = std::make_shared<Expr>(ExprKind::Function, line);
+        expr->func = parseFunctionBody(line, "");
+        expr->func->annotation = annotation;
+        return expr;
+    }
+
+    return parseSuffixedExpr();
+}
+
+ExprPtr LuaParser::parsePrimaryExpr() {
+    int line = peek().line;
+
+    if (peek().type == TokenType::Name) {
+        auto expr = std::make_shared<Expr>(ExprKind::Name, line);
+        expr->value = advance().text;
+        return expr;
+    }
+
+    if (accept("(")) {
+        auto expr = std::make_shared<Expr>(ExprKind::Paren, line);
+        expr->lhs = parseExpr();
+        expect(")");
+        return expr;
+    }
+
+    fail("unexpected symbol");
+}
+
+ExprPtr LuaParser::parseSuffixedExpr() {
+    ExprPtr expr = parsePrimaryExpr();
+
+    while (true) {
+        int line = peek().line;
+
+        if (accept(".")) {
+            auto key = std::make_shared<Expr>(ExprKind::String, line);
+            key->value = expectName();
+            auto index = std::make_shared<Expr>(ExprKind::Index, line);
+            index->lhs = expr;
+            index->rhs = key;
+            expr = index;
+        } else if (accept("[")) {
+            auto index = std::make_shared<Expr>(ExprKind::Index, line);
+            index->lhs = expr;
+            index->rhs = parseExpr();
+            expect("]");
+            expr = index;
+        } else if (accept(":")) {
+            auto call = std::make_shared<Expr>(ExprKind::Method, line);
+            call->lhs = expr;
+            call->value = expectName();
+            call->args = parseCallArgs();
+            expr = call;
+        } else if (check("(") || check("{") || peek().type == TokenType::String) {
+            auto call = std::make_shared<Expr>(ExprKind::Call, line);
+            call->lhs = expr;
+            call->args = parseCallArgs();
+            expr = call;
+        } else {
+            return expr;
+        }
+    }
+}
+
+std::vector<ExprPtr> LuaParser::parseCallArgs() {
+    if (peek().type == TokenType::String) {
+        auto expr = std::make_shared<Expr>(ExprKind::String, peek().line);
+        expr->literal = peek().text;
+        expr->value = advance().value;
+        return {expr};
+    }
+
+    if (check("{")) return {parseTable()};
+
+    expect("(");
+    std::vector<ExprPtr> args;
+    if (!check(")")) args = parseExprList();
+    expect(")");
+    return args;
+}
+
+ExprPtr LuaParser::parseTable() {
+    auto table = std::make_shared<Expr>(ExprKind::Table, peek().line);
+    expect("{");
+
+    while (!check("}")) {
+        TableField field;
+        if (accept("[")) {
+            field.kind = TableField::Keyed;
+            field.key = parseExpr();
+            expect("]");
+            expect("=");
+            field.value = parseExpr();
+        } else if (peek().type == TokenType::Name && peek(1).type == TokenType::Symbol && peek(1).text == "=") {
+            field.kind = TableField::Named;
+            field.name = advance().text;
+            advance();
+            field.value = parseExpr();
+        } else {
+            field.value = parseExpr();
+        }
+        table->fields.push_back(field);
+
+        if (!accept(",") && !accept(";")) break;
+    }
+
+    expect("}");
+    return table;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "LuaAst.hpp"
+#include "LuaLexer.hpp"
+
+class LuaParser {
+private:
+    std::vector<Token> tokens;
+    size_t current;
+
+    const Token& peek(size_t ahead = 0) const;
+    const Token& advance();
+    bool check(const std::string& text) const;
+    bool accept(const std::string& text);
+    void expect(const std::string& text);
+    std::string expectName();
+    [[noreturn]] void fail(const std::string& message) const;
+
+    bool blockFollows() const;
+    BlockPtr parseBlock();
+    StatPtr parseStatement();
+    StatPtr parseIf(int line);
+    StatPtr parseFor(int line);
+    StatPtr parseFunctionStat(int line);
+    StatPtr parseLocal(int line);
+    StatPtr parseExprStat(int line);
+    FunctionPtr parseFunctionBody(int line, const std::string& name);
+
+    ExprPtr parseExpr(int limit = 0);
+    ExprPtr parseSimpleExpr();
+    ExprPtr parsePrimaryExpr();
+    ExprPtr parseSuffixedExpr();
+    std::vector<ExprPtr> parseExprList();
+    std::vector<ExprPtr> parseCallArgs();
+    ExprPtr parseTable();
+
+public:
+    static int leftPriority(const std::string& op);
+    static int rightPriority(const std::string& op);
+    static constexpr int UNARY_PRIORITY = 12;
+
+    explicit LuaParser(const std::string& source, Target::Kind target = Target::Lua54);
+    BlockPtr parse();
+};
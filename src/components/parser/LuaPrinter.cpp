@@ -0,0 +1,316 @@
+#include "LuaPrinter.hpp"
+#include "LuaLexer.hpp"
+#include "LuaParser.hpp"
+#include <cctype>
+
+LuaPrinter::LuaPrinter() : indent(0), annotations(false), annotated(nullptr) {}
+
+std::string LuaPrinter::print(const Block& block, bool annotations) {
+    LuaPrinter printer;
+    printer.annotations = annotations;
+    printer.printBlock(block);
+    return printer.out.str();
+}
+
+std::string LuaPrinter::printExpr(const Expr& expr) {
+    LuaPrinter printer;
+    return printer.printExprWithIndent(expr);
+}
+
+bool LuaPrinter::isIdentifier(const std::string& name) {
+    if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0]))) return false;
+    for (char c : name) {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_') return false;
+    }
+    return !LuaLexer::isKeyword(name);
+}
+
+std::string LuaPrinter::quote(const std::string& value) {
+    std::string result = "\"";
+    for (size_t i = 0; i < value.length(); ++i) {
+        unsigned char c = static_cast<unsigned char>(value[i]);
+        switch (c) {
+            case '"': result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\n': result += "\\n"; break;
+            case '\r': result += "\\r"; break;
+            case '\t': result += "\\t"; break;
+            default:
+                if (c < 0x20 || c == 0x7F) {
+                    bool digitFollows = i + 1 < value.length() && std::isdigit(static_cast<unsigned char>(value[i + 1]));
+                    std::string digits = std::to_string(c);
+                    result += '\\';
+                    if (digitFollows) result.append(3 - digits.length(), '0');
+                    result += digits;
+                } else {
+                    result += static_cast<char>(c);
+                }
+        }
+    }
+    return result + "\"";
+}
+
+std::string LuaPrinter::pad() const {
+    return std::string(indent * 4, ' ');
+}
+
+void LuaPrinter::printBlock(const Block& block) {
+    for (const auto& stat : block.stats) {
+        printStat(*stat);
+    }
+}
+
+std::string LuaPrinter::printList(const std::vector<ExprPtr>& exprs) {
+    std::string result;
+    for (size_t i = 0; i < exprs.size(); ++i) {
+        if (i > 0) result += ", ";
+        result += printExprWithIndent(*exprs[i]);
+    }
+    return result;
+}
+
+std::string LuaPrinter::printFunction(const Function& func, bool skipSelf) {
+    std::string result = "(";
+    bool first = true;
+    for (size_t i = skipSelf ? 1 : 0; i < func.params.size(); ++i) {
+        if (!first) result += ", ";
+        result += func.params[i];
+        first = false;
+    }
+    if (func.vararg) result += first ? "..." : ", ...";
+    result += ")\n";
+
+    LuaPrinter nested;
+    nested.indent = indent + 1;
+    nested.annotations = annotations;
+    nested.printBlock(*func.body);
+
+    result += nested.out.str() + pad() + "end";
+    return result;
+}
+
+std::string LuaPrinter::printPrefix(const ExprPtr& expr) {
+    switch (expr->kind) {
+        case ExprKind::Name:
+        case ExprKind::Index:
+        case ExprKind::Call:
+        case ExprKind::Method:
+        case ExprKind::Paren:
+            return printExprWithIndent(*expr);
+        default:
+            return "(" + printExprWithIndent(*expr) + ")";
+    }
+}
+
+std::string LuaPrinter::printOperand(const ExprPtr& expr, const std::string& op, bool right) {
+    std::string text = printExprWithIndent(*expr);
+    bool wrap = false;
+
+    if (op.empty()) {
+        // Operand of a unary operator: only '^' binds tighter
+        wrap = expr->kind == ExprKind::Binary && LuaParser::leftPriority(expr->value) <= LuaParser::UNARY_PRIORITY;
+    } else if (expr->kind == ExprKind::Binary) {
+        wrap = right ? LuaParser::leftPriority(expr->value) <= LuaParser::rightPriority(op)
+                     : LuaParser::rightPriority(expr->value) < LuaParser::leftPriority(op);
+    } else if (expr->kind == ExprKind::Unary) {
+        wrap = !right && LuaParser::leftPriority(op) > LuaParser::UNARY_PRIORITY;
+    }
+
+    return wrap ? "(" + text + ")" : text;
+}
+
+std::string LuaPrinter::printExprWithIndent(const Expr& expr) {
+    switch (expr.kind) {
+        case ExprKind::Nil: return "nil";
+        case ExprKind::True: return "true";
+        case ExprKind::False: return "false";
+        case ExprKind::Vararg: return "...";
+        case ExprKind::Number: return expr.value;
+        case ExprKind::String: return expr.literal.empty() ? quote(expr.value) : expr.literal;
+        case ExprKind::Name: return expr.value;
+        case ExprKind::Function: {
+            // Inline, so the lexer hands it to the function keyword
+            std::string head = !annotations || expr.func->annotation.empty() || expr.func.get() == annotated ? "function"
+                             : "--[[@obf:" + expr.func->annotation + "]] function";
+            return head + printFunction(*expr.func, false);
+        }
+        case ExprKind::Paren: return "(" + printExprWithIndent(*expr.lhs) + ")";
+
+        case ExprKind::Table: {
+            if (expr.fields.empty()) return "{}";
+            std::string result = "{";
+            for (size_t i = 0; i < expr.fields.size(); ++i) {
+                const auto& field = expr.fields[i];
+                if (i > 0) result += ", ";
+                if (field.kind == TableField::Named) {
+                    result += field.name + " = ";
+                } else if (field.kind == TableField::Keyed) {
+                    result += "[" + printExprWithIndent(*field.key) + "] = ";
+                }
+                result += printExprWithIndent(*field.value);
+            }
+            return result + "}";
+        }
+
+        case ExprKind::Binary:
+            return printOperand(expr.lhs, expr.value, false) + " " + expr.value + " " + printOperand(expr.rhs, expr.value, true);
+
+        case ExprKind::Unary: {
+            std::string operand = printOperand(expr.lhs, "", false);
+            if (expr.value == "not" || (!operand.empty() && operand[0] == expr.value[0])) {
+                return expr.value + " " + operand;
+            }
+            return expr.value + operand;
+        }
+
+        case ExprKind::Index:
+            if (expr.rhs->kind == ExprKind::String && isIdentifier(expr.rhs->value)) {
+                return printPrefix(expr.lhs) + "." + expr.rhs->value;
+            }
+            return printPrefix(expr.lhs) + "[" + printExprWithIndent(*expr.rhs) + "]";
+
+        case ExprKind::Call:
+            return printPrefix(expr.lhs) + "(" + printList(expr.args) + ")";
+
+        case ExprKind::Method:
+            return printPrefix(expr.lhs) + ":" + expr.value + "(" + printList(expr.args) + ")";
+    }
+    return "";
+}
+
+void LuaPrinter::printStat(const Stat& stat) {
+    std::string line;
+
+    // On a line of its own, where the lexer picks it up for the statement that follows
+    const std::string& annotation = stat.annotation.empty() && stat.func ? stat.func->annotation : stat.annotation;
+    if (annotations && !annotation.empty()) {
+        out << pad() << "--@obf:" << annotation << "\n";
+        if ((stat.kind == StatKind::Local || stat.kind == StatKind::Assign) && stat.exprs.size() == 1 &&
+            stat.exprs[0]->kind == ExprKind::Function &&
+            stat.exprs[0]->func->annotation == annotation) {
+            annotated = stat.exprs[0]->func.get();
+        }
+    }
+
+    switch (stat.kind) {
+        case StatKind::Local: {
+            line = "local ";
+            for (size_t i = 0; i < stat.names.size(); ++i) {
+                if (i > 0) line += ", ";
+                line += stat.names[i];
+                if (i < stat.attribs.size() && !stat.attribs[i].empty()) line += " <" + stat.attribs[i] + ">";
+            }
+            if (!stat.exprs.empty()) line += " = " + printList(stat.exprs);
+            break;
+        }
+
+        case StatKind::Assign: {
+            for (size_t i = 0; i < stat.targets.size(); ++i) {
+                if (i > 0) line += ", ";
+                line += printExprWithIndent(*stat.targets[i]);
+            }
+            line += " = " + printList(stat.exprs);
+            break;
+        }
+
+        case StatKind::Call:
+            line = printExprWithIndent(*stat.expr);
+            break;
+
+        case StatKind::Do:
+            out << pad() << "do\n";
+            ++indent;
+            printBlock(*stat.blocks[0]);
+            --indent;
+            out << pad() << "end\n";
+            return;
+
+        case StatKind::While:
+            out << pad() << "while " << printExprWithIndent(*stat.exprs[0]) << " do\n";
+            ++indent;
+            printBlock(*stat.blocks[0]);
+            --indent;
+            out << pad() << "end\n";
+            return;
+
+        case StatKind::Repeat:
+            out << pad() << "repeat\n";
+            ++indent;
+            printBlock(*stat.blocks[0]);
+            --indent;
+            out << pad() << "until " << printExprWithIndent(*stat.exprs[0]) << "\n";
+            return;
+
+        case StatKind::If:
+            for (size_t i = 0; i < stat.blocks.size(); ++i) {
+                if (i == 0) {
+                    out << pad() << "if " << printExprWithIndent(*stat.exprs[0]) << " then\n";
+                } else if (i < stat.exprs.size()) {
+                    out << pad() << "elseif " << printExprWithIndent(*stat.exprs[i]) << " then\n";
+                } else {
+                    out << pad() << "else\n";
+                }
+                ++indent;
+                printBlock(*stat.blocks[i]);
+                --indent;
+            }
+            out << pad() << "end\n";
+            return;
+
+        case StatKind::NumericFor:
+            out << pad() << "for " << stat.names[0] << " = " << printList(stat.exprs) << " do\n";
+            ++indent;
+            printBlock(*stat.blocks[0]);
+            --indent;
+            out << pad() << "end\n";
+            return;
+
+        case StatKind::GenericFor: {
+            std::string names;
+            for (size_t i = 0; i < stat.names.size(); ++i) {
+                if (i > 0) names += ", ";
+                names += stat.names[i];
+            }
+            out << pad() << "for " << names << " in " << printList(stat.exprs) << " do\n";
+            ++indent;
+            printBlock(*stat.blocks[0]);
+            --indent;
+            out << pad() << "end\n";
+            return;
+        }
+
+        case StatKind::Function: {
+            const ExprPtr& target = stat.targets[0];
+            std::string name = printExprWithIndent(*target);
+            if (stat.method) {
+                name = printExprWithIndent(*target->lhs) + ":" + target->rhs->value;
+            }
+            line = "function " + name + printFunction(*stat.func, stat.method);
+            break;
+        }
+
+        case StatKind::LocalFunction:
+            line = "local function " + stat.names[0] + printFunction(*stat.func, false);
+            break;
+
+        case StatKind::Return:
+            line = stat.exprs.empty() ? "return" : "return " + printList(stat.exprs);
+            break;
+
+        case StatKind::Break:
+            line = "break";
+            break;
+
+        case StatKind::Goto:
+            line = "goto " + stat.names[0];
+            break;
+
+        case StatKind::Label:
+            line = "::" + stat.names[0] + "::";
+            break;
+    }
+
+    // A statement starting with '(' would otherwise continue the previous call expression
+    if (!line.empty() && line[0] == '(') line = ";" + line;
+    out << pad() << line << "\n";
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+#include <sstream>
+#include "LuaAst.hpp"
+
+class LuaPrinter {
+private:
+    std::stringstream out;
+    int indent;
+    bool annotations;
+    // Function whose annotation the current statement already printed
+    const Function* annotated;
+
+    LuaPrinter();
+    std::string pad() const;
+    void printBlock(const Block& block);
+    void printStat(const Stat& stat);
+    std::string printFunction(const Function& func, bool skipSelf);
+    std::string printList(const std::vector<ExprPtr>& exprs);
+    std::string printPrefix(const ExprPtr& expr);
+    std::string printOperand(const ExprPtr& expr, const std::string& op, bool right);
+    std::string printExprWithIndent(const Expr& expr);
+
+public:
+    // Annotations are only printed for source that later passes parse again; output never carries them
+    static std::string print(const Block& block, bool annotations = false);
+    static std::string printExpr(const Expr& expr);
+    static std::string quote(const std::string& value);
+    static bool isIdentifier(const std::string& name);
+};
@@ -0,0 +1,355 @@
+#include "BlockFlattener.hpp"
+#include <set>
+#include <cmath>
+#include <algorithm>
+#include "../parser/AstWalker.hpp"
+#include "StateAllocator.hpp"
+
+const char* BlockFlattener::STATE_VAR = "__cf";
+
+static ExprPtr makeName(const std::string& name) {
+    auto expr = std::make_shared<Expr>(ExprKind::Name);
+    expr->value = name;
+    return expr;
+}
+
+static ExprPtr makeNumber(int value) {
+    auto expr = std::make_shared<Expr>(ExprKind::Number);
+    expr->value = std::to_string(value);
+    return expr;
+}
+
+static StatPtr makeAssign(ExprPtr target, ExprPtr value) {
+    auto stat = std::make_shared<Stat>(StatKind::Assign);
+    stat->targets.push_back(target);
+    stat->exprs.push_back(value);
+    return stat;
+}
+
+size_t BlockFlattener::findPrologue(const Block& body) {
+    // Locals that are referenced before their declaration (or by it) cannot be hoisted,
+    // so everything up to the last such declaration stays in front of the state machine
+    size_t prologue = 0;
+    std::set<std::string> used, declared;
+
+    for (size_t i = 0; i < body.stats.size(); ++i) {
+        Stat& stat = *body.stats[i];
+        std::set<std::string> names = AstWalker::namesUsed(stat);
+
+        if (stat.kind == StatKind::Local || stat.kind == StatKind::LocalFunction) {
+            bool conflict = false;
+            for (size_t j = 0; j < stat.names.size(); ++j) {
+                const std::string& name = stat.names[j];
+                if (used.count(name) || declared.count(name)) conflict = true;
+                if (stat.kind == StatKind::Local && names.count(name)) conflict = true;
+                if (j < stat.attribs.size() && !stat.attribs[j].empty()) conflict = true;
+            }
+            if (conflict) {
+                prologue = i + 1;
+                used.clear();
+                declared.clear();
+                continue;
+            }
+            declared.insert(stat.names.begin(), stat.names.end());
+        }
+        used.insert(names.begin(), names.end());
+    }
+    return prologue;
+}
+
+bool BlockFlattener::containsGoto(Block& block) {
+    bool found = false;
+    AstWalker::walk(block, [&](Stat& stat) {
+        if (stat.kind == StatKind::Goto || stat.kind == StatKind::Label) found = true;
+    }, nullptr, false);
+    return found;
+}
+
+bool BlockFlattener::hasLoopBreak(const Block& block) {
+    for (const auto& stat : block.stats) {
+        if (stat->kind == StatKind::Break) return true;
+        if (stat->kind == StatKind::If || stat->kind == StatKind::Do) {
+            for (const auto& inner : stat->blocks) {
+                if (hasLoopBreak(*inner)) return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool BlockFlattener::declaresLocals(const Block& block) {
+    for (const auto& stat : block.stats) {
+        if (stat->kind == StatKind::Local || stat->kind == StatKind::LocalFunction) return true;
+    }
+    return false;
+}
+
+int BlockFlattener::addState(Plan& plan, std::vector<StatPtr> stats, double weight) {
+    plan.states.push_back(State{std::move(stats)});
+    plan.dispatches += weight;
+    return static_cast<int>(plan.states.size()) - 1;
+}
+
+void BlockFlattener::appendJump(Plan& plan, std::vector<StatPtr>& stats, int target) {
+    if (!stats.empty() && stats.back()->kind == StatKind::Return) return;
+    if (target == EXIT) {
+        stats.push_back(std::make_shared<Stat>(StatKind::Return));
+        return;
+    }
+    ExprPtr id = makeNumber(0);
+    plan.fixups.emplace_back(id, target);
+    stats.push_back(makeAssign(makeName(STATE_VAR), id));
+}
+
+int BlockFlattener::buildSequence(Plan& plan, const std::vector<StatPtr>& stats, size_t begin, int next, double weight) {
+    auto splits = [&](const Stat& stat) {
+        if (stat.kind == StatKind::If) return true;
+        return stat.kind == StatKind::While && plan.level >= Loops && !hasLoopBreak(*stat.blocks[0]);
+    };
+
+    // Built back to front so every state already knows its successor
+    int entry = next;
+    size_t end = stats.size();
+    while (end > begin) {
+        const Stat& last = *stats[end - 1];
+        if (last.kind == StatKind::If) {
+            entry = buildIf(plan, last, entry, weight);
+            --end;
+            continue;
+        }
+        if (splits(last)) {
+            entry = buildWhile(plan, last, entry, weight);
+            --end;
+            continue;
+        }
+
+        size_t start = end - 1;
+        if (plan.level != Statements) {
+            while (start > begin && !splits(*stats[start - 1])) --start;
+        }
+        std::vector<StatPtr> run(stats.begin() + start, stats.begin() + end);
+        appendJump(plan, run, entry);
+        entry = addState(plan, std::move(run), weight);
+        end = start;
+    }
+    return entry;
+}
+
+int BlockFlattener::buildBody(Plan& plan, const Block& body, int next, double weight) {
+    // Blocks with their own locals stay in one state so their scope is unchanged
+    if (declaresLocals(body)) {
+        std::vector<StatPtr> run = body.stats;
+        appendJump(plan, run, next);
+        return addState(plan, std::move(run), weight);
+    }
+    return buildSequence(plan, body.stats, 0, next, weight);
+}
+
+int BlockFlattener::buildIf(Plan& plan, const Stat& stat, int next, double weight) {
+    auto branch = std::make_shared<Stat>(StatKind::If, stat.line);
+    branch->exprs = stat.exprs;
+
+    double share = weight / (stat.exprs.size() + 1);
+    for (const auto& body : stat.blocks) {
+        int target = buildBody(plan, *body, next, share);
+        auto block = std::make_shared<Block>();
+        appendJump(plan, block->stats, target);
+        branch->blocks.push_back(block);
+    }
+    if (stat.blocks.size() == stat.exprs.size()) {
+        auto block = std::make_shared<Block>();
+        appendJump(plan, block->stats, next);
+        branch->blocks.push_back(block);
+    }
+    return addState(plan, {branch}, weight);
+}
+
+int BlockFlattener::buildWhile(Plan& plan, const Stat& stat, int next, double weight) {
+    double inner = weight * LOOP_WEIGHT;
+    int header = addState(plan, {}, inner);
+    int body = buildBody(plan, *stat.blocks[0], header, inner);
+
+    auto branch = std::make_shared<Stat>(StatKind::If, stat.line);
+    branch->exprs.push_back(stat.exprs[0]);
+    branch->blocks.push_back(std::make_shared<Block>());
+    branch->blocks.push_back(std::make_shared<Block>());
+    appendJump(plan, branch->blocks[0]->stats, body);
+    appendJump(plan, branch->blocks[1]->stats, next);
+    plan.states[header].stats.push_back(branch);
+    return header;
+}
+
+std::vector<StatPtr> BlockFlattener::buildTree(const std::vector<std::pair<int, const State*>>& states, size_t begin, size_t end, int depth, int& maxDepth) {
+    if (end - begin == 1) {
+        maxDepth = std::max(maxDepth, depth);
+        return states[begin].second->stats;
+    }
+
+    size_t mid = begin + (end - begin) / 2;
+    auto cond = std::make_shared<Expr>(ExprKind::Binary);
+    cond->value = "<";
+    cond->lhs = makeName(STATE_VAR);
+    cond->rhs = makeNumber(states[mid].first);
+
+    auto branch = std::make_shared<Stat>(StatKind::If);
+    branch->exprs.push_back(cond);
+    branch->blocks.push_back(std::make_shared<Block>());
+    branch->blocks.push_back(std::make_shared<Block>());
+    branch->blocks[0]->stats = buildTree(states, begin, mid, depth + 1, maxDepth);
+    branch->blocks[1]->stats = buildTree(states, mid, end, depth + 1, maxDepth);
+    return {branch};
+}
+
+std::vector<StatPtr> BlockFlattener::linearize(const Block& body, size_t prologue, std::vector<std::string>& hoisted) {
+    // Locals after the prologue are declared up front and assigned in place
+    std::vector<StatPtr> stats;
+    for (size_t i = prologue; i < body.stats.size(); ++i) {
+        const StatPtr& stat = body.stats[i];
+        if (stat->kind == StatKind::Local) {
+            hoisted.insert(hoisted.end(), stat->names.begin(), stat->names.end());
+            if (stat->exprs.empty()) continue;
+            auto assign = std::make_shared<Stat>(StatKind::Assign, stat->line);
+            for (const auto& name : stat->names) assign->targets.push_back(makeName(name));
+            assign->exprs = stat->exprs;
+            stats.push_back(assign);
+        } else if (stat->kind == StatKind::LocalFunction) {
+            hoisted.push_back(stat->names[0]);
+            auto value = std::make_shared<Expr>(ExprKind::Function, stat->line);
+            value->func = stat->func;
+            stats.push_back(makeAssign(makeName(stat->names[0]), value));
+        } else {
+            stats.push_back(stat);
+        }
+    }
+    return stats;
+}
+
+BlockFlattener::Report BlockFlattener::measure(Plan& plan, const std::vector<StatPtr>& stats, int level, int fakePercent) {
+    Report report;
+    plan.level = level;
+    plan.entry = buildSequence(plan, stats, 0, EXIT, 1.0);
+
+    size_t real = plan.states.size();
+    size_t fakes = real * std::max(fakePercent, 0) / 100;
+    report.level = level;
+    report.realStates = real;
+    report.fakeStates = fakes;
+    report.depth = real + fakes > 0 ? static_cast<int>(std::ceil(std::log2(static_cast<double>(real + fakes)))) : 0;
+    report.dispatches = plan.dispatches;
+    report.cost = plan.dispatches * (report.depth + 1);
+    return report;
+}
+
+std::vector<BlockFlattener::Report> BlockFlattener::estimate(Function& func, int fakePercent) {
+    std::vector<Report> levels;
+    Block& body = *func.body;
+    if (containsGoto(body)) return levels;
+
+    std::vector<std::string> hoisted;
+    std::vector<StatPtr> stats = linearize(body, findPrologue(body), hoisted);
+    if (hoisted.size() > MAX_HOISTED) return levels;
+    for (int level = Statements; level >= Blocks; --level) {
+        Plan candidate;
+        Report report = measure(candidate, stats, level, fakePercent);
+        if (report.realStates < 2) break;
+        levels.push_back(report);
+    }
+    return levels;
+}
+
+BlockFlattener::Report BlockFlattener::flatten(Function& func, double budget, int fakePercent, std::mt19937& gen) {
+    Report report;
+    Block& body = *func.body;
+    if (containsGoto(body)) {
+        report.reason = "uses goto";
+        return report;
+    }
+
+    size_t prologue = findPrologue(body);
+    std::vector<std::string> hoisted;
+    std::vector<StatPtr> stats = linearize(body, prologue, hoisted);
+    if (hoisted.size() > MAX_HOISTED) {
+        report.reason = "too many locals";
+        return report;
+    }
+
+    // Pick the most aggressive level whose estimated cost fits the budget
+    Plan plan;
+    bool found = false;
+    for (int level = Statements; level >= Blocks && !found; --level) {
+        Plan candidate;
+        Report measured = measure(candidate, stats, level, fakePercent);
+        if (measured.realStates < 2) {
+            report.reason = level == Statements ? "too few blocks" : "over budget";
+            return report;
+        }
+        report = measured;
+        if (report.cost <= budget) {
+            plan = std::move(candidate);
+            found = true;
+        }
+    }
+    if (!found) {
+        report.reason = "over budget";
+        return report;
+    }
+
+    StateAllocator allocator(report.realStates + report.fakeStates, gen);
+    std::vector<int> ids;
+    for (size_t i = 0; i < plan.states.size(); ++i) {
+        ids.push_back(allocator.next());
+    }
+    for (auto& [expr, target] : plan.fixups) {
+        expr->value = std::to_string(ids[target]);
+    }
+
+    std::vector<std::pair<int, const State*>> entries;
+    for (size_t i = 0; i < plan.states.size(); ++i) {
+        entries.emplace_back(ids[i], &plan.states[i]);
+    }
+
+    // Fake blocks replay a real block without nested functions, or just jump to a real state
+    std::vector<State> fakes(report.fakeStates);
+    std::uniform_int_distribution<size_t> pick(0, plan.states.size() - 1);
+    for (auto& fake : fakes) {
+        const State& source = plan.states[pick(gen)];
+        bool nested = false;
+        for (const auto& stat : source.stats) {
+            AstWalker::walk(*stat, [&](Stat& inner) {
+                if (inner.func) nested = true;
+            }, [&](Expr& expr) {
+                if (expr.kind == ExprKind::Function) nested = true;
+            }, false);
+        }
+        if (!nested && !source.stats.empty()) {
+            fake.stats = source.stats;
+        } else {
+            fake.stats.push_back(makeAssign(makeName(STATE_VAR), makeNumber(ids[pick(gen)])));
+        }
+        entries.emplace_back(allocator.next(), &fake);
+    }
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    int depth = 0;
+    auto loop = std::make_shared<Stat>(StatKind::While);
+    loop->exprs.push_back(std::make_shared<Expr>(ExprKind::True));
+    loop->blocks.push_back(std::make_shared<Block>());
+    loop->blocks[0]->stats = buildTree(entries, 0, entries.size(), 0, depth);
+
+    std::vector<StatPtr> result(body.stats.begin(), body.stats.begin() + prologue);
+    if (!hoisted.empty()) {
+        auto decl = std::make_shared<Stat>(StatKind::Local);
+        decl->names = hoisted;
+        result.push_back(decl);
+    }
+    auto state = std::make_shared<Stat>(StatKind::Local);
+    state->names.push_back(STATE_VAR);
+    state->exprs.push_back(makeNumber(ids[plan.entry]));
+    result.push_back(state);
+    result.push_back(loop);
+    body.stats = std::move(result);
+
+    report.flattened = true;
+    report.depth = depth;
+    return report;
+}
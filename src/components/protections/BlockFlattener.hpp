@@ -0,0 +1,63 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <random>
+#include <utility>
+#include "../parser/LuaAst.hpp"
+
+// Rewrites a function body into a state machine that dispatches over its basic blocks
+class BlockFlattener {
+public:
+    // Statements: one state per statement, Loops: one state per block with while loops split,
+    // Blocks: one state per block with loops kept whole
+    enum Level { Blocks = 0, Loops = 1, Statements = 2 };
+
+    struct Report {
+        bool flattened = false;
+        std::string reason;
+        int level = 0;
+        size_t realStates = 0;
+        size_t fakeStates = 0;
+        int depth = 0;
+        double dispatches = 0;
+        double cost = 0;
+    };
+
+    static Report flatten(Function& func, double budget, int fakePercent, std::mt19937& gen);
+    // Reports of the levels flatten would consider, most aggressive first, without rewriting anything
+    static std::vector<Report> estimate(Function& func, int fakePercent);
+
+private:
+    struct State {
+        std::vector<StatPtr> stats;
+    };
+
+    struct Plan {
+        std::vector<State> states;
+        // State literals are patched once the sparse IDs are drawn
+        std::vector<std::pair<ExprPtr, int>> fixups;
+        int level = 0;
+        int entry = 0;
+        double dispatches = 0;
+    };
+
+    static constexpr int EXIT = -1;
+    static constexpr double LOOP_WEIGHT = 8.0;
+    static constexpr size_t MAX_HOISTED = 150;
+    static const char* STATE_VAR;
+
+    static size_t findPrologue(const Block& body);
+    static bool containsGoto(Block& block);
+    static bool hasLoopBreak(const Block& block);
+    static bool declaresLocals(const Block& block);
+
+    static std::vector<StatPtr> linearize(const Block& body, size_t prologue, std::vector<std::string>& hoisted);
+    static Report measure(Plan& plan, const std::vector<StatPtr>& stats, int level, int fakePercent);
+    static int addState(Plan& plan, std::vector<StatPtr> stats, double weight);
+    static void appendJump(Plan& plan, std::vector<StatPtr>& stats, int target);
+    static int buildSequence(Plan& plan, const std::vector<StatPtr>& stats, size_t begin, int next, double weight);
+    static int buildBody(Plan& plan, const Block& body, int next, double weight);
+    static int buildIf(Plan& plan, const Stat& stat, int next, double weight);
+    static int buildWhile(Plan& plan, const Stat& stat, int next, double weight);
+    static std::vector<StatPtr> buildTree(const std::vector<std::pair<int, const State*>>& states, size_t begin, size_t end, int depth, int& maxDepth);
+};
@@ -1,22 +1,51 @@
 #pragma once
 #include <string>
+#include <vector>
 #include "../../components/ConfigParser.hpp"
+#include "../parser/LuaLexer.hpp"
 
+// Minifies Lua source from its token stream: comments and whitespace are dropped and tokens are joined with a
+// space only where they would otherwise lex differently. String and number tokens are copied verbatim. Locals can
+// first be given short scope-aware names (see LocalRenamer).
 class Compression {
-private:
-    static std::string compressLua(const std::string& code);
-    static std::string optimizeAst(const std::string& code);
-    static std::string shortenVariables(const std::string& code);
-    static std::string removeWhitespace(const std::string& code);
-    static std::string optimizeStrings(const std::string& code);
-    static std::string mergeAdjacentStrings(const std::string& code);
-    
-    static std::string removeEmptyLines(const std::string& code);
-    static std::string optimizeNumbers(const std::string& code);
-    static std::string optimizeOperators(const std::string& code);
-    static std::string optimizeBooleans(const std::string& code);
-    static std::string optimizeLocalDeclarations(const std::string& code);
-
 public:
-    static std::string compress(const std::string& code, const ConfigParser& config);
-}; 
\ No newline at end of file
+    static constexpr int MAX_LEVEL = 9;
+
+    // Passes behind each [Compression] level: 1 minifies, 2 also renames locals, 3 also folds constants before the
+    // protections run, 4-9 also compress the VM payload with increasing match-finder effort
+    struct Tier {
+        bool minify = false;
+        bool renameLocals = false;
+        bool foldConstants = false;
+        int payloadEffort = 0;
+    };
+
+    struct Stats {
+        size_t inputBytes = 0;
+        size_t outputBytes = 0;
+        size_t tokens = 0;
+        size_t separatorsDropped = 0;
+        size_t localsRenamed = 0;
+        size_t names = 0;
+        double seconds = 0;
+    };
+
+    static Tier tier(int level);
+    static Tier fromConfig(const ConfigParser& config);
+    static std::string describe(const Tier& tier);
+
+    static std::string minify(const std::string& code, Stats& stats, Target::Kind target, bool rename = false);
+    static void report(const Stats& stats);
+    static std::string compress(const std::string& code, const ConfigParser& config, Target::Kind target, Stats* stats = nullptr);
+    // Runs the whole pipeline once per level and prints time, size and unpack cost, so the levels are compared on the
+    // protected output they produce
+    static bool levelReport(const std::string& inputFile, bool useStrings, bool useJunk, bool useVM, bool useFlow,
+                            const std::string& target, bool bytecode, const std::string& profile);
+    // Constant folding and dead code removal on the parsed source (see ConstantFolder)
+    static std::string optimizeAst(const std::string& code, Target::Kind target);
+
+private:
+    static std::string renameLocals(const std::string& code, Stats& stats, Target::Kind target);
+    static bool needsSpace(const Token& prev, const Token& next);
+    static bool isWordLike(const Token& token);
+};
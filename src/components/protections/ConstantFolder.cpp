@@ -0,0 +1,399 @@
+#include "ConstantFolder.hpp"
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "../parser/AstWalker.hpp"
+
+// Integers beyond this are not exact as doubles, so Lua 5.1 and 5.4 could disagree on the result
+static constexpr int64_t MAX_EXACT = int64_t(1) << 53;
+// Floor division and modulo through doubles (Lua 5.1, LuaJIT) are only exact for small operands
+static constexpr int64_t MAX_DIVISION = int64_t(1) << 31;
+
+ConstantFolder::Report ConstantFolder::fold(Block& chunk) {
+    ConstantFolder folder;
+    folder.visitBlock(chunk);
+    return folder.report;
+}
+
+bool ConstantFolder::parseNumber(const std::string& text, Constant& out) {
+    bool hex = text.size() > 1 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X');
+    if (text.find_first_of(hex ? ".pP" : ".eE") != std::string::npos) {
+        // Hex floats are rare enough to leave alone
+        if (hex) return false;
+        char* end = nullptr;
+        double value = std::strtod(text.c_str(), &end);
+        return *end == '\0' && makeFloat(value, out);
+    }
+
+    int64_t value = 0;
+    int base = hex ? 16 : 10;
+    for (size_t i = hex ? 2 : 0; i < text.size(); ++i) {
+        char c = text[i];
+        int digit = std::isdigit(static_cast<unsigned char>(c)) ? c - '0'
+                  : std::isxdigit(static_cast<unsigned char>(c)) ? std::tolower(static_cast<unsigned char>(c)) - 'a' + 10 : -1;
+        if (digit < 0 || digit >= base) return false;
+        value = value * base + digit;
+        if (value > MAX_EXACT) return false;
+    }
+    return makeInteger(value, out);
+}
+
+ConstantFolder::Constant ConstantFolder::evaluate(const Expr& expr) {
+    Constant value;
+    switch (expr.kind) {
+        case ExprKind::Nil:
+            value.kind = Constant::Nil;
+            break;
+        case ExprKind::True:
+        case ExprKind::False:
+            value.kind = Constant::Boolean;
+            value.boolean = expr.kind == ExprKind::True;
+            break;
+        case ExprKind::Number:
+            if (!parseNumber(expr.value, value)) value.kind = Constant::None;
+            break;
+        case ExprKind::String:
+            value.kind = Constant::String;
+            value.string = expr.value;
+            break;
+        case ExprKind::Unary:
+            // Negative numbers are a minus applied to a literal, which is also how folded results are written back
+            if (expr.value == "-" && expr.lhs->kind == ExprKind::Number) {
+                Constant operand = evaluate(*expr.lhs);
+                if (operand.kind != Constant::None) foldUnary("-", operand, value);
+            }
+            break;
+        default:
+            break;
+    }
+    return value;
+}
+
+bool ConstantFolder::isTruthy(const Constant& value) {
+    return value.kind != Constant::Nil && !(value.kind == Constant::Boolean && !value.boolean);
+}
+
+bool ConstantFolder::isNumber(const Constant& value) {
+    return value.kind == Constant::Integer || value.kind == Constant::Float;
+}
+
+double ConstantFolder::toDouble(const Constant& value) {
+    return value.kind == Constant::Integer ? static_cast<double>(value.integer) : value.number;
+}
+
+bool ConstantFolder::makeInteger(int64_t value, Constant& out) {
+    if (value > MAX_EXACT || value < -MAX_EXACT) return false;
+    out.kind = Constant::Integer;
+    out.integer = value;
+    return true;
+}
+
+bool ConstantFolder::makeFloat(double value, Constant& out) {
+    // inf, nan and -0.0 have no literal
+    if (!std::isfinite(value) || (value == 0 && std::signbit(value))) return false;
+    out.kind = Constant::Float;
+    out.number = value;
+    return true;
+}
+
+bool ConstantFolder::foldUnary(const std::string& op, const Constant& operand, Constant& out) {
+    if (op == "not") {
+        out.kind = Constant::Boolean;
+        out.boolean = !isTruthy(operand);
+        return true;
+    }
+    if (op == "-") {
+        // On runtimes where every number is a double, -0 is negative zero
+        if (operand.kind == Constant::Integer) return operand.integer != 0 && makeInteger(-operand.integer, out);
+        if (operand.kind == Constant::Float) return makeFloat(-operand.number, out);
+        return false;
+    }
+    if (op == "#" && operand.kind == Constant::String) {
+        return makeInteger(static_cast<int64_t>(operand.string.size()), out);
+    }
+    return false;
+}
+
+bool ConstantFolder::foldArithmetic(const std::string& op, const Constant& a, const Constant& b, Constant& out) {
+    if (a.kind == Constant::Integer && b.kind == Constant::Integer) {
+        int64_t x = a.integer, y = b.integer;
+        if (op == "+") return makeInteger(x + y, out);
+        if (op == "-") return makeInteger(x - y, out);
+        if (op == "*") {
+            if (x != 0 && std::llabs(y) > MAX_EXACT / std::llabs(x)) return false;
+            if ((x == 0 || y == 0) && (x < 0 || y < 0)) return false;
+            return makeInteger(x * y, out);
+        }
+        if (op == "//" || op == "%") {
+            if (y == 0 || std::llabs(x) >= MAX_DIVISION || std::llabs(y) >= MAX_DIVISION) return false;
+            int64_t quotient = x / y;
+            if ((x % y != 0) && ((x < 0) != (y < 0))) --quotient;
+            return makeInteger(op == "//" ? quotient : x - quotient * y, out);
+        }
+        if (op == "^") {
+            // Only exact powers, so the host's pow cannot round differently from the runtime's
+            if (y < 0 || y > 64) return false;
+            double result = std::pow(static_cast<double>(x), static_cast<double>(y));
+            if (std::fabs(result) > static_cast<double>(MAX_EXACT)) return false;
+            return makeFloat(result, out);
+        }
+    }
+
+    // Mixed and float arithmetic is correctly rounded IEEE everywhere; float // and % are left to the runtime
+    double x = toDouble(a), y = toDouble(b);
+    if (op == "+") return makeFloat(x + y, out);
+    if (op == "-") return makeFloat(x - y, out);
+    if (op == "*") return makeFloat(x * y, out);
+    if (op == "/") return makeFloat(x / y, out);
+    return false;
+}
+
+bool ConstantFolder::foldBinary(const std::string& op, const Constant& a, const Constant& b, Constant& out) {
+    if (op == "==" || op == "~=") {
+        bool equal;
+        if (isNumber(a) && isNumber(b)) {
+            equal = toDouble(a) == toDouble(b);
+        } else if (a.kind != b.kind) {
+            equal = false;
+        } else {
+            equal = a.kind == Constant::Nil || (a.kind == Constant::Boolean && a.boolean == b.boolean) ||
+                    (a.kind == Constant::String && a.string == b.string);
+        }
+        out.kind = Constant::Boolean;
+        out.boolean = (op == "==") == equal;
+        return true;
+    }
+
+    if (isNumber(a) && isNumber(b)) {
+        double x = toDouble(a), y = toDouble(b);
+        out.kind = Constant::Boolean;
+        if (op == "<") { out.boolean = x < y; return true; }
+        if (op == "<=") { out.boolean = x <= y; return true; }
+        if (op == ">") { out.boolean = x > y; return true; }
+        if (op == ">=") { out.boolean = x >= y; return true; }
+        out.kind = Constant::None;
+        return foldArithmetic(op, a, b, out);
+    }
+
+    // Numbers convert to text differently across versions (1.0 vs 1), so only strings are joined
+    if (op == ".." && a.kind == Constant::String && b.kind == Constant::String) {
+        out.kind = Constant::String;
+        out.string = a.string + b.string;
+        return true;
+    }
+    return false;
+}
+
+std::string ConstantFolder::formatFloat(double value) {
+    char buffer[32];
+    for (int precision = 15; precision <= 17; ++precision) {
+        std::snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+        if (std::strtod(buffer, nullptr) == value) break;
+    }
+    std::string text = buffer;
+    // Keep the result a float on Lua 5.4
+    if (text.find_first_of(".e") == std::string::npos) text += ".0";
+    return text;
+}
+
+ExprPtr ConstantFolder::toExpr(const Constant& value, int line) {
+    switch (value.kind) {
+        case Constant::Nil:
+            return std::make_shared<Expr>(ExprKind::Nil, line);
+        case Constant::Boolean:
+            return std::make_shared<Expr>(value.boolean ? ExprKind::True : ExprKind::False, line);
+        case Constant::String: {
+            auto expr = std::make_shared<Expr>(ExprKind::String, line);
+            expr->value = value.string;
+            return expr;
+        }
+        default: {
+            bool negative = value.kind == Constant::Integer ? value.integer < 0 : value.number < 0;
+            auto number = std::make_shared<Expr>(ExprKind::Number, line);
+            number->value = value.kind == Constant::Integer ? std::to_string(std::llabs(value.integer))
+                                                            : formatFloat(std::fabs(value.number));
+            if (!negative) return number;
+            auto minus = std::make_shared<Expr>(ExprKind::Unary, line);
+            minus->value = "-";
+            minus->lhs = number;
+            return minus;
+        }
+    }
+}
+
+// `true and f()` yields one value, while f() on its own would expand at the end of a list
+ExprPtr ConstantFolder::singleValue(const ExprPtr& expr) {
+    if (expr->kind != ExprKind::Call && expr->kind != ExprKind::Method && expr->kind != ExprKind::Vararg) return expr;
+    auto paren = std::make_shared<Expr>(ExprKind::Paren, expr->line);
+    paren->lhs = expr;
+    return paren;
+}
+
+void ConstantFolder::visitExpr(ExprPtr& expr) {
+    AstWalker::children(*expr, [&](ExprPtr& child) { visitExpr(child); }, [&](BlockPtr& body) { visitBlock(*body); });
+
+    if (evaluate(*expr).kind != Constant::None) return;
+
+    Constant result;
+    switch (expr->kind) {
+        case ExprKind::Paren:
+            if (evaluate(*expr->lhs).kind != Constant::None) expr = expr->lhs;
+            return;
+
+        case ExprKind::Unary: {
+            Constant operand = evaluate(*expr->lhs);
+            if (operand.kind == Constant::None || !foldUnary(expr->value, operand, result)) return;
+            break;
+        }
+
+        case ExprKind::Binary: {
+            Constant left = evaluate(*expr->lhs);
+            if (left.kind == Constant::None) return;
+            if (expr->value == "and" || expr->value == "or") {
+                bool takeRight = (expr->value == "and") == isTruthy(left);
+                expr = takeRight ? singleValue(expr->rhs) : expr->lhs;
+                ++report.folded;
+                return;
+            }
+            Constant right = evaluate(*expr->rhs);
+            if (right.kind == Constant::None || !foldBinary(expr->value, left, right, result)) return;
+            break;
+        }
+
+        default:
+            return;
+    }
+
+    expr = toExpr(result, expr->line);
+    ++report.folded;
+}
+
+void ConstantFolder::visitStat(Stat& stat) {
+    if (stat.kind == StatKind::Repeat) {
+        visitBlock(*stat.blocks[0], &stat.exprs[0]);
+        return;
+    }
+    AstWalker::children(stat, [&](ExprPtr& expr) { visitExpr(expr); }, [&](BlockPtr& block) { visitBlock(*block); });
+}
+
+// A block can be spliced into its parent when that changes neither scoping nor where a return or break may appear
+bool ConstantFolder::canInline(const Block& block) {
+    for (const auto& stat : block.stats) {
+        switch (stat->kind) {
+            case StatKind::Local:
+            case StatKind::LocalFunction:
+            case StatKind::Label:
+            case StatKind::Goto:
+            case StatKind::Return:
+            case StatKind::Break:
+                return false;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+void ConstantFolder::visitBlock(Block& block, ExprPtr* until) {
+    std::vector<StatPtr> stats;
+    stats.reserve(block.stats.size());
+
+    auto keep = [&](const BlockPtr& body, int line) {
+        if (canInline(*body)) {
+            stats.insert(stats.end(), body->stats.begin(), body->stats.end());
+        } else {
+            auto scope = std::make_shared<Stat>(StatKind::Do, line);
+            scope->blocks.push_back(body);
+            stats.push_back(scope);
+        }
+    };
+
+    for (auto& stat : block.stats) {
+        visitStat(*stat);
+
+        if (stat->kind == StatKind::While) {
+            Constant condition = evaluate(*stat->exprs[0]);
+            if (condition.kind != Constant::None && !isTruthy(condition)) {
+                ++report.loops;
+                continue;
+            }
+        }
+
+        if (stat->kind != StatKind::If) {
+            stats.push_back(stat);
+            continue;
+        }
+
+        // Drop arms whose condition is constantly false; a constantly true one becomes the else of what is left
+        std::vector<ExprPtr> conditions;
+        std::vector<BlockPtr> bodies;
+        BlockPtr otherwise = stat->blocks.size() > stat->exprs.size() ? stat->blocks.back() : nullptr;
+        for (size_t i = 0; i < stat->exprs.size(); ++i) {
+            Constant condition = evaluate(*stat->exprs[i]);
+            if (condition.kind == Constant::None) {
+                conditions.push_back(stat->exprs[i]);
+                bodies.push_back(stat->blocks[i]);
+                continue;
+            }
+            if (!isTruthy(condition)) {
+                ++report.branches;
+                continue;
+            }
+            report.branches += stat->exprs.size() - i - 1 + (otherwise ? 1 : 0);
+            otherwise = stat->blocks[i];
+            break;
+        }
+
+        if (conditions.size() == stat->exprs.size()) {
+            stats.push_back(stat);
+        } else if (!conditions.empty()) {
+            stat->exprs = conditions;
+            stat->blocks = bodies;
+            if (otherwise) stat->blocks.push_back(otherwise);
+            stats.push_back(stat);
+        } else if (otherwise) {
+            keep(otherwise, stat->line);
+        }
+    }
+
+    block.stats = std::move(stats);
+    removeUnusedFunctions(block, until);
+}
+
+bool ConstantFolder::isDeadFunction(const Stat& stat) {
+    if (stat.kind == StatKind::LocalFunction) return true;
+    // A <close> local runs code when it goes out of scope, so only plain ones qualify
+    return stat.kind == StatKind::Local && stat.names.size() == 1 && stat.exprs.size() == 1 &&
+           (stat.attribs.empty() || stat.attribs[0].empty()) && stat.exprs[0]->kind == ExprKind::Function;
+}
+
+void ConstantFolder::countNames(Stat& stat, Counts& counts) {
+    AstWalker::walk(stat, nullptr, [&](Expr& expr) {
+        if (expr.kind == ExprKind::Name) ++counts[expr.value];
+    });
+}
+
+// Walks the block backwards counting names used by the statements after each local function, so a function only
+// called from another dead one goes too. Any use of the name counts, even one that is really a shadowing local.
+void ConstantFolder::removeUnusedFunctions(Block& block, ExprPtr* until) {
+    Counts used;
+    if (until) {
+        Stat condition(StatKind::Call);
+        condition.expr = *until;
+        countNames(condition, used);
+    }
+
+    std::vector<StatPtr> kept;
+    for (auto it = block.stats.rbegin(); it != block.stats.rend(); ++it) {
+        Stat& stat = **it;
+        if (isDeadFunction(stat) && used.find(stat.names[0]) == used.end()) {
+            ++report.functions;
+            continue;
+        }
+        countNames(stat, used);
+        kept.push_back(*it);
+    }
+    if (kept.size() == block.stats.size()) return;
+    block.stats.assign(kept.rbegin(), kept.rend());
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include "../parser/LuaAst.hpp"
+
+// Folds constant expressions and removes code that can never run: branches of if statements whose condition is a
+// constant, while loops that never start and local functions nothing refers to. Only folds whose result is the same
+// on every supported runtime are made, so integers stay within 2^53 and float results must be finite and exact to
+// print; anything else is left for the runtime to compute.
+class ConstantFolder {
+public:
+    struct Report {
+        size_t folded = 0;
+        size_t branches = 0;
+        size_t loops = 0;
+        size_t functions = 0;
+    };
+
+    static Report fold(Block& chunk);
+
+private:
+    struct Constant {
+        enum Kind { None, Nil, Boolean, Integer, Float, String } kind = None;
+        bool boolean = false;
+        int64_t integer = 0;
+        double number = 0;
+        std::string string;
+    };
+
+    using Counts = std::unordered_map<std::string, size_t>;
+
+    Report report;
+
+    static Constant evaluate(const Expr& expr);
+    static bool parseNumber(const std::string& text, Constant& out);
+    static bool isTruthy(const Constant& value);
+    static bool isNumber(const Constant& value);
+    static double toDouble(const Constant& value);
+    static bool makeInteger(int64_t value, Constant& out);
+    static bool makeFloat(double value, Constant& out);
+    static bool foldUnary(const std::string& op, const Constant& operand, Constant& out);
+    static bool foldArithmetic(const std::string& op, const Constant& a, const Constant& b, Constant& out);
+    static bool foldBinary(const std::string& op, const Constant& a, const Constant& b, Constant& out);
+    static std::string formatFloat(double value);
+    static ExprPtr toExpr(const Constant& value, int line);
+    static ExprPtr singleValue(const ExprPtr& expr);
+    static bool isDeadFunction(const Stat& stat);
+    static void countNames(Stat& stat, Counts& counts);
+    static bool canInline(const Block& block);
+
+    void visitBlock(Block& block, ExprPtr* until = nullptr);
+    void visitStat(Stat& stat);
+    void visitExpr(ExprPtr& expr);
+    void removeUnusedFunctions(Block& block, ExprPtr* until);
+};
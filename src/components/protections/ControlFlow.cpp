@@ -1,10 +1,15 @@
 #include "ControlFlow.hpp"
 #include <sstream>
 #include <map>
-#include <set>
+#include <algorithm>
+#include <limits>
 #include "../Logger.hpp"
-
-std::set<int> ControlFlow::validStates;
+#include "../Annotations.hpp"
+#include "StateAllocator.hpp"
+#include "BlockFlattener.hpp"
+#include "../parser/LuaParser.hpp"
+#include "../parser/LuaPrinter.hpp"
+#include "../parser/AstWalker.hpp"
 
 std::mt19937& ControlFlow::getGenerator() {
     static std::random_device rd;
@@ -12,167 +17,117 @@ std::mt19937& ControlFlow::getGenerator() {
     return gen;
 }
 
-int ControlFlow::generateRandomState() {
-    static std::uniform_int_distribution<> dis(1000, 9999);
-    return dis(getGenerator());
-}
-
-std::vector<int> ControlFlow::generateStates(const ConfigParser& config) {
+std::vector<int> ControlFlow::generateStates(int count, StateAllocator& allocator) {
     std::vector<int> states;
-    int tableSize = config.getIntValue("ControlFlow", "jump_table_size", 10);
-    
+    states.reserve(count);
     
-    for (int i = 0; i < tableSize; ++i) {
-        states.push_back(generateRandomState());
+    for (int i = 0; i < count; ++i) {
+        states.push_back(allocator.next());
     }
     
     return states;
 }
 
-std::string ControlFlow::generateJumpTable(const std::vector<int>& states) {
-    std::stringstream ss;
-    ss << "local __jumptable = {\n";
+std::unordered_map<int, int> ControlFlow::remapStates(const std::vector<int>& states) {
+    std::vector<int> indices;
+    std::unordered_map<int, int> dense;
+    dense.reserve(states.size());
+    for (int state : states) {
+        if (dense.emplace(state, 0).second) {
+            indices.push_back(static_cast<int>(indices.size()) + 1);
+        }
+    }
     
+    std::shuffle(indices.begin(), indices.end(), getGenerator());
+    size_t next = 0;
+    for (auto& [state, index] : dense) {
+        index = indices[next++];
+    }
+    return dense;
+}
+
+void ControlFlow::generateJumpTable(const std::vector<int>& states, const std::unordered_map<int, int>& dense, std::vector<std::string>& handlers) {
     for (size_t i = 0; i < states.size(); ++i) {
-        ss << "    [" << states[i] << "] = function(__next)\n";
-        ss << "        if __debug then return nil end\n";
-        ss << "        local nextState = " << states[(i + 1) % states.size()] << "\n";
-        ss << "        return __next(nextState)\n";
-        ss << "    end,\n";
+        int next = (i + 1 < states.size()) ? dense.at(states[i + 1]) : 0;
+        handlers[dense.at(states[i]) - 1] = generateStateHandler(next);
     }
-    ss << "}\n\n";
-    
-    return ss.str();
 }
 
 std::string ControlFlow::generateDispatcher() {
     std::stringstream ss;
     ss << "local function __dispatch()\n";
-    ss << "    local __debug = false\n";
-    ss << "    if not __state then return nil end\n";
-    ss << "    local __jumps = 0\n";
-    ss << "    local MAX_JUMPS = 100\n";
-    ss << "    local function __next(newState)\n";
-    ss << "        __jumps = __jumps + 1\n";
-    ss << "        if __jumps > MAX_JUMPS then return false end\n";
-    ss << "        __state = newState\n";
-    ss << "        return true\n";
-    ss << "    end\n";
-    ss << "    while true do\n";
-    ss << "        if __jumptable[__state] then\n";
-    ss << "            local ok = __jumptable[__state](__next)\n";
-    ss << "            if not ok then return nil end\n";
-    ss << "        elseif __handlers[__state] then\n";
-    ss << "            local result = __handlers[__state](__next)\n";
-    ss << "            if result ~= true then return result end\n";
-    ss << "        else\n";
-    ss << "            return nil\n";
-    ss << "        end\n";
-    ss << "    end\n";
+    ss << "    local handlers, state, result = __handlers, __state, nil\n";
+    ss << "    repeat\n";
+    ss << "        state, result = handlers[state](result)\n";
+    ss << "    until state == 0\n";
+    ss << "    return result\n";
     ss << "end\n\n";
     return ss.str();
 }
 
-std::string ControlFlow::generateStateHandler(int state, const std::string& code, const ConfigParser& config) {
-    std::stringstream ss;
-    ss << "    [" << state << "] = function(__next)\n";
-    validStates.insert(state);
-    
-    auto getValidState = []() {
-        auto& states = validStates;
-        auto it = states.begin();
-        std::advance(it, std::uniform_int_distribution<>(0, states.size() - 1)(getGenerator()));
-        return *it;
-    };
+std::string ControlFlow::generateStateHandler(int next) {
+    return "    __link(" + std::to_string(next) + "),\n";
+}
 
-    
-    ss << "        if __state == " << state << " then\n";  
-    ss << "            local key = __key\n";
-    ss << "            local decrypt = __decrypt\n";
-    ss << "            local chunk = load([[\n";
-    ss << "                local __key = ...\n";
-    ss << "                local __decrypt = select(2, ...)\n";
-    ss << "                if not __key then return nil end\n";
-    ss << "                if not __decrypt then return nil end\n";
-    ss << "                " << code << "\n";
-    ss << "                local decrypted = __code\n";
-    ss << "                local f, err = load(decrypted, '@', 't', _G)\n";
-    ss << "                if not f then return nil end\n";
-    ss << "                return f()\n";
-    ss << "            ]], '@')\n";
-    ss << "            if not chunk then return nil end\n";
-    ss << "            local ok, result = pcall(chunk, key, decrypt)\n";
-    ss << "            if not ok then return nil end\n";
-    ss << "            if result ~= nil then return result end\n";
-    ss << "        end\n";
-    
-    
-    if (config.getBoolValue("ControlFlow", "debug_traps", true)) {
-        std::uniform_int_distribution<> condition_dis(0, 3);
-        int condition_type = condition_dis(getGenerator());
-        
-        switch (condition_type) {
-            case 0:
-                ss << "        if __debug then return __next(" << getValidState() << ") end\n";
-                break;
-            case 1:
-                if (config.getBoolValue("ControlFlow", "gc_hooks", true)) {
-                    ss << "        if collectgarbage('count') > 0 then\n";
-                    ss << "            return __next(" << getValidState() << ")\n";
-                    ss << "        end\n";
-                }
-                break;
-            case 2:
-                ss << "        if _VERSION ~= _VERSION then return __next(" << getValidState() << ") end\n";
-                break;
-            case 3:
-                ss << "        if type(_G) ~= 'table' then return __next(" << getValidState() << ") end\n";
-                break;
-        }
+void ControlFlow::generateFakeStates(const std::vector<int>& fakes, const std::unordered_map<int, int>& dense, const StateAllocator& allocator, std::vector<std::string>& handlers) {
+    for (int state : fakes) {
+        handlers[dense.at(state) - 1] = generateStateHandler(dense.at(allocator.pick()));
     }
-    
-    ss << "        return __next(" << getValidState() << ")\n";
-    ss << "    end,\n";
-    return ss.str();
 }
 
-std::string ControlFlow::generateFakeStates(const ConfigParser& config) {
-    std::stringstream ss;
-    int fakeCount = config.getIntValue("ControlFlow", "fake_states", 15);
-
-    auto getValidState = []() {
-        auto& states = validStates;  
-        auto it = states.begin();
-        std::advance(it, std::uniform_int_distribution<>(0, states.size() - 1)(getGenerator()));
-        return *it;
+std::string ControlFlow::generateEntryGuard(int mainIndex, int fakeIndex, const ConfigParser& config) {
+    // Opaque predicates are evaluated once before dispatch instead of inside every handler
+    std::vector<std::string> predicates = {
+        "_VERSION ~= _VERSION",
+        "type(_G) ~= 'table'",
     };
-
-    for (int i = 0; i < fakeCount; i++) {
-        int state = generateRandomState();
-        validStates.insert(state);  
-        ss << "    [" << state << "] = function(__next)\n";
-        ss << "        if __debug then\n";
-        ss << "            return __next(" << getValidState() << ")\n";
-        ss << "        end\n";
-        ss << "        return nil\n";
-        ss << "    end,\n";
+    if (config.getBoolValue("ControlFlow", "gc_hooks", true)) {
+        predicates.push_back("collectgarbage('count') < 0");
+    }
+    
+    std::stringstream ss;
+    if (config.getBoolValue("ControlFlow", "debug_traps", true)) {
+        std::uniform_int_distribution<> dis(0, predicates.size() - 1);
+        ss << "local __state = (" << predicates[dis(getGenerator())] << ") and " << fakeIndex << " or " << mainIndex << "\n\n";
+    } else {
+        ss << "local __state = " << mainIndex << "\n\n";
     }
     return ss.str();
 }
 
-std::string ControlFlow::generateCoroutineWrapper() {
+std::string ControlFlow::generateCoroutineWrapper(int poolSize) {
     std::stringstream ss;
-    ss << "local function __wrap(f)\n";
-    ss << "    return function(...)\n";
-    ss << "        local co = coroutine.create(f)\n";
-    ss << "        local success, result\n";
-    ss << "        repeat\n";
-    ss << "            success, result = coroutine.resume(co, ...)\n";
-    ss << "            if not success then\n";
-    ss << "                error(result)  -- Propagate error directly\n";
+    // Idle coroutines park in a trampoline instead of dying, so repeated calls reuse their stacks.
+    // A coroutine that raised is dead and simply dropped; yields from the wrapped function pass through.
+    ss << "local __wrap\n";
+    ss << "do\n";
+    ss << "    local create, resume, yield = coroutine.create, coroutine.resume, coroutine.yield\n";
+    ss << "    local pool, idle, DONE = {}, 0, {}\n\n";
+    ss << "    local function trampoline(f, ...)\n";
+    ss << "        return trampoline(yield(DONE, f(...)))\n";
+    ss << "    end\n\n";
+    ss << "    local function finish(co, ok, first, ...)\n";
+    ss << "        if not ok then error(first, 0) end\n";
+    ss << "        if first ~= DONE then\n";
+    ss << "            return finish(co, resume(co, yield(first, ...)))\n";
+    ss << "        end\n";
+    ss << "        if idle < " << poolSize << " then\n";
+    ss << "            idle = idle + 1\n";
+    ss << "            pool[idle] = co\n";
+    ss << "        end\n";
+    ss << "        return ...\n";
+    ss << "    end\n\n";
+    ss << "    __wrap = function(f)\n";
+    ss << "        return function(...)\n";
+    ss << "            local co = pool[idle]\n";
+    ss << "            if co then\n";
+    ss << "                pool[idle] = nil\n";
+    ss << "                idle = idle - 1\n";
+    ss << "            else\n";
+    ss << "                co = create(trampoline)\n";
     ss << "            end\n";
-    ss << "        until coroutine.status(co) == 'dead'\n";
-    ss << "        return result\n";
+    ss << "            return finish(co, resume(co, f, ...))\n";
+    ss << "        end\n";
     ss << "    end\n";
     ss << "end\n\n";
     return ss.str();
@@ -183,62 +138,69 @@ std::string ControlFlow::generateVM() {
     return "";
 }
 
-std::string ControlFlow::scramble(const std::string& code, const ConfigParser& config) {
+std::string ControlFlow::scramble(const std::string& code, const ConfigParser& config, const std::string& loader) {
     Logger::info("Original code length: " + std::to_string(code.length()));
     std::stringstream ss;
     
     
-    int mainState = generateRandomState();
+    int tableSize = std::max(config.getIntValue("ControlFlow", "jump_table_size", 10), 0);
+    int numFakeStates = std::max(config.getIntValue("ControlFlow", "fake_states", 15), 0);
+    StateAllocator allocator(1 + tableSize + numFakeStates, getGenerator());
+    
+    int mainState = allocator.next();
     Logger::info("Main state ID: " + std::to_string(mainState));
     
-    ss << "local __state = " << mainState << "\n\n";
+    // The payload is compiled with the rest of the chunk; only the decrypted program goes through load()
+    ss << code << "\n";
     
     
     Logger::info("Generating jump table...");
-    std::vector<int> states = generateStates(config);
-    ss << generateJumpTable(states);
+    std::vector<int> states = generateStates(tableSize, allocator);
+    std::vector<int> fakes = generateStates(numFakeStates, allocator);
     
+    std::vector<int> allStates = {mainState};
+    allStates.insert(allStates.end(), states.begin(), states.end());
+    allStates.insert(allStates.end(), fakes.begin(), fakes.end());
     
-    Logger::info("Generating state handlers...");
-    ss << "local __handlers = {\n";
+    // Handlers live in the array part of __handlers, indexed by a shuffled dense remap of the state IDs
+    std::unordered_map<int, int> dense = remapStates(allStates);
+    std::vector<std::string> handlers(dense.size());
+    generateJumpTable(states, dense, handlers);
     
     
-    ss << "    [" << mainState << "] = function(__next)\n";
-    ss << "        if __state == " << mainState << " then\n";
-    ss << "            local key = __key\n";
-    ss << "            local decrypt = __decrypt\n";
-    ss << "            local chunk = load([[\n";
-    ss << "                local __key = ...\n";
-    ss << "                local __decrypt = select(2, ...)\n";
-    ss << "                if not __key then return nil end\n";
-    ss << "                if not __decrypt then return nil end\n";
-    ss << "                " << code;
-    ss << "\n                local decrypted = __code\n";
-    ss << "                local f, err = load(decrypted, '@', 't', _G)\n";
-    ss << "                if not f then return nil end\n";
-    ss << "                _G.__key = __key\n";
-    ss << "                local result = f()\n";
-    ss << "                _G.__key = nil\n";
-    ss << "                return result\n";
-    ss << "            ]], '@')\n";
-    ss << "            if not chunk then return nil end\n";
-    ss << "            local ok, result = pcall(chunk, key, decrypt)\n";
-    ss << "            if not ok then return nil end\n";
-    ss << "            if result ~= nil then return result end\n";
-    ss << "        end\n";
-    ss << "        return __next(" << states[0] << ")\n";
-    ss << "    end,\n";
+    Logger::info("Generating fake states...");
+    generateFakeStates(fakes, dense, allocator, handlers);
     
     
-    Logger::info("Generating fake states...");
-    int numFakeStates = config.getIntValue("ControlFlow", "fake_states", 15);
-    for (int i = 0; i < numFakeStates; ++i) {
-        int state = generateRandomState();
-        int nextState = states[rand() % states.size()];
-        ss << "    [" << state << "] = function(__next)\n";
-        ss << "        if __debug then return __next(" << nextState << ") end\n";
-        ss << "        return nil\n";
-        ss << "    end,\n";
+    Logger::info("Generating state handlers...");
+    // Opt-in: inside the pooled coroutine the program no longer runs on the main thread, which
+    // coroutine.running() and coroutine.isyieldable() report
+    bool useCoroutines = config.getBoolValue("ControlFlow", "use_coroutines", false);
+    int exitState = states.empty() ? 0 : dense.at(states[0]);
+    std::stringstream main;
+    main << "    function()\n";
+    main << "        local f = " << loader << "\n";
+    main << "        if not f then return 0 end\n";
+    main << "        local ok, result = pcall(" << (useCoroutines ? "__wrap(f)" : "f") << ")\n";
+    main << "        if not ok then error(result, 0) end\n";
+    main << "        if result ~= nil then return 0, result end\n";
+    main << "        return " << exitState << "\n";
+    main << "    end,\n";
+    handlers[dense.at(mainState) - 1] = main.str();
+    
+    int fakeState = fakes.empty() ? 0 : dense.at(fakes[0]);
+    ss << generateEntryGuard(dense.at(mainState), fakeState, config);
+    if (useCoroutines) {
+        ss << generateCoroutineWrapper(std::max(config.getIntValue("ControlFlow", "coroutine_pool_size", 8), 0));
+    }
+    
+    // Pass-through states share one prototype, so the state count is not bound by Lua's per-function limits
+    ss << "local function __link(n)\n";
+    ss << "    return function(__result) return n, __result end\n";
+    ss << "end\n\n";
+    ss << "local __handlers = {\n";
+    for (const auto& handler : handlers) {
+        ss << handler;
     }
     ss << "}\n\n";
     
@@ -253,4 +215,62 @@ std::string ControlFlow::scramble(const std::string& code, const ConfigParser& c
     Logger::info("Final code length: " + std::to_string(result.length()));
     
     return result;
-} 
\ No newline at end of file
+}
+
+void ControlFlow::flatten(std::string& code, const ConfigParser& config, Target::Kind target, bool maxOnly) {
+    BlockPtr chunk;
+    try {
+        LuaParser parser(code, target);
+        chunk = parser.parse();
+    } catch (const std::exception& e) {
+        Logger::warning("Control flow flattening skipped: " + std::string(e.what()));
+        return;
+    }
+    
+    double budget = config.getIntValue("ControlFlow", "flatten_budget", 150);
+    int fakePercent = config.getIntValue("ControlFlow", "fake_block_percent", 50);
+    
+    size_t total = 0, flattened = 0, exempt = 0, realStates = 0, fakeStates = 0;
+    double dispatches = 0;
+    auto visit = [&](Function& func) {
+        ++total;
+        std::string name = (func.name.empty() ? "<anonymous>" : func.name) + " (line " + std::to_string(func.line) + ")";
+        // Every call of a fast function would pay for the dispatch loop
+        Annotations::Tier tier = Annotations::tierOf(func);
+        if (tier == Annotations::Tier::Fast || tier == Annotations::Tier::None) {
+            ++exempt;
+            Logger::debug("Flattening " + name + " skipped: " + Annotations::name(tier));
+            return;
+        }
+        if (maxOnly && tier != Annotations::Tier::Max) return;
+        double limit = tier == Annotations::Tier::Max ? std::numeric_limits<double>::infinity() : budget;
+        BlockFlattener::Report report = BlockFlattener::flatten(func, limit, fakePercent, getGenerator());
+        if (!report.flattened) {
+            Logger::debug("Flattening " + name + " skipped: " + report.reason +
+                          (report.cost > limit ? " (cost " + std::to_string(static_cast<int>(report.cost)) + ")" : ""));
+            return;
+        }
+        ++flattened;
+        realStates += report.realStates;
+        fakeStates += report.fakeStates;
+        dispatches += report.dispatches;
+        Logger::debug("Flattened " + name + ": level " + std::to_string(report.level) + ", " +
+                      std::to_string(report.realStates) + " real + " + std::to_string(report.fakeStates) + " fake blocks, depth " +
+                      std::to_string(report.depth) + ", ~" + std::to_string(static_cast<int>(report.dispatches + 0.5)) + " dispatches/call, cost " +
+                      std::to_string(static_cast<int>(report.cost)));
+    };
+    
+    // Inner functions are flattened first so each state machine only sees its own blocks
+    AstWalker::forEachFunction(*chunk, visit);
+    Function main;
+    main.name = "main chunk";
+    main.vararg = true;
+    main.body = chunk;
+    visit(main);
+    
+    code = LuaPrinter::print(*chunk, true);
+    Logger::info("Flattened " + std::to_string(flattened) + "/" + std::to_string(total) + " functions into " +
+                 std::to_string(realStates) + " real and " + std::to_string(fakeStates) + " fake blocks (~" +
+                 std::to_string(static_cast<int>(dispatches + 0.5)) + " dispatches for one call of each)" +
+                 (exempt > 0 ? ", " + std::to_string(exempt) + " fast or unprotected functions left as they are" : ""));
+}
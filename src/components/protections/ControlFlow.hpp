@@ -2,25 +2,29 @@
 #include <string>
 #include <vector>
 #include <random>
-#include <set>
+#include <unordered_map>
 #include "../../components/ConfigParser.hpp"
+#include "../Target.hpp"
+#include "StateAllocator.hpp"
 
 class ControlFlow {
 private:
     static std::mt19937 generator;
-    static std::set<int> validStates;
-    
-    static int generateRandomState();
-    static std::vector<int> generateStates(const ConfigParser& config);
-    static std::string generateJumpTable(const std::vector<int>& states);
+
+    static std::vector<int> generateStates(int count, StateAllocator& allocator);
+    static std::unordered_map<int, int> remapStates(const std::vector<int>& states);
+    static void generateJumpTable(const std::vector<int>& states, const std::unordered_map<int, int>& dense, std::vector<std::string>& handlers);
     static std::mt19937& getGenerator();
     static std::string generateDispatcher();
-    static std::string generateStateHandler(int state, const std::string& code, const ConfigParser& config);
+    static std::string generateStateHandler(int next);
     static std::string wrapInTryCatch(const std::string& code);
-    static std::string generateFakeStates(const ConfigParser& config);
-    static std::string generateCoroutineWrapper();
+    static void generateFakeStates(const std::vector<int>& fakes, const std::unordered_map<int, int>& dense, const StateAllocator& allocator, std::vector<std::string>& handlers);
+    static std::string generateEntryGuard(int mainIndex, int fakeIndex, const ConfigParser& config);
+    static std::string generateCoroutineWrapper(int poolSize);
     static std::string generateVM();
 
 public:
-    static std::string scramble(const std::string& code, const ConfigParser& config);
+    static std::string scramble(const std::string& code, const ConfigParser& config, const std::string& loader = "load(__code, '=', 't', _G)");
+    // With maxOnly, only functions tagged --@obf:max are flattened
+    static void flatten(std::string& code, const ConfigParser& config, Target::Kind target, bool maxOnly = false);
 }; 
\ No newline at end of file
@@ -1,7 +1,15 @@
 #include "JunkCode.hpp"
+#include <algorithm>
+#include <limits>
 #include <random>
 #include <sstream>
 #include <vector>
+#include "../Annotations.hpp"
+#include "../CostModel.hpp"
+#include "../Logger.hpp"
+#include "../parser/AstWalker.hpp"
+#include "../parser/LuaParser.hpp"
+#include "../parser/LuaPrinter.hpp"
 
 std::mt19937& JunkCode::getGenerator() {
     static std::random_device rd;
@@ -19,32 +27,165 @@ std::string JunkCode::generateRandomString(int length) {
     return result;
 }
 
-std::string JunkCode::generate(int count) {
-    std::vector<std::string> junkTemplates = {
-        "local __{} = {}",
-        "local __{} = string.rep('x', {})",
-        "local __{} = {{}, {}, {}}",
-        "local __{} = math.random(1, {})",
-        "local __{} = table.concat({{}, {}, {}})",
-        "local __{} = bit32 and bit32.bxor({}, {}) or {}",
+// $ is the statement's local, # a number from 1 to 1000 and ! one from 1 to 16. Costs are measured on Lua 5.4 in
+// simple instructions, allocation and collection included
+const std::vector<JunkCode::Template>& JunkCode::templates() {
+    static const std::vector<Template> all = {
+        {"local $ = #", 1, false},
+        {"local $ = # $ = $ * # + #", 4, false},
+        {"local $ = bit32 and bit32.bxor(#, #) or #", 6, false},
+        {"local $ = math.max(#, #)", 16, false},
+        {"local $ = {#, #, #}", 40, true},
+        {"local $ = string.rep('x', !)", 70, true},
+        {"local $ = table.concat({#, #, #})", 300, true},
     };
+    return all;
+}
 
-    std::stringstream ss;
-    std::uniform_int_distribution<> templateDis(0, junkTemplates.size() - 1);
+// Opaque predicates that are never true; @ is the body, which never runs and so may be any template
+const std::vector<JunkCode::Template>& JunkCode::guards() {
+    static const std::vector<Template> all = {
+        {"if # < 0 then @ end", 4, false},
+        {"if math.huge < # then @ end", 12, false},
+        {"local $ = # if $ * ($ + 1) % 2 == 1 then @ end", 12, false},
+    };
+    return all;
+}
+
+std::string JunkCode::fill(const std::string& text) {
     std::uniform_int_distribution<> numDis(1, 1000);
+    std::uniform_int_distribution<> smallDis(1, 16);
+    std::string name = "__" + generateRandomString(8);
+    std::string result;
+    for (char c : text) {
+        if (c == '$') {
+            result += name;
+        } else if (c == '#') {
+            result += std::to_string(numDis(getGenerator()));
+        } else if (c == '!') {
+            result += std::to_string(smallDis(getGenerator()));
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
 
+std::string JunkCode::generate(int count) {
+    const auto& all = templates();
+    std::uniform_int_distribution<> templateDis(0, all.size() - 1);
+    std::stringstream ss;
     for (int i = 0; i < count; ++i) {
-        std::string varName = generateRandomString(8);
-        std::string templ = junkTemplates[templateDis(getGenerator())];
-        
-        size_t pos = templ.find("{}");
-        while (pos != std::string::npos) {
-            templ.replace(pos, 2, std::to_string(numDis(getGenerator())));
-            pos = templ.find("{}", pos + 1);
+        ss << "do " << fill(all[templateDis(getGenerator())].text) << " end\n";
+    }
+    return ss.str();
+}
+
+double JunkCode::averageCost() {
+    double total = 0;
+    for (const auto& templ : templates()) total += templ.cost;
+    return total / templates().size();
+}
+
+StatPtr JunkCode::parseStatement(const std::string& code) {
+    LuaParser parser(code);
+    return parser.parse()->stats.front();
+}
+
+void JunkCode::pad(Block& block, int count) {
+    LuaParser parser(generate(count));
+    BlockPtr junk = parser.parse();
+    block.stats.insert(block.stats.begin(), junk->stats.begin(), junk->stats.end());
+}
+
+void JunkCode::collect(Block& block, double weight, std::vector<Point>& points) {
+    for (size_t i = 0; i < block.stats.size(); ++i) {
+        // Right after a label would stop it from ending the block, which a goto past a local needs
+        if (i == 0 || block.stats[i - 1]->kind != StatKind::Label) points.push_back({&block, i, weight});
+        const Stat& stat = *block.stats[i];
+        bool loop = stat.kind == StatKind::While || stat.kind == StatKind::Repeat ||
+                    stat.kind == StatKind::NumericFor || stat.kind == StatKind::GenericFor;
+        for (const auto& body : stat.blocks) collect(*body, loop ? weight * CostModel::iterations(stat) : weight, points);
+    }
+}
+
+void JunkCode::place(Function& func, int count, double budget, bool allocate, Report& report) {
+    std::vector<Point> points;
+    collect(*func.body, 1, points);
+    std::shuffle(points.begin(), points.end(), getGenerator());
+
+    std::vector<std::pair<Point, StatPtr>> chosen;
+    double spent = 0;
+    for (const auto& point : points) {
+        if (chosen.size() >= static_cast<size_t>(count)) break;
+        // Loops only get junk that never runs, and only when even its guard fits the budget
+        bool guarded = point.weight > 1;
+        std::vector<const Template*> fitting;
+        for (const auto& templ : guarded ? guards() : templates()) {
+            if (spent + templ.cost * point.weight <= budget && (allocate || !templ.allocates)) fitting.push_back(&templ);
         }
-        
-        ss << templ << "\n";
+        if (fitting.empty()) continue;
+
+        const Template& templ = *fitting[std::uniform_int_distribution<size_t>(0, fitting.size() - 1)(getGenerator())];
+        std::string text = "do " + fill(templ.text) + " end";
+        if (guarded) {
+            const auto& bodies = templates();
+            std::string body = fill(bodies[std::uniform_int_distribution<size_t>(0, bodies.size() - 1)(getGenerator())].text);
+            text.replace(text.find('@'), 1, body);
+            ++report.guarded;
+        }
+        chosen.emplace_back(point, parseStatement(text));
+        spent += templ.cost * point.weight;
     }
 
-    return ss.str();
-} 
\ No newline at end of file
+    // Back to front, so the points still to insert keep their indices
+    std::sort(chosen.begin(), chosen.end(), [](const auto& a, const auto& b) { return a.first.index > b.first.index; });
+    for (const auto& [point, stat] : chosen) {
+        point.block->stats.insert(point.block->stats.begin() + point.index, stat);
+    }
+    report.statements += chosen.size();
+    report.functions += !chosen.empty();
+    report.cost += spent;
+}
+
+void JunkCode::insert(std::string& code, int count, int budgetPercent, Target::Kind target, bool maxOnly) {
+    // Junk goes in between parsed statements, so it never lands inside a fast or none region or a hot loop
+    try {
+        LuaParser parser(code, target);
+        BlockPtr chunk = parser.parse();
+        size_t padded = 0;
+        AstWalker::walk(*chunk, [&](Stat& stat) {
+            if (Annotations::tier(stat.annotation) != Annotations::Tier::Max || stat.func) return;
+            for (auto& body : stat.blocks) pad(*body, count);
+            padded += !stat.blocks.empty();
+        }, nullptr);
+
+        std::vector<Function*> functions;
+        AstWalker::forEachFunction(*chunk, [&](Function& func) { functions.push_back(&func); });
+        Function main;
+        main.body = chunk;
+        if (!maxOnly) functions.push_back(&main);
+
+        Report report;
+        for (Function* func : functions) {
+            Annotations::Tier tier = Annotations::tierOf(*func);
+            if (tier == Annotations::Tier::Fast || tier == Annotations::Tier::None) {
+                ++report.skipped;
+            } else if (tier == Annotations::Tier::Max) {
+                place(*func, count, std::numeric_limits<double>::infinity(), true, report);
+            } else if (!maxOnly) {
+                // Only the main chunk surely runs once, so only its junk may allocate
+                place(*func, count, CostModel::work(*func) * budgetPercent / 100.0, func == &main, report);
+            }
+        }
+        code = LuaPrinter::print(*chunk, true);
+
+        Logger::info("Junk code: " + std::to_string(report.statements) + " statements (" + std::to_string(report.guarded) +
+                     " behind opaque predicates) in " + std::to_string(report.functions) + " functions, " +
+                     std::to_string(static_cast<long long>(report.cost)) + " instructions per call in total; " +
+                     std::to_string(report.skipped) + " fast or none functions left without");
+        if (padded > 0) Logger::debug("Padded " + std::to_string(padded) + " max statements with junk code");
+    } catch (const std::exception& e) {
+        Logger::warning("Junk code skipped: " + std::string(e.what()));
+    }
+}
@@ -1,12 +1,57 @@
 #pragma once
 #include <string>
 #include <random>
+#include <vector>
+#include "../Target.hpp"
+#include "../parser/LuaAst.hpp"
 
+// Junk statements spread over the statement boundaries of every function. Each template has a known cost and the
+// junk in a function may cost at most [Junk] budget_percent of what a call of it runs, both weighted by the loops
+// around them. Loops only get junk behind an opaque predicate that is never true, junk that runs only allocates in
+// the main chunk and max functions, fast and none functions get none, and every statement is a do or if block, so
+// its locals never add to the function's.
 class JunkCode {
+public:
+    struct Template {
+        const char* text;
+        // Simple instructions it costs to run, or for guards to decide not to run the body
+        int cost;
+        bool allocates;
+    };
+
+    struct Report {
+        size_t statements = 0;
+        size_t guarded = 0;
+        size_t functions = 0;
+        size_t skipped = 0;
+        // Junk instructions per call, summed over the functions
+        double cost = 0;
+    };
+
+    // `count` straight-line junk statements, as insert places them outside loops
+    static std::string generate(int count);
+    // Average cost of a statement generate() returns
+    static double averageCost();
+    // Adds up to `count` junk statements to every function and the main chunk within budgetPercent of its own cost,
+    // and at the start of every statement tagged --@obf:max; functions tagged max take `count` whatever they cost.
+    // With maxOnly, only tagged code gets any.
+    static void insert(std::string& code, int count, int budgetPercent, Target::Kind target, bool maxOnly = false);
+
 private:
+    // Where a statement can go: before stats[index] of block, run `weight` times per call
+    struct Point {
+        Block* block;
+        size_t index;
+        double weight;
+    };
+
+    static const std::vector<Template>& templates();
+    static const std::vector<Template>& guards();
     static std::string generateRandomString(int length);
     static std::mt19937& getGenerator();
-
-public:
-    static std::string generate(int count);
-}; 
\ No newline at end of file
+    static std::string fill(const std::string& text);
+    static StatPtr parseStatement(const std::string& code);
+    static void pad(Block& block, int count);
+    static void collect(Block& block, double weight, std::vector<Point>& points);
+    static void place(Function& func, int count, double budget, bool allocate, Report& report);
+};
@@ -0,0 +1,139 @@
+#include "LocalRenamer.hpp"
+#include <algorithm>
+#include <numeric>
+#include "../parser/AstWalker.hpp"
+#include "../parser/LuaLexer.hpp"
+
+LocalRenamer::Report LocalRenamer::rename(Block& chunk) {
+    LocalRenamer renamer;
+    renamer.visitBlock(chunk);
+
+    // Slots used most across all their locals get the shortest names
+    std::vector<size_t> weights(renamer.slots, 0);
+    Report report;
+    for (const auto& variable : renamer.variables) {
+        report.references += variable.sites.size();
+        if (!variable.fixed) weights[variable.slot] += variable.sites.size();
+    }
+    std::vector<size_t> order(renamer.slots);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return weights[a] > weights[b]; });
+
+    std::vector<std::string> names(renamer.slots);
+    for (size_t slot : order) names[slot] = renamer.nextName();
+
+    for (auto& variable : renamer.variables) {
+        if (variable.fixed) continue;
+        for (std::string* site : variable.sites) *site = names[variable.slot];
+        ++report.locals;
+    }
+    report.names = renamer.slots;
+    report.globals = renamer.globals.size();
+    return report;
+}
+
+void LocalRenamer::declare(std::string& name) {
+    variables.emplace_back();
+    Variable& variable = variables.back();
+    // The printer drops the implicit self of a method and _ENV decides what globals resolve to, so both keep their names
+    variable.fixed = name == "self" || name == "_ENV";
+    if (variable.fixed) {
+        globals.insert(name);
+    } else {
+        variable.slot = depth++;
+        slots = std::max(slots, depth);
+    }
+    variable.sites.push_back(&name);
+    visible[name].push_back(&variable);
+    declared.push_back(&name);
+}
+
+void LocalRenamer::closeScope(size_t mark) {
+    while (declared.size() > mark) {
+        auto& shadowed = visible[*declared.back()];
+        if (!shadowed.back()->fixed) --depth;
+        shadowed.pop_back();
+        declared.pop_back();
+    }
+}
+
+void LocalRenamer::visitBlock(Block& block, ExprPtr* until) {
+    size_t mark = declared.size();
+    for (auto& stat : block.stats) visitStat(*stat);
+    // The condition of repeat ... until sees the body's locals
+    if (until) visitExpr(*until);
+    closeScope(mark);
+}
+
+void LocalRenamer::visitStat(Stat& stat) {
+    switch (stat.kind) {
+        case StatKind::Local:
+            for (auto& expr : stat.exprs) visitExpr(expr);
+            for (auto& name : stat.names) declare(name);
+            return;
+        case StatKind::LocalFunction:
+            declare(stat.names[0]);
+            visitFunction(*stat.func);
+            return;
+        case StatKind::Function:
+            visitExpr(stat.targets[0]);
+            visitFunction(*stat.func);
+            return;
+        case StatKind::Repeat:
+            visitBlock(*stat.blocks[0], &stat.exprs[0]);
+            return;
+        case StatKind::NumericFor:
+        case StatKind::GenericFor: {
+            for (auto& expr : stat.exprs) visitExpr(expr);
+            size_t mark = declared.size();
+            for (auto& name : stat.names) declare(name);
+            visitBlock(*stat.blocks[0]);
+            closeScope(mark);
+            return;
+        }
+        default:
+            for (auto& target : stat.targets) visitExpr(target);
+            for (auto& expr : stat.exprs) visitExpr(expr);
+            if (stat.expr) visitExpr(stat.expr);
+            for (auto& block : stat.blocks) visitBlock(*block);
+            return;
+    }
+}
+
+void LocalRenamer::visitExpr(ExprPtr& expr) {
+    if (expr->kind == ExprKind::Name) {
+        auto found = visible.find(expr->value);
+        if (found != visible.end() && !found->second.empty()) {
+            found->second.back()->sites.push_back(&expr->value);
+        } else {
+            globals.insert(expr->value);
+        }
+        return;
+    }
+    if (expr->func) {
+        visitFunction(*expr->func);
+        return;
+    }
+    AstWalker::children(*expr, [&](ExprPtr& child) { visitExpr(child); }, [](BlockPtr&) {});
+}
+
+void LocalRenamer::visitFunction(Function& func) {
+    size_t mark = declared.size();
+    for (auto& param : func.params) declare(param);
+    visitBlock(*func.body);
+    closeScope(mark);
+}
+
+std::string LocalRenamer::nextName() {
+    static const std::string first = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+    static const std::string rest = first + "0123456789";
+    while (true) {
+        size_t n = counter++;
+        std::string name(1, first[n % first.length()]);
+        for (n /= first.length(); n > 0; n /= rest.length()) {
+            --n;
+            name += rest[n % rest.length()];
+        }
+        if (!LuaLexer::isKeyword(name) && globals.find(name) == globals.end()) return name;
+    }
+}
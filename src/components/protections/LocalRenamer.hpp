@@ -0,0 +1,46 @@
+#pragma once
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "../parser/LuaAst.hpp"
+
+// Renames local variables by lexical scope. Each local takes the next free slot of the scope stack, so locals in
+// sibling scopes share slots, and slots are named shortest-first by how often their locals are used. Globals, table
+// keys, method names and labels are never touched, and no local is given the name of a global the chunk uses.
+class LocalRenamer {
+public:
+    struct Report {
+        size_t locals = 0;
+        size_t references = 0;
+        size_t names = 0;
+        size_t globals = 0;
+    };
+
+    static Report rename(Block& chunk);
+
+private:
+    struct Variable {
+        size_t slot = 0;
+        bool fixed = false;
+        std::vector<std::string*> sites;
+    };
+
+    std::deque<Variable> variables;
+    // Visible locals by original name, innermost last
+    std::unordered_map<std::string, std::vector<Variable*>> visible;
+    std::vector<const std::string*> declared;
+    std::unordered_set<std::string> globals;
+    size_t depth = 0;
+    size_t slots = 0;
+    size_t counter = 0;
+
+    void declare(std::string& name);
+    void closeScope(size_t mark);
+    void visitBlock(Block& block, ExprPtr* until = nullptr);
+    void visitStat(Stat& stat);
+    void visitExpr(ExprPtr& expr);
+    void visitFunction(Function& func);
+    std::string nextName();
+};
@@ -0,0 +1,35 @@
+#include "StateAllocator.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <cstdint>
+
+StateAllocator::StateAllocator(size_t capacity, std::mt19937& gen) : cursor(0), gen(gen) {
+    if (capacity == 0) capacity = 1;
+    if (capacity > static_cast<size_t>(MAX_ID - MIN_ID)) {
+        throw std::length_error("State allocator capacity exceeds ID space");
+    }
+
+    // Splitting the range into equal buckets keeps IDs unique without a lookup set
+    int64_t width = static_cast<int64_t>(MAX_ID - MIN_ID) / static_cast<int64_t>(capacity);
+    std::uniform_int_distribution<int64_t> offset(0, width - 1);
+    ids.resize(capacity);
+    for (size_t i = 0; i < capacity; ++i) {
+        ids[i] = static_cast<int>(MIN_ID + static_cast<int64_t>(i) * width + offset(gen));
+    }
+    std::shuffle(ids.begin(), ids.end(), gen);
+}
+
+int StateAllocator::next() {
+    if (cursor >= ids.size()) {
+        throw std::out_of_range("State allocator exhausted after " + std::to_string(ids.size()) + " states");
+    }
+    return ids[cursor++];
+}
+
+int StateAllocator::pick() const {
+    if (cursor == 0) {
+        throw std::out_of_range("No states allocated yet");
+    }
+    return ids[std::uniform_int_distribution<size_t>(0, cursor - 1)(gen)];
+}
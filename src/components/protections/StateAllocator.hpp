@@ -0,0 +1,23 @@
+#pragma once
+#include <vector>
+#include <random>
+#include <cstdint>
+
+// Hands out unique state IDs drawn from a large range, one bucket per ID, in shuffled order
+class StateAllocator {
+private:
+    std::vector<int> ids;
+    size_t cursor;
+    std::mt19937& gen;
+
+public:
+    static constexpr int MIN_ID = 1;
+    static constexpr int MAX_ID = 1 << 30;
+
+    StateAllocator(size_t capacity, std::mt19937& gen);
+
+    int next();
+    int pick() const;
+    size_t size() const { return cursor; }
+    size_t capacity() const { return ids.size(); }
+};
@@ -1,82 +1,79 @@
 #include "StringEncryption.hpp"
 #include "../Logger.hpp"
 #include "../ProgressBar.hpp"
+#include "../PayloadEncoder.hpp"
+#include "../Annotations.hpp"
+#include "../parser/LuaLexer.hpp"
+#include "../parser/LuaParser.hpp"
+#include "../parser/LuaPrinter.hpp"
+#include "StringHoister.hpp"
 #include <sstream>
 #include <regex>
 #include <algorithm>
 #include <numeric>
+#include <unordered_map>
 
-std::string StringEncryption::encryptBytes(const std::string& input, const std::vector<uint8_t>& key, const std::string& varName, size_t chunkSize) {
-    std::vector<uint8_t> encrypted;
-    for (size_t i = 0; i < input.length(); ++i) {
-        uint8_t byte = input[i];
-        byte ^= key[i % key.size()];
-        byte = (byte << 3) | (byte >> 5); 
-        encrypted.push_back(byte);
-    }
+std::string StringEncryption::generateDecryptor(size_t blockSize, Target::Kind target, const std::string& nativeModule) {
+    return PayloadEncoder::generateDecryptor(blockSize, target, nativeModule);
+}
 
-    std::stringstream ss;
-    
-    
-    if (encrypted.empty()) {
-        ss << "local " << varName << " = \"\"\n";
-        return ss.str();
-    }
-    
-    
-    size_t numChunks = (encrypted.size() + chunkSize - 1) / chunkSize;
-    
-    
-    std::vector<std::string> chunkVars;
-    for (size_t chunk = 0; chunk < numChunks; ++chunk) {
-        std::string chunkVar = varName + "_" + std::to_string(chunk);
-        chunkVars.push_back(chunkVar);
-        
-        ss << "local " << chunkVar << " = string.char(";
-        size_t start = chunk * chunkSize;
-        size_t end = std::min<size_t>(start + chunkSize, encrypted.size());
-        
-        for (size_t i = start; i < end; ++i) {
-            if (i > start) ss << ",";
-            ss << std::to_string((int)encrypted[i]); 
+void StringEncryption::hoistLoopInvariants(std::string& code, Target::Kind target) {
+    try {
+        LuaParser parser(code, target);
+        BlockPtr chunk = parser.parse();
+        StringHoister::Report report = StringHoister::hoist(*chunk);
+        if (!report.skipped.empty()) {
+            Logger::info("Loop hoisting skipped: " + report.skipped);
+            return;
+        }
+        Logger::info("Hoisted " + std::to_string(report.hoisted) + "/" + std::to_string(report.inLoops) +
+                     " in-loop decryptions into " + std::to_string(report.locals) + " locals (" +
+                     std::to_string(report.sites - report.inLoops) + " sites outside loops, " +
+                     std::to_string(report.skippedFunctions) + " functions skipped for goto)");
+        if (report.hoisted > 0) {
+            code = LuaPrinter::print(*chunk, true);
         }
-        ss << ")\n";
+    } catch (const std::exception& e) {
+        Logger::warning("Loop hoisting skipped: " + std::string(e.what()));
     }
+}
 
-    
-    ss << "local " << varName << " = table.concat({";
-    for (size_t i = 0; i < chunkVars.size(); ++i) {
-        if (i > 0) ss << ", ";
-        ss << "[" << (i+1) << "]=" << chunkVars[i];
-    }
-    ss << "})\n";
+// Byte ranges of the tagged regions in `code`, shifted by what will be prepended to it
+struct TierRange {
+    size_t start;
+    size_t end;
+    Annotations::Tier tier;
+};
 
-    return ss.str();
-}
+static std::vector<TierRange> tierRanges(const std::string& code, size_t shift, Target::Kind target) {
+    std::vector<TierRange> ranges;
+    std::vector<Annotations::Region> regions = Annotations::regions(code, target);
+    if (regions.empty()) return ranges;
 
-std::string StringEncryption::generateDecryptor(const std::vector<uint8_t>& key) {
-    std::stringstream ss;
-    
-    
-    ss << "_G.__decrypt = function(str, key)\n"
-         "    if not str then return \"\" end\n"
-         "    if type(str) ~= 'string' then return \"\" end\n"
-         "    if #str == 0 then return \"\" end\n"
-         "    local result = {}\n"
-         "    for i = 1, #str do\n"
-         "        local byte = str:byte(i)\n"
-         "        byte = (byte >> 3) | (byte << 5) & 0xFF\n"
-         "        byte = byte ~ key[(i-1) % #key + 1]\n"
-         "        result[i] = string.char(byte)\n"
-         "    end\n"
-         "    return table.concat(result)\n"
-         "end\n\n";
+    std::vector<size_t> starts = {0, 0};
+    for (size_t i = 0; i < code.length(); ++i) {
+        if (code[i] == '\n') starts.push_back(i + 1);
+    }
+    starts.push_back(code.length());
+    for (const auto& region : regions) {
+        size_t end = static_cast<size_t>(region.endLine) + 1 < starts.size() ? starts[region.endLine + 1] : code.length();
+        ranges.push_back({starts[region.line] + shift, end + shift, region.tier});
+    }
+    return ranges;
+}
 
-    return ss.str();
+// Innermost region wins, and regions come outer first
+static Annotations::Tier tierAt(const std::vector<TierRange>& ranges, size_t pos) {
+    Annotations::Tier tier = Annotations::Tier::Default;
+    for (const auto& range : ranges) {
+        if (pos >= range.start && pos < range.end) tier = range.tier;
+    }
+    return tier;
 }
 
-void StringEncryption::processString(std::string& code, const std::vector<uint8_t>& key, size_t chunkSize) {
-    std::string decryptor = generateDecryptor(key);
+void StringEncryption::processString(std::string& code, const std::vector<uint8_t>& key, size_t chunkSize, Target::Kind target, const std::string& nativeModule, bool hoistLoops, bool maxOnly) {
+    std::string decryptor = generateDecryptor(chunkSize, target, nativeModule);
+    std::vector<TierRange> tiers = tierRanges(code, decryptor.length(), target);
     code = decryptor + code;
     
     
@@ -204,49 +201,98 @@ void StringEncryption::processString(std::string& code, const std::vector<uint8_
         }
         
         progress.finish("Found " + std::to_string(strings.size()) + " strings");
+
+        // Untagged literals are only encrypted when [Strings] is enabled, --@obf:none ones never
+        size_t found = strings.size();
+        strings.erase(std::remove_if(strings.begin(), strings.end(), [&](const auto& site) {
+            Annotations::Tier tier = tierAt(tiers, site.first);
+            return tier == Annotations::Tier::None || (maxOnly && tier != Annotations::Tier::Max);
+        }), strings.end());
+        if (strings.size() < found) {
+            Logger::info("Left " + std::to_string(found - strings.size()) + " string sites outside the protected tiers as written");
+        }
         
         if (strings.empty()) {
             return;
         }
         
         
-        std::sort(strings.rbegin(), strings.rend());
-        
-        
-        ProgressBar encProgress(strings.size(), 50, "Encrypting strings");
-        processedCount = 0;
-        std::vector<std::string> encryptedStrings;
+        // Intern literals by value so every distinct string is encrypted exactly once
+        std::sort(strings.begin(), strings.end());
+        std::unordered_map<std::string, size_t> pool;
+        std::vector<std::string> poolValues;
+        std::vector<size_t> siteIndices;
+        size_t siteBytes = 0;
         
         for (const auto& [pos, str] : strings) {
-            try {
-                
-                std::string content = str.substr(1, str.length() - 2);
-                std::string varName = "__str_" + std::to_string(processedCount);
-                
-                
-                std::string encrypted = encryptBytes(content, key, varName, chunkSize);
-                std::string replacement = "__decrypt(" + varName + ", __key)";
-                
-                encryptedStrings.push_back(encrypted);
-                code.replace(pos, str.length(), replacement);
-                
-                encProgress.update(++processedCount);
-                
-            } catch (const std::exception& e) {
-                Logger::error("Failed to process string at position " + std::to_string(pos) + ": " + e.what());
+            std::string content = LuaLexer::unescape(str.substr(1, str.length() - 2), target);
+            auto [it, inserted] = pool.emplace(content, poolValues.size());
+            if (inserted) {
+                poolValues.push_back(content);
             }
+            siteIndices.push_back(it->second);
+            siteBytes += content.length();
+        }
+        
+        ProgressBar encProgress(poolValues.size(), 50, "Encrypting strings");
+        std::string blob;
+        std::vector<size_t> lengths;
+        
+        for (size_t i = 0; i < poolValues.size(); ++i) {
+            blob += PayloadEncoder::encrypt(poolValues[i], key);
+            lengths.push_back(poolValues[i].length());
+            encProgress.update(i + 1);
         }
         
         encProgress.finish("Completed");
         
+        // Literals in fast code read a cache that decrypts each one on first use
+        size_t hotSites = 0;
+        for (size_t i = strings.size(); i-- > 0;) {
+            const auto& [pos, str] = strings[i];
+            std::string index = std::to_string(siteIndices[i] + 1);
+            bool inHot = tierAt(tiers, pos) == Annotations::Tier::Fast;
+            std::string replacement = inHot ? "__strcache[" + index + "]" : "__decrypt(__strpool[" + index + "], __key)";
+            code.replace(pos, str.length(), replacement);
+            if (inHot) ++hotSites;
+        }
         
-        std::string allEncrypted;
-        for (const auto& encrypted : encryptedStrings) {
-            allEncrypted += encrypted + "\n";
+        std::string allEncrypted = "local __strpool = {}\n"
+            "do\n"
+            "    local blob, pos = " + PayloadEncoder::toLuaLiteral(blob) + ", 1\n"
+            "    for i, len in ipairs(" + PayloadEncoder::toLuaList(lengths) + ") do\n"
+            "        __strpool[i] = blob:sub(pos, pos + len - 1)\n"
+            "        pos = pos + len\n"
+            "    end\n"
+            "end\n\n";
+        if (hotSites > 0) {
+            allEncrypted += "local __strcache = setmetatable({}, {__index = function(cache, i)\n"
+                "    local value = __decrypt(__strpool[i], __key)\n"
+                "    cache[i] = value\n"
+                "    return value\n"
+                "end})\n\n";
+            Logger::info("Cached " + std::to_string(hotSites) + " string sites in fast code");
         }
+        size_t poolBytes = blob.length();
+        
+        Logger::info("String pool: " + std::to_string(strings.size()) + " sites, " +
+                     std::to_string(poolValues.size()) + " unique literals, " +
+                     std::to_string(poolBytes) + "/" + std::to_string(siteBytes) + " bytes encrypted (" +
+                     std::to_string(siteBytes - poolBytes) + " deduplicated)");
         
-        if (!allEncrypted.empty()) {
-            code.insert(decryptor.length(), allEncrypted);
+        std::stringstream keyDecl;
+        keyDecl << "local __key = {";
+        for (size_t i = 0; i < key.size(); ++i) {
+            if (i > 0) keyDecl << ",";
+            keyDecl << (int)key[i];
+        }
+        keyDecl << "}\n\n";
+        
+        code.insert(decryptor.length(), keyDecl.str() + allEncrypted);
+
+        // Literals inside loops would otherwise be decrypted again on every iteration
+        if (hoistLoops) {
+            hoistLoopInvariants(code, target);
         }
         
     } catch (const std::exception& e) {
@@ -2,13 +2,15 @@
 #include <string>
 #include <vector>
 #include "../Logger.hpp"
+#include "../Target.hpp"
 
 class StringEncryption {
 private:
-    static std::string encryptBytes(const std::string& input, const std::vector<uint8_t>& key, const std::string& varName, size_t chunkSize);
+    static void hoistLoopInvariants(std::string& code, Target::Kind target);
 
 public:
     static std::string encrypt(const std::string& input, const std::vector<uint8_t>& key, const std::string& varName, size_t chunkSize);
-    static std::string generateDecryptor(const std::vector<uint8_t>& key);
-    static void processString(std::string& sourceCode, const std::vector<uint8_t>& key, size_t chunkSize);
+    static std::string generateDecryptor(size_t blockSize, Target::Kind target, const std::string& nativeModule);
+    // With maxOnly, only literals in code tagged --@obf:max are encrypted
+    static void processString(std::string& sourceCode, const std::vector<uint8_t>& key, size_t chunkSize, Target::Kind target, const std::string& nativeModule, bool hoistLoops = true, bool maxOnly = false);
 }; 
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include "StringHoister.hpp"
+#include <algorithm>
+#include "../parser/AstWalker.hpp"
+
+StringHoister::Report StringHoister::hoist(Block& chunk) {
+    StringHoister hoister;
+    if (writesPool(chunk)) {
+        hoister.report.skipped = "script assigns __decrypt, __key or __strpool";
+        return hoister.report;
+    }
+    hoister.visitFunction(chunk);
+    return hoister.report;
+}
+
+bool StringHoister::isDecryptCall(const Expr& expr) {
+    if (expr.kind != ExprKind::Call || expr.args.size() != 2) return false;
+    const Expr& pooled = *expr.args[0];
+    return expr.lhs->kind == ExprKind::Name && expr.lhs->value == "__decrypt" &&
+           pooled.kind == ExprKind::Index && pooled.lhs->kind == ExprKind::Name && pooled.lhs->value == "__strpool" &&
+           pooled.rhs->kind == ExprKind::Number &&
+           expr.args[1]->kind == ExprKind::Name && expr.args[1]->value == "__key";
+}
+
+bool StringHoister::writesPool(Block& chunk) {
+    // The prelude declares each name once; anything more means a hoisted value could go stale
+    size_t decryptWrites = 0, poolDeclarations = 0;
+    bool reassigned = false;
+    AstWalker::walk(chunk, [&](Stat& stat) {
+        if (stat.kind == StatKind::Local || stat.kind == StatKind::LocalFunction) {
+            for (const auto& name : stat.names) {
+                if (name == "__decrypt") ++decryptWrites;
+                if (name == "__key" || name == "__strpool") ++poolDeclarations;
+            }
+        }
+        if (stat.kind != StatKind::Assign && stat.kind != StatKind::Function) return;
+        for (const auto& target : stat.targets) {
+            if (target->kind == ExprKind::Name) {
+                if (target->value == "__decrypt") ++decryptWrites;
+                if (target->value == "__key" || target->value == "__strpool") reassigned = true;
+            } else if (target->kind == ExprKind::Index && target->lhs->kind == ExprKind::Name && target->lhs->value == "_G" &&
+                       target->rhs->kind == ExprKind::String && target->rhs->value == "__decrypt") {
+                ++decryptWrites;
+            }
+        }
+    }, nullptr);
+    return decryptWrites > 1 || poolDeclarations > 2 || reassigned;
+}
+
+bool StringHoister::containsGoto(Block& block) {
+    bool found = false;
+    AstWalker::walk(block, [&](Stat& stat) {
+        if (stat.kind == StatKind::Goto || stat.kind == StatKind::Label) found = true;
+    }, nullptr, false);
+    return found;
+}
+
+size_t StringHoister::countLocals(Block& block) {
+    size_t count = 0;
+    AstWalker::walk(block, [&](Stat& stat) {
+        if (stat.kind == StatKind::Local || stat.kind == StatKind::LocalFunction ||
+            stat.kind == StatKind::NumericFor || stat.kind == StatKind::GenericFor) {
+            count += stat.names.size();
+        }
+    }, nullptr, false);
+    return count;
+}
+
+void StringHoister::visitFunction(Block& body) {
+    FunctionState state;
+    size_t existing = countLocals(body);
+    state.budget = existing < MAX_LOCALS ? MAX_LOCALS - existing : 0;
+    // A new local between a goto and its label would put the jump into the local's scope
+    if (containsGoto(body)) {
+        state.budget = 0;
+        ++report.skippedFunctions;
+    }
+
+    visitBlock(body, state, -1);
+
+    for (auto& insertion : state.insertions) {
+        if (insertion.locals.empty()) continue;
+        auto decl = std::make_shared<Stat>(StatKind::Local, insertion.loop->line);
+        for (auto& [name, call] : insertion.locals) {
+            decl->names.push_back(name);
+            decl->attribs.push_back("");
+            decl->exprs.push_back(call);
+        }
+        auto& stats = insertion.block->stats;
+        auto it = std::find_if(stats.begin(), stats.end(), [&](const StatPtr& stat) { return stat.get() == insertion.loop; });
+        stats.insert(it, decl);
+        report.locals += insertion.locals.size();
+    }
+}
+
+void StringHoister::visitBlock(Block& block, FunctionState& state, int loop) {
+    for (size_t i = 0; i < block.stats.size(); ++i) {
+        Stat& stat = *block.stats[i];
+        bool isLoop = stat.kind == StatKind::While || stat.kind == StatKind::Repeat ||
+                      stat.kind == StatKind::NumericFor || stat.kind == StatKind::GenericFor;
+
+        // For-loop headers run once per entry, so they belong to the surrounding context
+        int inner = loop;
+        if (isLoop && loop < 0) {
+            state.insertions.push_back({&block, &stat, {}, {}});
+            inner = static_cast<int>(state.insertions.size()) - 1;
+        }
+        bool headerInLoop = stat.kind == StatKind::While || stat.kind == StatKind::Repeat;
+
+        for (auto& target : stat.targets) visitExpr(target, state, loop);
+        for (auto& expr : stat.exprs) visitExpr(expr, state, headerInLoop ? inner : loop);
+        if (stat.expr) visitExpr(stat.expr, state, loop);
+        for (auto& body : stat.blocks) visitBlock(*body, state, isLoop ? inner : loop);
+        if (stat.func) visitFunction(*stat.func->body);
+    }
+}
+
+void StringHoister::visitExpr(ExprPtr& expr, FunctionState& state, int loop) {
+    if (isDecryptCall(*expr)) {
+        ++report.sites;
+        if (loop < 0) return;
+        ++report.inLoops;
+
+        Insertion& insertion = state.insertions[loop];
+        const std::string& index = expr->args[0]->rhs->value;
+        auto found = insertion.names.find(index);
+        if (found == insertion.names.end()) {
+            if (state.locals >= state.budget) return;
+            ++state.locals;
+            found = insertion.names.emplace(index, "__str" + index).first;
+            insertion.locals.emplace_back(found->second, expr);
+        }
+        auto name = std::make_shared<Expr>(ExprKind::Name, expr->line);
+        name->value = found->second;
+        expr = name;
+        ++report.hoisted;
+        return;
+    }
+
+    if (expr->func) {
+        visitFunction(*expr->func->body);
+        return;
+    }
+    AstWalker::children(*expr, [&](ExprPtr& child) { visitExpr(child, state, loop); }, [](BlockPtr&) {});
+}
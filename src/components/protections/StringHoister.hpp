@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include "../parser/LuaAst.hpp"
+
+// Moves decryption of pooled literals out of loops: a __decrypt(__strpool[i], __key) call inside a loop becomes a
+// local declared right before the outermost loop of its function, so each iteration only reads the local.
+class StringHoister {
+public:
+    struct Report {
+        size_t sites = 0;
+        size_t inLoops = 0;
+        size_t hoisted = 0;
+        size_t locals = 0;
+        size_t skippedFunctions = 0;
+        std::string skipped;
+    };
+
+    static Report hoist(Block& chunk);
+
+private:
+    static constexpr size_t MAX_LOCALS = 150;
+
+    // Declarations waiting to be inserted before `loop` in `block`, one per pool index
+    struct Insertion {
+        Block* block;
+        Stat* loop;
+        std::vector<std::pair<std::string, ExprPtr>> locals;
+        std::map<std::string, std::string> names;
+    };
+
+    struct FunctionState {
+        std::vector<Insertion> insertions;
+        size_t budget = 0;
+        size_t locals = 0;
+    };
+
+    Report report;
+
+    static bool isDecryptCall(const Expr& expr);
+    static bool writesPool(Block& chunk);
+    static bool containsGoto(Block& block);
+    static size_t countLocals(Block& block);
+
+    void visitFunction(Block& body);
+    void visitBlock(Block& block, FunctionState& state, int loop);
+    void visitExpr(ExprPtr& expr, FunctionState& state, int loop);
+};
@@ -1,104 +1,168 @@
 #include "VMProtection.hpp"
 #include <sstream>
+#include "Compression.hpp"
 #include "ControlFlow.hpp"
+#include "../Annotations.hpp"
 #include "../Logger.hpp"
+#include "../PayloadEncoder.hpp"
+#include "../parser/LuaParser.hpp"
+#include "../vm/BytecodeCompiler.hpp"
+#include "../vm/BytecodeInterpreter.hpp"
+#include "../vm/GlobalLocalizer.hpp"
+#include "../parser/LuaPrinter.hpp"
 
-std::string VMProtection::generateVM() {
+std::vector<std::string> VMProtection::toPieces(const std::string& code, const std::vector<uint8_t>& key, int level, PayloadCompressor::Stats& stats) {
+    if (level <= 0) return PayloadEncoder::toLuaPieces(PayloadEncoder::encrypt(code, key), key.size());
+
+    // Compressed blocks are encrypted one by one, so every piece decrypts and decompresses on its own
+    std::vector<std::string> pieces;
+    for (const auto& block : PayloadCompressor::compress(code, level, stats)) {
+        pieces.push_back(PayloadEncoder::toLuaLiteral(PayloadEncoder::encrypt(block, key)));
+    }
+    return pieces;
+}
+
+std::string VMProtection::encryptCode(const std::string& code, const std::vector<uint8_t>& key, int level, PayloadCompressor::Stats& stats) {
     std::stringstream ss;
     
-    ss << "local function __createVM()\n";
-    ss << "    local env = setmetatable({}, {__index = _ENV})\n";
-    ss << "    return function(code)\n";
-    ss << "        local f = load(code, nil, 't', env)\n";
-    ss << "        if not f then error('Code error') end\n";
-    ss << "        return f()\n";
+    std::vector<std::string> pieces = toPieces(code, key, level, stats);
+    Logger::debug("Payload split into " + std::to_string(pieces.size()) + " pieces");
+
+    ss << "local __payload = {\n";
+    for (const auto& piece : pieces) {
+        ss << "    " << piece << ",\n";
+    }
+    ss << "}\n\n";
+
+    // load() pulls decrypted pieces one at a time, so the plaintext is never materialized as one string
+    ss << "local __code\n";
+    ss << "do\n";
+    ss << "    local index = 0\n";
+    ss << "    __code = function()\n";
+    ss << "        index = index + 1\n";
+    ss << "        local piece = __payload[index]\n";
+    ss << "        if piece then\n";
+    ss << "            __payload[index] = nil\n";
+    ss << "            return " << (level > 0 ? "__decompress(__decrypt(piece, __key))" : "__decrypt(piece, __key)") << "\n";
+    ss << "        end\n";
     ss << "    end\n";
     ss << "end\n\n";
 
     return ss.str();
 }
 
-std::string VMProtection::encryptCode(const std::string& code, const std::vector<uint8_t>& key, size_t chunkSize) {
+std::string VMProtection::encryptBodies(const std::vector<std::string>& bodies, const std::vector<uint8_t>& key, int level, PayloadCompressor::Stats& stats) {
     std::stringstream ss;
-    
-    
-    std::vector<std::string> chunks;
-    for (size_t i = 0; i < code.length(); i += chunkSize * 5) {
-        chunks.push_back(code.substr(i, std::min<size_t>(chunkSize * 5, code.length() - i)));
-    }
 
-    
-    for (size_t i = 0; i < chunks.size(); ++i) {
-        const std::string& chunk = chunks[i];
-        
-        
-        std::vector<std::string> subChunkVars;
-        for (size_t j = 0; j < 5 && j * chunkSize < chunk.length(); ++j) {
-            size_t subStart = j * chunkSize;
-            size_t subLen = std::min<size_t>(chunkSize, chunk.length() - subStart);
-            if (subLen == 0) break;
-            
-            std::string subChunk = chunk.substr(subStart, subLen);
-            std::string varName = std::string("__enc_") + std::to_string(i) + "_" + std::to_string(j);
-            ss << "local " << varName << " = string.char(";
-            
-            
-            for (size_t k = 0; k < subChunk.length(); ++k) {
-                if (k > 0) ss << ",";
-                uint8_t byte = subChunk[k];
-                
-                byte ^= key[(k + subStart) % key.size()];
-                byte = (byte << 3) | (byte >> 5); 
-                ss << (int)byte;
-            }
-            ss << ")\n";
-            subChunkVars.push_back(varName);
+    // Each function body is encrypted on its own and only decrypted when the function first runs
+    ss << "local __body\n";
+    ss << "do\n";
+    ss << "    local bodies = {\n";
+    for (const auto& body : bodies) {
+        ss << "        {";
+        std::vector<std::string> pieces = toPieces(body, key, level, stats);
+        for (size_t i = 0; i < pieces.size(); ++i) {
+            if (i > 0) ss << ", ";
+            ss << pieces[i];
         }
-        
-        
-        ss << "local __encrypted_" << i << " = string.format('%s%s%s%s%s',\n";
-        for (size_t j = 0; j < subChunkVars.size(); ++j) {
-            ss << "    " << subChunkVars[j];
-            if (j < subChunkVars.size() - 1) ss << ",\n";
+        ss << "},\n";
+    }
+    ss << "    }\n";
+    // Captured now: the protected program may define its own global __decrypt before a body is fetched
+    ss << "    local decrypt, key" << (level > 0 ? ", decompress" : "") << " = __decrypt, __key" << (level > 0 ? ", __decompress" : "") << "\n";
+    ss << "    __body = function(index)\n";
+    ss << "        local pieces = bodies[index]\n";
+    ss << "        bodies[index] = nil\n";
+    ss << "        for i = 1, #pieces do\n";
+    ss << "            pieces[i] = " << (level > 0 ? "decompress(decrypt(pieces[i], key))" : "decrypt(pieces[i], key)") << "\n";
+    ss << "        end\n";
+    ss << "        return table.concat(pieces)\n";
+    ss << "    end\n";
+    ss << "end\n\n";
+
+    return ss.str();
+}
+
+void VMProtection::localizeGlobals(std::string& code, Target::Kind target) {
+    try {
+        LuaParser parser(code, target);
+        BlockPtr chunk = parser.parse();
+        GlobalLocalizer::Report report = GlobalLocalizer::localize(*chunk);
+        if (!report.skipped.empty()) {
+            Logger::info("Global localization limited: " + report.skipped);
         }
-        
-        for (size_t j = subChunkVars.size(); j < 5; ++j) {
-            ss << ",\n    ''";
+        if (report.names.empty()) return;
+
+        std::string names;
+        for (const auto& name : report.names) {
+            names += (names.empty() ? "" : ", ") + name;
         }
-        ss << ")\n";
+        Logger::info("Localized " + std::to_string(report.names.size()) + " globals (" + std::to_string(report.reads) + " reads): " + names);
+        code = LuaPrinter::print(*chunk, true);
+    } catch (const std::exception& e) {
+        Logger::warning("Global localization skipped: " + std::string(e.what()));
     }
+}
 
-    
-    ss << "local __code = string.format('%s%s%s%s',\n";
-    for (size_t i = 0; i < chunks.size(); ++i) {
-        ss << "    __decrypt(__encrypted_" << i << ", __key)";
-        if (i < chunks.size() - 1) ss << ",\n";
-    }
-    
-    for (size_t i = chunks.size(); i < 4; ++i) {
-        ss << ",\n    ''";
-    }
-    ss << ")\n\n";
+bool VMProtection::compileBytecode(const std::string& code, bool lazy, Target::Kind target, std::string& runtime, std::string& program, std::vector<std::string>& bodies, bool maxOnly) {
+    try {
+        LuaParser parser(code, target);
+        BlockPtr chunk = parser.parse();
+        ProtoPtr main = BytecodeCompiler::compile(*chunk, target, maxOnly);
 
-    return ss.str();
+        BytecodeInterpreter::Stats stats;
+        runtime = BytecodeInterpreter::generate(*main, program, lazy ? &bodies : nullptr, target, stats);
+        Logger::info("Compiled " + std::to_string(stats.functions) + " functions to " + std::to_string(stats.instructions) +
+                     " instructions (" + std::to_string(stats.fused) + " fused), " + std::to_string(program.length()) + " bytes");
+        std::stringstream depth;
+        depth.precision(2);
+        depth << std::fixed << stats.dispatchDepth;
+        if (lazy) {
+            Logger::info("Split " + std::to_string(bodies.size()) + " function bodies for decryption on first call");
+        }
+        if (stats.natives > 0) {
+            Logger::info("Left " + std::to_string(stats.natives) + " functions to run natively");
+        }
+        Logger::info("Interpreter handles " + std::to_string(stats.opcodes) + " opcodes, " + depth.str() + " comparisons per dispatch (weighted)");
+        return true;
+    } catch (const std::exception& e) {
+        Logger::warning("Bytecode compilation failed, falling back to load(): " + std::string(e.what()));
+        return false;
+    }
 }
 
-std::string VMProtection::wrapCode(const std::string& code, const std::vector<uint8_t>& key, size_t chunkSize, const ConfigParser& config) {
+std::string VMProtection::wrapCode(const std::string& code, const std::vector<uint8_t>& key, size_t chunkSize, const ConfigParser& config, PayloadCompressor::Stats* stats, bool maxOnly) {
     Logger::info("Starting VM protection...");
     Logger::info("Input code length: " + std::to_string(code.length()));
     
     std::stringstream ss;
     bool compressionEnabled = config.getBoolValue("Compression", "enabled", false);
+    Target::Kind target = Target::fromName(config.getValue("Output", "target", "lua54"));
     
     
-    std::string vmCode;
-    if (compressionEnabled) {
-        vmCode = "local function __createVM()local env=setmetatable({},{__index=_ENV})return function(code)local f=load(code,nil,'t',env)if not f then error('Code error')end return f()end end\n";
-    } else {
-        vmCode = generateVM();
+    // Library globals become upvalue locals, so hot reads skip the environment lookup
+    std::string source = code;
+    if (config.getBoolValue("VM", "localize_globals", true)) {
+        localizeGlobals(source, target);
+    }
+
+    // Bytecode mode ships compiled functions and an interpreter instead of source for load()
+    std::string runtime, program;
+    std::vector<std::string> bodies;
+    bool lazy = config.getBoolValue("VM", "lazy_functions", true);
+    // Luau has no load(), so it always gets the interpreter
+    bool wantBytecode = maxOnly || config.getValue("VM", "mode", "bytecode") == "bytecode" || !Target::hasLoad(target);
+    bool bytecode = wantBytecode && compileBytecode(source, lazy, target, runtime, program, bodies, maxOnly);
+    // Source mode would hand the whole chunk to the VM
+    if (maxOnly && !bytecode) {
+        Logger::warning("--@obf:max functions left outside the VM");
+        return code;
+    }
+    if (!bytecode && !Target::hasLoad(target)) {
+        Logger::warning("VM output relies on load(), which " + Target::name(target) + " does not provide");
     }
     
-    ss << vmCode;
+    ss << runtime;
 
     
     ss << "local __key = {";
@@ -109,30 +173,38 @@ std::string VMProtection::wrapCode(const std::string& code, const std::vector<ui
     ss << "}\n\n";
 
     
-    if (compressionEnabled) {
-        ss << "_G.__decrypt=function(str,key)if not str then return\"\"end if type(str)~='string'then return\"\"end if #str==0 then return\"\"end local result={}for i=1,#str do local byte=str:byte(i)byte=(byte>>3)|(byte<<5)&0xFF byte=byte~key[(i-1)%#key+1]result[i]=string.char(byte)end return table.concat(result)end\n";
-    } else {
-        ss << "_G.__decrypt = function(str, key)\n"
-           << "    if not str then return \"\" end\n"
-           << "    if type(str) ~= 'string' then return \"\" end\n"
-           << "    if #str == 0 then return \"\" end\n"
-           << "    local result = {}\n"
-           << "    for i = 1, #str do\n"
-           << "        local byte = str:byte(i)\n"
-           << "        byte = (byte >> 3) | (byte << 5) & 0xFF\n"
-           << "        byte = byte ~ key[(i-1) % #key + 1]\n"
-           << "        result[i] = string.char(byte)\n"
-           << "    end\n"
-           << "    return table.concat(result)\n"
-           << "end\n\n";
+    ss << PayloadEncoder::generateDecryptor(chunkSize, target, config.getValue("Encryption", "native_module", ""), compressionEnabled);
+
+    // load() runs the source itself, which must not show the tiers it was protected with
+    if (!bytecode) Annotations::strip(source, target);
+
+    // The payload is compressed before encryption when the compression level asks for it and it reaches the threshold
+    const std::string& payload = bytecode ? program : source;
+    size_t payloadSize = payload.length();
+    for (const auto& body : bodies) payloadSize += body.length();
+    int level = Compression::fromConfig(config).payloadEffort;
+    if (payloadSize < static_cast<size_t>(config.getIntValue("Compression", "threshold", 1024))) level = 0;
+    PayloadCompressor::Stats local;
+    PayloadCompressor::Stats& compression = stats ? *stats : local;
+    if (level > 0) {
+        ss << PayloadCompressor::generateDecompressor(target);
+    }
+
+    if (!bodies.empty()) {
+        ss << encryptBodies(bodies, key, level, compression);
     }
     
     
-    std::string encryptedCode = encryptCode(code, key, chunkSize);
+    std::string encryptedCode = encryptCode(payload, key, level, compression);
     Logger::info("Encrypted code length: " + std::to_string(encryptedCode.length()));
+    if (level > 0) {
+        PayloadCompressor::report(compression, level);
+    }
     
     
-    std::string scrambledCode = ControlFlow::scramble(encryptedCode, config);
+    std::string env = Target::environment(target);
+    std::string scrambledCode = bytecode ? ControlFlow::scramble(encryptedCode, config, bodies.empty() ? "__vm_load(__code, " + env + ")" : "__vm_load(__code, " + env + ", __body)")
+                                         : ControlFlow::scramble(encryptedCode, config);
     
     ss << scrambledCode;
     
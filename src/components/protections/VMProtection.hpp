@@ -2,12 +2,18 @@
 #include <string>
 #include <vector>
 #include "../../components/ConfigParser.hpp"
+#include "../../components/PayloadCompressor.hpp"
+#include "../../components/Target.hpp"
 
 class VMProtection {
 private:
-    static std::string generateVM();
-    static std::string encryptCode(const std::string& code, const std::vector<uint8_t>& key, size_t chunkSize);
+    static std::vector<std::string> toPieces(const std::string& code, const std::vector<uint8_t>& key, int level, PayloadCompressor::Stats& stats);
+    static std::string encryptCode(const std::string& code, const std::vector<uint8_t>& key, int level, PayloadCompressor::Stats& stats);
+    static std::string encryptBodies(const std::vector<std::string>& bodies, const std::vector<uint8_t>& key, int level, PayloadCompressor::Stats& stats);
+    static void localizeGlobals(std::string& code, Target::Kind target);
+    static bool compileBytecode(const std::string& code, bool lazy, Target::Kind target, std::string& runtime, std::string& program, std::vector<std::string>& bodies, bool maxOnly);
 
 public:
-    static std::string wrapCode(const std::string& code, const std::vector<uint8_t>& key, size_t chunkSize, const ConfigParser& config);
+    // With maxOnly, only the main chunk and functions tagged --@obf:max run in the interpreter
+    static std::string wrapCode(const std::string& code, const std::vector<uint8_t>& key, size_t chunkSize, const ConfigParser& config, PayloadCompressor::Stats* stats = nullptr, bool maxOnly = false);
 }; 
\ No newline at end of file
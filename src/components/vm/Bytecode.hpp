@@ -0,0 +1,80 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+
+// R = registers (1-based), K = constants, U = upvalue boxes, T = jump target (instruction index)
+enum class Opcode {
+    Move,           // R[a] = R[b]
+    LoadK,          // R[a] = K[b]
+    LoadNil,        // R[a .. a+b-1] = nil
+    LoadBool,       // R[a] = b ~= 0
+    GetUpval,       // R[a] = U[b][1]
+    GetConstUpval,  // R[a] = U[b], for captures never assigned after initialization
+    SetUpval,       // U[b][1] = R[a]
+    GetBox,         // R[a] = R[b][1]
+    SetBox,         // R[a][1] = R[b]
+    NewBox,         // R[a] = {R[a]}
+    GetGlobal,      // R[a] = env[K[b]]
+    SetGlobal,      // env[K[b]] = R[a]
+    GetTable,       // R[a] = R[b][R[c]]
+    GetField,       // R[a] = R[b][K[c]]
+    SetTable,       // R[a][R[b]] = R[c]
+    SetField,       // R[a][K[b]] = R[c]
+    NewTable,       // R[a] = {}
+    SetList,        // R[a][c+i] = R[a+i] for i = 1 .. b (b = 0: up to top)
+    Self,           // R[a+1] = R[b]; R[a] = R[b][K[c]]
+    Add, Sub, Mul, Div, Mod, Pow, IDiv, BAnd, BOr, BXor, Shl, Shr, Concat,   // R[a] = R[b] op R[c]
+    AddK, SubK, MulK, DivK, ModK,                                            // R[a] = R[b] op K[c]
+    Unm, Not, Len, BNot,                                                     // R[a] = op R[b]
+    Eq, Ne, Lt, Le,                                                          // R[a] = R[b] op R[c]
+    Jmp,            // pc = T[a]
+    JT, JF,         // if (not) R[a] then pc = T[b]
+    JEq, JNe, JLt, JNLt, JLe, JNLe,                                          // if R[a] op R[b] then pc = T[c]
+    JEqK, JNeK, JLtK, JNLtK, JLeK, JNLeK, JGtK, JNGtK, JGeK, JNGeK,          // if R[a] op K[b] then pc = T[c]
+    Call,           // R[a .. a+c-2] = R[a](R[a+1 .. a+b-1]); b = 0: args up to top, c = 0: results set top
+    TailCall,       // return R[a](R[a+1 .. a+b-1])
+    Return,         // return R[a .. a+b-2]; b = 0: up to top
+    Vararg,         // R[a .. a+b-2] = ...; b = 0: all of them, sets top
+    Closure,        // R[a] = closure(protos[b])
+    ForPrep,        // check R[a], R[a+1], R[a+2]; R[a+3] = R[a] or pc = T[b]
+    ForLoop,        // R[a] += R[a+2]; if in range then R[a+3] = R[a]; pc = T[b]
+    TForLoop,       // R[a+3 .. a+2+b] = R[a](R[a+1], R[a+2]); if R[a+3] ~= nil then R[a+2] = R[a+3]; pc = T[c]
+
+    // Superinstructions for a variable load followed by a constant-key field read
+    GetGlobalField, // R[a] = env[K[b]][K[c]]
+    GetUpvalField,  // R[a] = U[b][1][K[c]]
+    GetConstUpvalField, // R[a] = U[b][K[c]]
+
+    Count
+};
+
+struct Instruction {
+    Opcode op;
+    int a = 0;
+    int b = 0;
+    int c = 0;
+    int loopDepth = 0;
+};
+
+struct Constant {
+    enum Type { Nil, False, True, Number, String } type = Nil;
+    // Numbers keep their source text so integer/float subtypes survive tonumber() at load time
+    std::string value;
+};
+
+struct Proto {
+    int numParams = 0;
+    bool vararg = false;
+    std::vector<Instruction> code;
+    std::vector<Constant> constants;
+    std::vector<std::shared_ptr<Proto>> protos;
+    // (captured from the enclosing function's registers, index) per upvalue
+    std::vector<std::pair<bool, int>> upvalues;
+    // Hot functions left to run natively: Lua source of a chunk that is called with the upvalues (values, or boxes
+    // for assigned ones) and returns the function. Such protos have no code of their own.
+    std::string native;
+};
+
+using ProtoPtr = std::shared_ptr<Proto>;
@@ -0,0 +1,1061 @@
+#include "BytecodeCompiler.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <iterator>
+#include "../Annotations.hpp"
+#include "../parser/AstWalker.hpp"
+#include "../parser/LuaParser.hpp"
+#include "../parser/LuaPrinter.hpp"
+
+static const int SETLIST_BATCH = 50;
+
+static Opcode arithOp(const std::string& op) {
+    static const std::map<std::string, Opcode> ops = {
+        {"+", Opcode::Add}, {"-", Opcode::Sub}, {"*", Opcode::Mul}, {"/", Opcode::Div},
+        {"%", Opcode::Mod}, {"^", Opcode::Pow}, {"//", Opcode::IDiv}, {"&", Opcode::BAnd},
+        {"|", Opcode::BOr}, {"~", Opcode::BXor}, {"<<", Opcode::Shl}, {">>", Opcode::Shr},
+        {"..", Opcode::Concat},
+    };
+    return ops.at(op);
+}
+
+static bool isComparison(const std::string& op) {
+    return op == "==" || op == "~=" || op == "<" || op == "<=" || op == ">" || op == ">=";
+}
+
+// Values that are written to their target before all operands have been read
+static bool writesEarly(const Expr& expr) {
+    switch (expr.kind) {
+        case ExprKind::Paren:
+            return writesEarly(*expr.lhs);
+        case ExprKind::Call:
+        case ExprKind::Method:
+        case ExprKind::Table:
+            return true;
+        case ExprKind::Binary:
+            return expr.value == "and" || expr.value == "or";
+        default:
+            return false;
+    }
+}
+
+BytecodeCompiler::BytecodeCompiler() : fs(nullptr), nextDecl(0), target(Target::Lua54), native(false), maxOnly(false) {}
+
+ProtoPtr BytecodeCompiler::compile(const Block& chunk, Target::Kind target, bool maxOnly) {
+    // The first pass only finds the locals that inner functions capture
+    BytecodeCompiler probe;
+    probe.compileMain(chunk);
+
+    BytecodeCompiler compiler;
+    compiler.target = target;
+    compiler.native = Target::hasLoad(target);
+    compiler.maxOnly = maxOnly;
+    std::set_intersection(probe.captured.begin(), probe.captured.end(), probe.assigned.begin(), probe.assigned.end(),
+                          std::inserter(compiler.boxed, compiler.boxed.end()));
+    return compiler.compileMain(chunk);
+}
+
+ProtoPtr BytecodeCompiler::compileMain(const Block& chunk) {
+    FuncState main;
+    main.proto = std::make_shared<Proto>();
+    main.proto->vararg = true;
+    fs = &main;
+
+    enterScope();
+    compileBlock(chunk);
+    leaveScope();
+    emit(Opcode::Return, 0, 1);
+
+    fs = nullptr;
+    return main.proto;
+}
+
+int BytecodeCompiler::jumpOperand(Opcode op) {
+    switch (op) {
+        case Opcode::Jmp:
+            return 0;
+        case Opcode::JT:
+        case Opcode::JF:
+        case Opcode::ForPrep:
+        case Opcode::ForLoop:
+            return 1;
+        case Opcode::TForLoop:
+            return 2;
+        default:
+            break;
+    }
+    if (op >= Opcode::JEq && op <= Opcode::JNGeK) return 2;
+    return -1;
+}
+
+static int& operand(Instruction& ins, int index) {
+    return index == 0 ? ins.a : (index == 1 ? ins.b : ins.c);
+}
+
+int BytecodeCompiler::emit(Opcode op, int a, int b, int c) {
+    Instruction ins;
+    ins.op = op;
+    ins.a = a;
+    ins.b = b;
+    ins.c = c;
+    ins.loopDepth = fs->loopDepth;
+    fs->proto->code.push_back(ins);
+    return static_cast<int>(fs->proto->code.size()) - 1;
+}
+
+int BytecodeCompiler::here() const {
+    return static_cast<int>(fs->proto->code.size());
+}
+
+void BytecodeCompiler::patch(int jump, int target) {
+    Instruction& ins = fs->proto->code[jump];
+    operand(ins, jumpOperand(ins.op)) = target;
+}
+
+void BytecodeCompiler::patchAll(const std::vector<int>& jumps, int target) {
+    for (int jump : jumps) {
+        patch(jump, target);
+    }
+}
+
+int BytecodeCompiler::allocReg(int count) {
+    int reg = fs->freeReg;
+    fs->freeReg += count;
+    return reg;
+}
+
+int BytecodeCompiler::constant(const Constant& value) {
+    std::string key = std::to_string(value.type) + ":" + value.value;
+    auto it = fs->constantIndex.find(key);
+    if (it != fs->constantIndex.end()) return it->second;
+
+    fs->proto->constants.push_back(value);
+    int index = static_cast<int>(fs->proto->constants.size());
+    fs->constantIndex[key] = index;
+    return index;
+}
+
+int BytecodeCompiler::stringConstant(const std::string& value) {
+    Constant k;
+    k.type = Constant::String;
+    k.value = value;
+    return constant(k);
+}
+
+bool BytecodeCompiler::constantOf(const Expr& expr, Constant& out) {
+    switch (expr.kind) {
+        case ExprKind::Nil:
+            out.type = Constant::Nil;
+            return true;
+        case ExprKind::False:
+            out.type = Constant::False;
+            return true;
+        case ExprKind::True:
+            out.type = Constant::True;
+            return true;
+        case ExprKind::Number:
+            out.type = Constant::Number;
+            out.value = expr.value;
+            return true;
+        case ExprKind::String:
+            out.type = Constant::String;
+            out.value = expr.value;
+            return true;
+        case ExprKind::Unary:
+            // Long decimal literals overflow to floats in the source but not in tonumber("-...")
+            if (expr.value == "-" && expr.lhs->kind == ExprKind::Number && expr.lhs->value.length() < 19) {
+                out.type = Constant::Number;
+                out.value = "-" + expr.lhs->value;
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+bool BytecodeCompiler::isMulti(const Expr& expr) {
+    return expr.kind == ExprKind::Call || expr.kind == ExprKind::Method || expr.kind == ExprKind::Vararg;
+}
+
+void BytecodeCompiler::enterScope() {
+    fs->scopes.emplace_back(fs->actives.size(), fs->freeReg);
+}
+
+void BytecodeCompiler::leaveScope() {
+    auto [count, reg] = fs->scopes.back();
+    fs->scopes.pop_back();
+    fs->actives.resize(count);
+    fs->freeReg = reg;
+}
+
+void BytecodeCompiler::activate(const std::string& name, int reg) {
+    if (name == "_ENV") throw std::runtime_error("a local named _ENV is not supported by the bytecode VM");
+    int decl = nextDecl++;
+    bool isBoxed = boxed.count(decl) > 0;
+    fs->actives.push_back(LocalVar{name, reg, decl, isBoxed});
+    // Captured locals live in a box so closures and the declaring function share one slot
+    if (isBoxed) emit(Opcode::NewBox, reg);
+}
+
+BytecodeCompiler::Variable BytecodeCompiler::resolve(FuncState* state, const std::string& name) {
+    // Globals are read from the VM's own environment, so code naming _ENV runs through load() instead
+    if (name == "_ENV") throw std::runtime_error("_ENV is not supported by the bytecode VM");
+    Variable var;
+    for (auto it = state->actives.rbegin(); it != state->actives.rend(); ++it) {
+        if (it->name == name) {
+            var.kind = Variable::Local;
+            var.index = it->reg;
+            var.decl = it->decl;
+            var.boxed = it->boxed;
+            return var;
+        }
+    }
+    for (size_t i = 0; i < state->upvalueNames.size(); ++i) {
+        if (state->upvalueNames[i] == name) return state->upvalueVars[i];
+    }
+    if (!state->parent) return var;
+
+    FuncState* parent = state->parent;
+    bool fromRegister = false;
+    int index = 0;
+    for (auto it = parent->actives.rbegin(); it != parent->actives.rend(); ++it) {
+        if (it->name == name) {
+            captured.insert(it->decl);
+            // A local function referring to itself is captured before its value exists
+            if (initializing.count(it->decl)) assigned.insert(it->decl);
+            fromRegister = true;
+            index = it->reg;
+            var.decl = it->decl;
+            var.constant = !it->boxed;
+            break;
+        }
+    }
+    if (!fromRegister) {
+        Variable outer = resolve(parent, name);
+        if (outer.kind == Variable::Global) return outer;
+        index = outer.index;
+        var.decl = outer.decl;
+        var.constant = outer.constant;
+    }
+
+    state->proto->upvalues.emplace_back(fromRegister, index);
+    state->upvalueNames.push_back(name);
+    var.kind = Variable::Upvalue;
+    var.index = static_cast<int>(state->upvalueNames.size());
+    state->upvalueVars.push_back(var);
+    return var;
+}
+
+void BytecodeCompiler::markAssigned(const Variable& var) {
+    if (var.kind != Variable::Global) assigned.insert(var.decl);
+}
+
+void BytecodeCompiler::compileBlock(const Block& block) {
+    for (const auto& stat : block.stats) {
+        compileStat(*stat);
+    }
+}
+
+void BytecodeCompiler::compileStat(const Stat& stat) {
+    int save = fs->freeReg;
+
+    switch (stat.kind) {
+        case StatKind::Local:
+            compileLocal(stat);
+            return;
+
+        case StatKind::LocalFunction: {
+            int reg = allocReg();
+            activate(stat.names[0], reg);
+            int decl = fs->actives.back().decl;
+            initializing.insert(decl);
+            if (fs->actives.back().boxed) {
+                int temp = allocReg();
+                emit(Opcode::Closure, temp, compileFunction(*stat.func));
+                emit(Opcode::SetBox, reg, temp);
+                fs->freeReg = reg + 1;
+            } else {
+                emit(Opcode::Closure, reg, compileFunction(*stat.func));
+            }
+            initializing.erase(decl);
+            return;
+        }
+
+        case StatKind::Function: {
+            Expr value(ExprKind::Function, stat.line);
+            value.func = stat.func;
+            store(*stat.targets[0], value);
+            break;
+        }
+
+        case StatKind::Assign:
+            compileAssign(stat);
+            break;
+
+        case StatKind::Call:
+            compileCall(*stat.expr, allocReg(), 0);
+            break;
+
+        case StatKind::Do:
+            enterScope();
+            compileBlock(*stat.blocks[0]);
+            leaveScope();
+            break;
+
+        case StatKind::While: {
+            fs->loops.emplace_back();
+            fs->loopDepth++;
+            int start = here();
+            std::vector<int> exits;
+            condJump(*stat.exprs[0], false, exits);
+            compileLoopBody(*stat.blocks[0]);
+            emit(Opcode::Jmp, start);
+            fs->loopDepth--;
+            patchAll(exits, here());
+            patchAll(fs->loops.back(), here());
+            fs->loops.pop_back();
+            break;
+        }
+
+        case StatKind::Repeat: {
+            fs->loops.emplace_back();
+            fs->loopDepth++;
+            int start = here();
+            // The condition can see the body's locals
+            enterScope();
+            compileBlock(*stat.blocks[0]);
+            std::vector<int> again;
+            condJump(*stat.exprs[0], false, again);
+            patchAll(again, start);
+            leaveScope();
+            fs->loopDepth--;
+            patchAll(fs->loops.back(), here());
+            fs->loops.pop_back();
+            break;
+        }
+
+        case StatKind::If:
+            compileIf(stat);
+            break;
+
+        case StatKind::NumericFor:
+            compileNumericFor(stat);
+            break;
+
+        case StatKind::GenericFor:
+            compileGenericFor(stat);
+            break;
+
+        case StatKind::Return:
+            compileReturn(stat);
+            break;
+
+        case StatKind::Break:
+            if (fs->loops.empty()) throw std::runtime_error("line " + std::to_string(stat.line) + ": break outside a loop");
+            fs->loops.back().push_back(emit(Opcode::Jmp, -1));
+            break;
+
+        case StatKind::Goto:
+        case StatKind::Label:
+            throw std::runtime_error("line " + std::to_string(stat.line) + ": goto is not supported by the bytecode VM");
+    }
+
+    fs->freeReg = save;
+}
+
+void BytecodeCompiler::compileLoopBody(const Block& block) {
+    enterScope();
+    compileBlock(block);
+    leaveScope();
+}
+
+void BytecodeCompiler::compileLocal(const Stat& stat) {
+    for (const auto& attrib : stat.attribs) {
+        if (attrib == "close") throw std::runtime_error("line " + std::to_string(stat.line) + ": to-be-closed variables are not supported by the bytecode VM");
+    }
+
+    int base = fs->freeReg;
+    int count = static_cast<int>(stat.names.size());
+    exprListToRegs(stat.exprs, base, count);
+    for (int i = 0; i < count; ++i) {
+        activate(stat.names[i], base + i);
+    }
+    fs->freeReg = base + count;
+}
+
+void BytecodeCompiler::compileAssign(const Stat& stat) {
+    if (stat.targets.size() == 1 && stat.exprs.size() == 1) {
+        store(*stat.targets[0], *stat.exprs[0]);
+        return;
+    }
+
+    // Table and key operands are copied out before any value is assigned
+    int save = fs->freeReg;
+    std::vector<std::pair<int, int>> prefixes;
+    for (const auto& target : stat.targets) {
+        if (target->kind != ExprKind::Index) {
+            prefixes.emplace_back(0, 0);
+            continue;
+        }
+        int obj = allocReg();
+        exprToReg(*target->lhs, obj);
+        int key;
+        if (target->rhs->kind == ExprKind::String) {
+            key = -stringConstant(target->rhs->value);
+        } else {
+            key = allocReg();
+            exprToReg(*target->rhs, key);
+        }
+        prefixes.emplace_back(obj, key);
+    }
+
+    int base = fs->freeReg;
+    exprListToRegs(stat.exprs, base, static_cast<int>(stat.targets.size()));
+
+    for (size_t i = 0; i < stat.targets.size(); ++i) {
+        const Expr& target = *stat.targets[i];
+        int value = base + static_cast<int>(i);
+        if (target.kind == ExprKind::Index) {
+            auto [obj, key] = prefixes[i];
+            if (key < 0) {
+                emit(Opcode::SetField, obj, -key, value);
+            } else {
+                emit(Opcode::SetTable, obj, key, value);
+            }
+            continue;
+        }
+
+        Variable var = resolve(fs, target.value);
+        markAssigned(var);
+        if (var.kind == Variable::Local) {
+            emit(var.boxed ? Opcode::SetBox : Opcode::Move, var.index, value);
+        } else if (var.kind == Variable::Upvalue) {
+            emit(Opcode::SetUpval, value, var.index);
+        } else {
+            emit(Opcode::SetGlobal, value, stringConstant(target.value));
+        }
+    }
+    fs->freeReg = save;
+}
+
+void BytecodeCompiler::compileIf(const Stat& stat) {
+    std::vector<int> ends;
+    bool hasElse = stat.blocks.size() > stat.exprs.size();
+
+    for (size_t i = 0; i < stat.exprs.size(); ++i) {
+        std::vector<int> next;
+        condJump(*stat.exprs[i], false, next);
+        enterScope();
+        compileBlock(*stat.blocks[i]);
+        leaveScope();
+        if (i + 1 < stat.exprs.size() || hasElse) {
+            ends.push_back(emit(Opcode::Jmp, -1));
+        }
+        patchAll(next, here());
+    }
+    if (hasElse) {
+        enterScope();
+        compileBlock(*stat.blocks.back());
+        leaveScope();
+    }
+    patchAll(ends, here());
+}
+
+void BytecodeCompiler::compileNumericFor(const Stat& stat) {
+    int base = allocReg(3);
+    exprToReg(*stat.exprs[0], base);
+    exprToReg(*stat.exprs[1], base + 1);
+    if (stat.exprs.size() > 2) {
+        exprToReg(*stat.exprs[2], base + 2);
+    } else {
+        Constant one;
+        one.type = Constant::Number;
+        one.value = "1";
+        emit(Opcode::LoadK, base + 2, constant(one));
+    }
+
+    int prep = emit(Opcode::ForPrep, base, -1);
+    allocReg();
+    fs->loops.emplace_back();
+    fs->loopDepth++;
+
+    int body = here();
+    enterScope();
+    activate(stat.names[0], base + 3);
+    compileBlock(*stat.blocks[0]);
+    leaveScope();
+    emit(Opcode::ForLoop, base, body);
+
+    fs->loopDepth--;
+    patch(prep, here());
+    patchAll(fs->loops.back(), here());
+    fs->loops.pop_back();
+}
+
+void BytecodeCompiler::compileGenericFor(const Stat& stat) {
+    int base = fs->freeReg;
+    exprListToRegs(stat.exprs, base, 3);
+    fs->freeReg = base + 3;
+    int count = static_cast<int>(stat.names.size());
+    int vars = allocReg(count);
+
+    int jump = emit(Opcode::Jmp, -1);
+    fs->loops.emplace_back();
+    fs->loopDepth++;
+
+    int body = here();
+    enterScope();
+    for (int i = 0; i < count; ++i) {
+        activate(stat.names[i], vars + i);
+    }
+    compileBlock(*stat.blocks[0]);
+    leaveScope();
+
+    patch(jump, here());
+    emit(Opcode::TForLoop, base, count, body);
+
+    fs->loopDepth--;
+    patchAll(fs->loops.back(), here());
+    fs->loops.pop_back();
+}
+
+void BytecodeCompiler::compileReturn(const Stat& stat) {
+    const auto& exprs = stat.exprs;
+    if (exprs.empty()) {
+        emit(Opcode::Return, 0, 1);
+        return;
+    }
+
+    const Expr& last = *exprs.back();
+    if (exprs.size() == 1 && (last.kind == ExprKind::Call || last.kind == ExprKind::Method)) {
+        compileCall(last, allocReg(), -1, true);
+        return;
+    }
+    if (exprs.size() == 1 && !isMulti(last)) {
+        emit(Opcode::Return, exprToAnyReg(last), 2);
+        return;
+    }
+
+    int base = fs->freeReg;
+    bool multi = isMulti(last);
+    int count = static_cast<int>(exprs.size());
+    exprListToRegs(exprs, base, multi ? -1 : count);
+    emit(Opcode::Return, base, multi ? 0 : count + 1);
+}
+
+int BytecodeCompiler::compileFunction(const Function& func) {
+    FuncState child;
+    child.parent = fs;
+    child.proto = std::make_shared<Proto>();
+    child.proto->numParams = static_cast<int>(func.params.size());
+    child.proto->vararg = func.vararg;
+    fs = &child;
+
+    enterScope();
+    for (const auto& param : func.params) {
+        activate(param, allocReg());
+    }
+    compileBlock(*func.body);
+    leaveScope();
+    emit(Opcode::Return, 0, 1);
+
+    // The body was compiled only to resolve the upvalues the native function is created with. A native function takes
+    // its inner functions along, so one holding a max function stays in the interpreter.
+    Annotations::Tier tier = Annotations::tierOf(func);
+    bool light = tier == Annotations::Tier::Fast || tier == Annotations::Tier::None ||
+                 (maxOnly && tier == Annotations::Tier::Default);
+    if (native && light && !Annotations::contains(func, Annotations::Tier::Max)) {
+        child.proto->native = nativeSource(func, child);
+        child.proto->code.clear();
+        child.proto->constants.clear();
+        child.proto->protos.clear();
+    }
+
+    fs = child.parent;
+    fs->proto->protos.push_back(child.proto);
+    return static_cast<int>(fs->proto->protos.size());
+}
+
+// Replaces reads and writes of boxed upvalues, by name wherever no local shadows them, with box[1]
+using BoxNames = std::map<std::string, std::string>;
+static void unboxBlock(Block& block, const BoxNames& boxes, std::vector<std::string>& locals, ExprPtr* until = nullptr);
+
+static void unboxExpr(ExprPtr& expr, const BoxNames& boxes, std::vector<std::string>& locals) {
+    if (expr->kind == ExprKind::Name) {
+        auto box = boxes.find(expr->value);
+        if (box == boxes.end() || std::find(locals.begin(), locals.end(), expr->value) != locals.end()) return;
+        auto name = std::make_shared<Expr>(ExprKind::Name, expr->line);
+        name->value = box->second;
+        auto slot = std::make_shared<Expr>(ExprKind::Number, expr->line);
+        slot->value = "1";
+        expr = std::make_shared<Expr>(ExprKind::Index, expr->line);
+        expr->lhs = name;
+        expr->rhs = slot;
+        return;
+    }
+    if (expr->func) {
+        size_t mark = locals.size();
+        locals.insert(locals.end(), expr->func->params.begin(), expr->func->params.end());
+        unboxBlock(*expr->func->body, boxes, locals);
+        locals.resize(mark);
+        return;
+    }
+    AstWalker::children(*expr, [&](ExprPtr& child) { unboxExpr(child, boxes, locals); }, [](BlockPtr&) {});
+}
+
+static void unboxStat(StatPtr& stat, const BoxNames& boxes, std::vector<std::string>& locals) {
+    auto visit = [&](ExprPtr& expr) { unboxExpr(expr, boxes, locals); };
+    size_t mark = locals.size();
+    switch (stat->kind) {
+        case StatKind::Local:
+            for (auto& expr : stat->exprs) visit(expr);
+            locals.insert(locals.end(), stat->names.begin(), stat->names.end());
+            return;
+        case StatKind::LocalFunction: {
+            locals.push_back(stat->names[0]);
+            auto value = std::make_shared<Expr>(ExprKind::Function, stat->line);
+            value->func = stat->func;
+            visit(value);
+            return;
+        }
+        case StatKind::Function: {
+            // `function box[1].f()` is not valid Lua, so a function stored through a box becomes an assignment
+            auto value = std::make_shared<Expr>(ExprKind::Function, stat->line);
+            value->func = stat->func;
+            ExprPtr root = stat->targets[0];
+            while (root->kind == ExprKind::Index) root = root->lhs;
+            visit(stat->targets[0]);
+            visit(value);
+            if (boxes.count(root->value) && std::find(locals.begin(), locals.end(), root->value) == locals.end()) {
+                auto assign = std::make_shared<Stat>(StatKind::Assign, stat->line);
+                assign->targets.push_back(stat->targets[0]);
+                assign->exprs.push_back(value);
+                stat = assign;
+            }
+            return;
+        }
+        case StatKind::Repeat:
+            unboxBlock(*stat->blocks[0], boxes, locals, &stat->exprs[0]);
+            return;
+        case StatKind::NumericFor:
+        case StatKind::GenericFor:
+            for (auto& expr : stat->exprs) visit(expr);
+            locals.insert(locals.end(), stat->names.begin(), stat->names.end());
+            unboxBlock(*stat->blocks[0], boxes, locals);
+            locals.resize(mark);
+            return;
+        default:
+            AstWalker::children(*stat, visit, [&](BlockPtr& block) { unboxBlock(*block, boxes, locals); });
+            return;
+    }
+}
+
+static void unboxBlock(Block& block, const BoxNames& boxes, std::vector<std::string>& locals, ExprPtr* until) {
+    size_t mark = locals.size();
+    for (auto& stat : block.stats) unboxStat(stat, boxes, locals);
+    if (until) unboxExpr(*until, boxes, locals);
+    locals.resize(mark);
+}
+
+std::string BytecodeCompiler::nativeSource(const Function& func, const FuncState& state) const {
+    // Printed and parsed again, so the rewrite works on a copy the rest of the compilation never sees
+    auto copy = std::make_shared<Function>(func);
+    copy->annotation.clear();
+    Block wrapper;
+    auto ret = std::make_shared<Stat>(StatKind::Return);
+    ret->exprs.push_back(std::make_shared<Expr>(ExprKind::Function));
+    ret->exprs[0]->func = copy;
+    wrapper.stats.push_back(ret);
+    LuaParser parser(LuaPrinter::print(wrapper), target);
+    BlockPtr chunk = parser.parse();
+
+    // Captures by value keep their names; assigned ones arrive as boxes
+    BoxNames boxes;
+    std::string header;
+    for (size_t i = 0; i < state.upvalueNames.size(); ++i) {
+        std::string name = state.upvalueNames[i];
+        if (!state.upvalueVars[i].constant) {
+            name = boxes[name] = "__box" + std::to_string(i + 1);
+        }
+        header += (i > 0 ? ", " : "local ") + name;
+    }
+    std::vector<std::string> locals;
+    unboxBlock(*chunk, boxes, locals);
+    return (header.empty() ? "" : header + " = ...\n") + LuaPrinter::print(*chunk);
+}
+
+void BytecodeCompiler::exprListToRegs(const std::vector<ExprPtr>& exprs, int base, int want) {
+    // base must be the first free register; want < 0 keeps every result of a trailing call or '...'
+    int count = static_cast<int>(exprs.size());
+    for (int i = 0; i < count; ++i) {
+        const Expr& expr = *exprs[i];
+        if (i == count - 1 && isMulti(expr)) {
+            int results = want < 0 ? -1 : std::max(want - i, 0);
+            fs->freeReg = base + i;
+            exprToMulti(expr, base + i, results);
+            fs->freeReg = base + std::max(want, i);
+            return;
+        }
+        int reg = allocReg();
+        exprToReg(expr, reg);
+        fs->freeReg = reg + 1;
+    }
+
+    if (want < 0) return;
+    if (count < want) {
+        emit(Opcode::LoadNil, base + count, want - count);
+    }
+    fs->freeReg = base + want;
+}
+
+void BytecodeCompiler::exprToMulti(const Expr& expr, int base, int results) {
+    if (expr.kind == ExprKind::Vararg) {
+        emit(Opcode::Vararg, base, results + 1);
+        fs->freeReg = base + std::max(results, 0);
+        return;
+    }
+    compileCall(expr, base, results);
+}
+
+void BytecodeCompiler::compileCall(const Expr& expr, int base, int results, bool tail) {
+    fs->freeReg = base + 1;
+    int args = static_cast<int>(expr.args.size());
+
+    exprToReg(*expr.lhs, base);
+    if (expr.kind == ExprKind::Method) {
+        allocReg();
+        emit(Opcode::Self, base, base, stringConstant(expr.value));
+        ++args;
+    }
+
+    bool multi = !expr.args.empty() && isMulti(*expr.args.back());
+    exprListToRegs(expr.args, fs->freeReg, multi ? -1 : static_cast<int>(expr.args.size()));
+    int b = multi ? 0 : args + 1;
+
+    if (tail) {
+        emit(Opcode::TailCall, base, b);
+    } else {
+        emit(Opcode::Call, base, b, results + 1);
+    }
+    fs->freeReg = base + std::max(results, 0);
+}
+
+void BytecodeCompiler::compileTable(const Expr& expr, int reg) {
+    emit(Opcode::NewTable, reg);
+    int pending = 0, stored = 0;
+
+    for (size_t i = 0; i < expr.fields.size(); ++i) {
+        const TableField& field = expr.fields[i];
+        if (field.kind == TableField::Positional) {
+            if (i + 1 == expr.fields.size() && isMulti(*field.value)) {
+                exprToMulti(*field.value, reg + 1 + pending, -1);
+                emit(Opcode::SetList, reg, 0, stored);
+                pending = 0;
+                break;
+            }
+            exprToReg(*field.value, allocReg());
+            if (++pending == SETLIST_BATCH) {
+                emit(Opcode::SetList, reg, pending, stored);
+                stored += pending;
+                pending = 0;
+                fs->freeReg = reg + 1;
+            }
+            continue;
+        }
+
+        int save = fs->freeReg;
+        if (field.kind == TableField::Named || field.key->kind == ExprKind::String) {
+            int key = stringConstant(field.kind == TableField::Named ? field.name : field.key->value);
+            emit(Opcode::SetField, reg, key, exprToAnyReg(*field.value));
+        } else {
+            int key = exprToAnyReg(*field.key);
+            emit(Opcode::SetTable, reg, key, exprToAnyReg(*field.value));
+        }
+        fs->freeReg = save;
+    }
+
+    if (pending > 0) {
+        emit(Opcode::SetList, reg, pending, stored);
+    }
+    fs->freeReg = reg + 1;
+}
+
+void BytecodeCompiler::compileBinary(const Expr& expr, int reg) {
+    const std::string& op = expr.value;
+    int save = fs->freeReg;
+
+    if (op == "and" || op == "or") {
+        exprToReg(*expr.lhs, reg);
+        int skip = emit(op == "and" ? Opcode::JF : Opcode::JT, reg, -1);
+        exprToReg(*expr.rhs, reg);
+        patch(skip, here());
+        return;
+    }
+
+    int lhs = exprToAnyReg(*expr.lhs);
+    if (isComparison(op)) {
+        int rhs = exprToAnyReg(*expr.rhs);
+        if (op == "==") emit(Opcode::Eq, reg, lhs, rhs);
+        else if (op == "~=") emit(Opcode::Ne, reg, lhs, rhs);
+        else if (op == "<") emit(Opcode::Lt, reg, lhs, rhs);
+        else if (op == "<=") emit(Opcode::Le, reg, lhs, rhs);
+        else if (op == ">") emit(Opcode::Lt, reg, rhs, lhs);
+        else emit(Opcode::Le, reg, rhs, lhs);
+        fs->freeReg = save;
+        return;
+    }
+
+    static const std::map<std::string, Opcode> withConstant = {
+        {"+", Opcode::AddK}, {"-", Opcode::SubK}, {"*", Opcode::MulK}, {"/", Opcode::DivK}, {"%", Opcode::ModK},
+    };
+    Constant k;
+    auto it = withConstant.find(op);
+    if (it != withConstant.end() && constantOf(*expr.rhs, k) && k.type == Constant::Number) {
+        emit(it->second, reg, lhs, constant(k));
+    } else {
+        emit(arithOp(op), reg, lhs, exprToAnyReg(*expr.rhs));
+    }
+    fs->freeReg = save;
+}
+
+void BytecodeCompiler::exprToReg(const Expr& expr, int reg) {
+    switch (expr.kind) {
+        case ExprKind::Nil:
+            emit(Opcode::LoadNil, reg, 1);
+            return;
+        case ExprKind::True:
+        case ExprKind::False:
+            emit(Opcode::LoadBool, reg, expr.kind == ExprKind::True ? 1 : 0);
+            return;
+        case ExprKind::Number:
+        case ExprKind::String: {
+            Constant k;
+            constantOf(expr, k);
+            emit(Opcode::LoadK, reg, constant(k));
+            return;
+        }
+        case ExprKind::Vararg:
+            emit(Opcode::Vararg, reg, 2);
+            return;
+        case ExprKind::Function:
+            emit(Opcode::Closure, reg, compileFunction(*expr.func));
+            return;
+        case ExprKind::Paren:
+            exprToReg(*expr.lhs, reg);
+            return;
+
+        case ExprKind::Name: {
+            Variable var = resolve(fs, expr.value);
+            if (var.kind == Variable::Local) {
+                if (var.boxed) emit(Opcode::GetBox, reg, var.index);
+                else if (var.index != reg) emit(Opcode::Move, reg, var.index);
+            } else if (var.kind == Variable::Upvalue) {
+                emit(var.constant ? Opcode::GetConstUpval : Opcode::GetUpval, reg, var.index);
+            } else {
+                emit(Opcode::GetGlobal, reg, stringConstant(expr.value));
+            }
+            return;
+        }
+
+        case ExprKind::Index: {
+            // Field reads of globals and upvalues (math.floor, M.helper) take one instruction
+            if (expr.lhs->kind == ExprKind::Name && expr.rhs->kind == ExprKind::String) {
+                Variable var = resolve(fs, expr.lhs->value);
+                if (var.kind == Variable::Global) {
+                    emit(Opcode::GetGlobalField, reg, stringConstant(expr.lhs->value), stringConstant(expr.rhs->value));
+                    return;
+                }
+                if (var.kind == Variable::Upvalue) {
+                    emit(var.constant ? Opcode::GetConstUpvalField : Opcode::GetUpvalField, reg, var.index, stringConstant(expr.rhs->value));
+                    return;
+                }
+            }
+            int save = fs->freeReg;
+            int obj = exprToAnyReg(*expr.lhs);
+            if (expr.rhs->kind == ExprKind::String) {
+                emit(Opcode::GetField, reg, obj, stringConstant(expr.rhs->value));
+            } else {
+                emit(Opcode::GetTable, reg, obj, exprToAnyReg(*expr.rhs));
+            }
+            fs->freeReg = save;
+            return;
+        }
+
+        case ExprKind::Call:
+        case ExprKind::Method:
+        case ExprKind::Table: {
+            // Both need reg at the top of the stack so arguments and list items follow it
+            int target = reg;
+            if (reg != fs->freeReg - 1) target = allocReg();
+            if (expr.kind == ExprKind::Table) {
+                compileTable(expr, target);
+            } else {
+                compileCall(expr, target, 1);
+            }
+            if (target != reg) {
+                emit(Opcode::Move, reg, target);
+                fs->freeReg = target;
+            }
+            return;
+        }
+
+        case ExprKind::Unary: {
+            Constant k;
+            if (constantOf(expr, k)) {
+                emit(Opcode::LoadK, reg, constant(k));
+                return;
+            }
+            int save = fs->freeReg;
+            int operandReg = exprToAnyReg(*expr.lhs);
+            Opcode op = Opcode::Unm;
+            if (expr.value == "not") op = Opcode::Not;
+            else if (expr.value == "#") op = Opcode::Len;
+            else if (expr.value == "~") op = Opcode::BNot;
+            emit(op, reg, operandReg);
+            fs->freeReg = save;
+            return;
+        }
+
+        case ExprKind::Binary:
+            compileBinary(expr, reg);
+            return;
+    }
+}
+
+int BytecodeCompiler::exprToAnyReg(const Expr& expr) {
+    if (expr.kind == ExprKind::Name) {
+        Variable var = resolve(fs, expr.value);
+        if (var.kind == Variable::Local && !var.boxed) return var.index;
+    }
+    int reg = allocReg();
+    exprToReg(expr, reg);
+    return reg;
+}
+
+void BytecodeCompiler::store(const Expr& target, const Expr& value) {
+    int save = fs->freeReg;
+
+    if (target.kind == ExprKind::Index) {
+        int obj = exprToAnyReg(*target.lhs);
+        if (target.rhs->kind == ExprKind::String) {
+            int key = stringConstant(target.rhs->value);
+            emit(Opcode::SetField, obj, key, exprToAnyReg(value));
+        } else {
+            int key = exprToAnyReg(*target.rhs);
+            emit(Opcode::SetTable, obj, key, exprToAnyReg(value));
+        }
+        fs->freeReg = save;
+        return;
+    }
+
+    Variable var = resolve(fs, target.value);
+    markAssigned(var);
+    if (var.kind == Variable::Local && !var.boxed) {
+        if (writesEarly(value)) {
+            int temp = allocReg();
+            exprToReg(value, temp);
+            emit(Opcode::Move, var.index, temp);
+        } else {
+            exprToReg(value, var.index);
+        }
+    } else if (var.kind == Variable::Local) {
+        emit(Opcode::SetBox, var.index, exprToAnyReg(value));
+    } else if (var.kind == Variable::Upvalue) {
+        emit(Opcode::SetUpval, exprToAnyReg(value), var.index);
+    } else {
+        emit(Opcode::SetGlobal, exprToAnyReg(value), stringConstant(target.value));
+    }
+    fs->freeReg = save;
+}
+
+void BytecodeCompiler::condJump(const Expr& expr, bool jumpWhen, std::vector<int>& jumps) {
+    switch (expr.kind) {
+        case ExprKind::Paren:
+            condJump(*expr.lhs, jumpWhen, jumps);
+            return;
+        case ExprKind::Nil:
+        case ExprKind::False:
+            if (!jumpWhen) jumps.push_back(emit(Opcode::Jmp, -1));
+            return;
+        case ExprKind::True:
+        case ExprKind::Number:
+        case ExprKind::String:
+            if (jumpWhen) jumps.push_back(emit(Opcode::Jmp, -1));
+            return;
+        case ExprKind::Unary:
+            if (expr.value == "not") {
+                condJump(*expr.lhs, !jumpWhen, jumps);
+                return;
+            }
+            break;
+        case ExprKind::Binary: {
+            const std::string& op = expr.value;
+            if (op == "and" || op == "or") {
+                // Short-circuit straight into jumps; no boolean is materialized
+                bool shortValue = op == "or";
+                if (jumpWhen == shortValue) {
+                    condJump(*expr.lhs, jumpWhen, jumps);
+                    condJump(*expr.rhs, jumpWhen, jumps);
+                } else {
+                    std::vector<int> skip;
+                    condJump(*expr.lhs, shortValue, skip);
+                    condJump(*expr.rhs, jumpWhen, jumps);
+                    patchAll(skip, here());
+                }
+                return;
+            }
+            if (isComparison(op)) {
+                static const std::map<std::string, std::string> mirror = {
+                    {"<", ">"}, {">", "<"}, {"<=", ">="}, {">=", "<="}, {"==", "=="}, {"~=", "~="},
+                };
+                const Expr* lhs = expr.lhs.get();
+                const Expr* rhs = expr.rhs.get();
+                std::string rel = op;
+                Constant lk, rk;
+                bool lhsConst = constantOf(*lhs, lk);
+                bool rhsConst = constantOf(*rhs, rk);
+                if (lhsConst && !rhsConst) {
+                    std::swap(lhs, rhs);
+                    std::swap(lk, rk);
+                    std::swap(lhsConst, rhsConst);
+                    rel = mirror.at(rel);
+                }
+
+                int save = fs->freeReg;
+                int a = exprToAnyReg(*lhs);
+                if (rhsConst && !lhsConst) {
+                    static const std::map<std::string, std::pair<Opcode, Opcode>> withConstant = {
+                        {"==", {Opcode::JEqK, Opcode::JNeK}}, {"~=", {Opcode::JNeK, Opcode::JEqK}},
+                        {"<", {Opcode::JLtK, Opcode::JNLtK}}, {"<=", {Opcode::JLeK, Opcode::JNLeK}},
+                        {">", {Opcode::JGtK, Opcode::JNGtK}}, {">=", {Opcode::JGeK, Opcode::JNGeK}},
+                    };
+                    auto ops = withConstant.at(rel);
+                    jumps.push_back(emit(jumpWhen ? ops.first : ops.second, a, constant(rk), -1));
+                } else {
+                    static const std::map<std::string, std::pair<Opcode, Opcode>> withRegister = {
+                        {"==", {Opcode::JEq, Opcode::JNe}}, {"~=", {Opcode::JNe, Opcode::JEq}},
+                        {"<", {Opcode::JLt, Opcode::JNLt}}, {"<=", {Opcode::JLe, Opcode::JNLe}},
+                    };
+                    int b = exprToAnyReg(*rhs);
+                    if (rel == ">" || rel == ">=") {
+                        std::swap(a, b);
+                        rel = rel == ">" ? "<" : "<=";
+                    }
+                    auto ops = withRegister.at(rel);
+                    jumps.push_back(emit(jumpWhen ? ops.first : ops.second, a, b, -1));
+                }
+                fs->freeReg = save;
+                return;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    int save = fs->freeReg;
+    int reg = exprToAnyReg(expr);
+    jumps.push_back(emit(jumpWhen ? Opcode::JT : Opcode::JF, reg, -1));
+    fs->freeReg = save;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "Bytecode.hpp"
+#include "../Target.hpp"
+#include "../parser/LuaAst.hpp"
+
+// Compiles a parsed chunk to register bytecode; throws std::runtime_error for unsupported constructs
+class BytecodeCompiler {
+private:
+    struct LocalVar {
+        std::string name;
+        int reg;
+        int decl;
+        bool boxed;
+    };
+
+    struct Variable {
+        enum Kind { Local, Upvalue, Global } kind = Global;
+        int index = 0;
+        int decl = -1;
+        bool boxed = false;
+        // Upvalue holding the value itself rather than a box
+        bool constant = false;
+    };
+
+    struct FuncState {
+        FuncState* parent = nullptr;
+        ProtoPtr proto;
+        std::vector<LocalVar> actives;
+        std::vector<std::pair<size_t, int>> scopes;
+        std::vector<std::string> upvalueNames;
+        std::vector<Variable> upvalueVars;
+        std::vector<std::vector<int>> loops;
+        std::map<std::string, int> constantIndex;
+        int freeReg = 1;
+        int loopDepth = 0;
+    };
+
+    FuncState* fs;
+    int nextDecl;
+    Target::Kind target;
+    bool native;
+    bool maxOnly;
+    // Declarations captured by inner functions; found by the first pass, boxed by the second when they are also assigned.
+    // Captured declarations that are never assigned after initialization are copied into closures by value.
+    std::set<int> captured;
+    std::set<int> assigned;
+    std::set<int> initializing;
+    std::set<int> boxed;
+
+    BytecodeCompiler();
+    ProtoPtr compileMain(const Block& chunk);
+
+    int emit(Opcode op, int a = 0, int b = 0, int c = 0);
+    int here() const;
+    void patch(int jump, int target);
+    void patchAll(const std::vector<int>& jumps, int target);
+    int allocReg(int count = 1);
+    int constant(const Constant& value);
+    int stringConstant(const std::string& value);
+    static bool constantOf(const Expr& expr, Constant& out);
+    static bool isMulti(const Expr& expr);
+
+    void enterScope();
+    void leaveScope();
+    void activate(const std::string& name, int reg);
+    Variable resolve(FuncState* state, const std::string& name);
+    void markAssigned(const Variable& var);
+
+    void compileBlock(const Block& block);
+    void compileStat(const Stat& stat);
+    void compileLocal(const Stat& stat);
+    void compileAssign(const Stat& stat);
+    void compileIf(const Stat& stat);
+    void compileNumericFor(const Stat& stat);
+    void compileGenericFor(const Stat& stat);
+    void compileReturn(const Stat& stat);
+    void compileLoopBody(const Block& block);
+    int compileFunction(const Function& func);
+    std::string nativeSource(const Function& func, const FuncState& state) const;
+
+    void exprToReg(const Expr& expr, int reg);
+    int exprToAnyReg(const Expr& expr);
+    void exprToMulti(const Expr& expr, int base, int results);
+    void exprListToRegs(const std::vector<ExprPtr>& exprs, int base, int want);
+    void compileCall(const Expr& expr, int base, int results, bool tail = false);
+    void compileTable(const Expr& expr, int reg);
+    void compileBinary(const Expr& expr, int reg);
+    void store(const Expr& target, const Expr& value);
+    void condJump(const Expr& expr, bool jumpWhen, std::vector<int>& jumps);
+
+public:
+    // When the target has load(), functions tagged fast or none are shipped as source and run outside the interpreter;
+    // with `maxOnly` as well, so are all functions but the ones tagged max
+    static ProtoPtr compile(const Block& chunk, Target::Kind target, bool maxOnly = false);
+    static int jumpOperand(Opcode op);
+};
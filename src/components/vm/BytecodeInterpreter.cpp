@@ -0,0 +1,477 @@
+#include "BytecodeInterpreter.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "BytecodeCompiler.hpp"
+
+std::string BytecodeInterpreter::handler(Opcode op, Target::Kind target) {
+    // Lua 5.1 and LuaJIT have no integer division or bitwise operators; LuaJIT and Luau reach the bit ops through a library
+    if (target != Target::Lua54) {
+        switch (op) {
+            case Opcode::IDiv:
+                if (target != Target::Luau) return "R[a] = math.floor(R[b] / R[c])";
+                break;
+            case Opcode::BAnd:
+            case Opcode::BOr:
+            case Opcode::BXor:
+            case Opcode::Shl:
+            case Opcode::Shr:
+            case Opcode::BNot:
+                if (target == Target::Lua51) throw std::runtime_error("bitwise operators are not available on " + Target::name(target));
+                break;
+            default:
+                break;
+        }
+        switch (op) {
+            case Opcode::BAnd: return "R[a] = bitlib.band(R[b], R[c])";
+            case Opcode::BOr: return "R[a] = bitlib.bor(R[b], R[c])";
+            case Opcode::BXor: return "R[a] = bitlib.bxor(R[b], R[c])";
+            case Opcode::Shl: return "R[a] = bitlib.lshift(R[b], R[c])";
+            case Opcode::Shr: return "R[a] = bitlib.rshift(R[b], R[c])";
+            case Opcode::BNot: return "R[a] = bitlib.bnot(R[b])";
+            default: break;
+        }
+    }
+
+    switch (op) {
+        case Opcode::Move: return "R[a] = R[b]";
+        case Opcode::LoadK: return "R[a] = k[b]";
+        case Opcode::LoadNil: return "for i = a, a + b - 1 do R[i] = nil end";
+        case Opcode::LoadBool: return "R[a] = b ~= 0";
+        case Opcode::GetUpval: return "R[a] = upvals[b][1]";
+        case Opcode::GetConstUpval: return "R[a] = upvals[b]";
+        case Opcode::SetUpval: return "upvals[b][1] = R[a]";
+        case Opcode::GetBox: return "R[a] = R[b][1]";
+        case Opcode::SetBox: return "R[a][1] = R[b]";
+        case Opcode::NewBox: return "R[a] = {R[a]}";
+        case Opcode::GetGlobal: return "R[a] = env[k[b]]";
+        case Opcode::SetGlobal: return "env[k[b]] = R[a]";
+        case Opcode::GetTable: return "R[a] = R[b][R[c]]";
+        case Opcode::GetField: return "R[a] = R[b][k[c]]";
+        case Opcode::SetTable: return "R[a][R[b]] = R[c]";
+        case Opcode::SetField: return "R[a][k[b]] = R[c]";
+        case Opcode::NewTable: return "R[a] = {}";
+        case Opcode::SetList:
+            return "local t = R[a]\n"
+                   "if b == 0 then b = top - a end\n"
+                   "for i = 1, b do t[c + i] = R[a + i] end";
+        case Opcode::Self:
+            return "local obj = R[b]\n"
+                   "R[a + 1] = obj\n"
+                   "R[a] = obj[k[c]]";
+        case Opcode::Add: return "R[a] = R[b] + R[c]";
+        case Opcode::Sub: return "R[a] = R[b] - R[c]";
+        case Opcode::Mul: return "R[a] = R[b] * R[c]";
+        case Opcode::Div: return "R[a] = R[b] / R[c]";
+        case Opcode::Mod: return "R[a] = R[b] % R[c]";
+        case Opcode::Pow: return "R[a] = R[b] ^ R[c]";
+        case Opcode::IDiv: return "R[a] = R[b] // R[c]";
+        case Opcode::BAnd: return "R[a] = R[b] & R[c]";
+        case Opcode::BOr: return "R[a] = R[b] | R[c]";
+        case Opcode::BXor: return "R[a] = R[b] ~ R[c]";
+        case Opcode::Shl: return "R[a] = R[b] << R[c]";
+        case Opcode::Shr: return "R[a] = R[b] >> R[c]";
+        case Opcode::Concat: return "R[a] = R[b] .. R[c]";
+        case Opcode::AddK: return "R[a] = R[b] + k[c]";
+        case Opcode::SubK: return "R[a] = R[b] - k[c]";
+        case Opcode::MulK: return "R[a] = R[b] * k[c]";
+        case Opcode::DivK: return "R[a] = R[b] / k[c]";
+        case Opcode::ModK: return "R[a] = R[b] % k[c]";
+        case Opcode::Unm: return "R[a] = -R[b]";
+        case Opcode::Not: return "R[a] = not R[b]";
+        case Opcode::Len: return "R[a] = #R[b]";
+        case Opcode::BNot: return "R[a] = ~R[b]";
+        case Opcode::Eq: return "R[a] = R[b] == R[c]";
+        case Opcode::Ne: return "R[a] = R[b] ~= R[c]";
+        case Opcode::Lt: return "R[a] = R[b] < R[c]";
+        case Opcode::Le: return "R[a] = R[b] <= R[c]";
+        case Opcode::Jmp: return "pc = a";
+        case Opcode::JT: return "if R[a] then pc = b end";
+        case Opcode::JF: return "if not R[a] then pc = b end";
+        case Opcode::JEq: return "if R[a] == R[b] then pc = c end";
+        case Opcode::JNe: return "if R[a] ~= R[b] then pc = c end";
+        case Opcode::JLt: return "if R[a] < R[b] then pc = c end";
+        case Opcode::JNLt: return "if not (R[a] < R[b]) then pc = c end";
+        case Opcode::JLe: return "if R[a] <= R[b] then pc = c end";
+        case Opcode::JNLe: return "if not (R[a] <= R[b]) then pc = c end";
+        case Opcode::JEqK: return "if R[a] == k[b] then pc = c end";
+        case Opcode::JNeK: return "if R[a] ~= k[b] then pc = c end";
+        case Opcode::JLtK: return "if R[a] < k[b] then pc = c end";
+        case Opcode::JNLtK: return "if not (R[a] < k[b]) then pc = c end";
+        case Opcode::JLeK: return "if R[a] <= k[b] then pc = c end";
+        case Opcode::JNLeK: return "if not (R[a] <= k[b]) then pc = c end";
+        case Opcode::JGtK: return "if k[b] < R[a] then pc = c end";
+        case Opcode::JNGtK: return "if not (k[b] < R[a]) then pc = c end";
+        case Opcode::JGeK: return "if k[b] <= R[a] then pc = c end";
+        case Opcode::JNGeK: return "if not (k[b] <= R[a]) then pc = c end";
+        case Opcode::Call:
+            return "local fn = R[a]\n"
+                   "local last = b == 0 and top or a + b - 1\n"
+                   "if c == 2 then\n"
+                   "    if last == a then\n"
+                   "        R[a] = fn()\n"
+                   "    elseif last == a + 1 then\n"
+                   "        R[a] = fn(R[a + 1])\n"
+                   "    else\n"
+                   "        R[a] = fn(unpack(R, a + 1, last))\n"
+                   "    end\n"
+                   "elseif c == 1 then\n"
+                   "    if last == a + 1 then\n"
+                   "        fn(R[a + 1])\n"
+                   "    else\n"
+                   "        fn(unpack(R, a + 1, last))\n"
+                   "    end\n"
+                   "else\n"
+                   "    local results = pack(fn(unpack(R, a + 1, last)))\n"
+                   "    local n = c == 0 and results.n or c - 1\n"
+                   "    for i = 1, n do R[a + i - 1] = results[i] end\n"
+                   "    top = a + n - 1\n"
+                   "end";
+        case Opcode::TailCall:
+            return "return R[a](unpack(R, a + 1, b == 0 and top or a + b - 1))";
+        case Opcode::Return:
+            return "if b == 1 then return end\n"
+                   "if b == 2 then return R[a] end\n"
+                   "return unpack(R, a, b == 0 and top or a + b - 2)";
+        case Opcode::Vararg:
+            return "local n = b == 0 and nvarargs or b - 1\n"
+                   "for i = 1, n do R[a + i - 1] = varargs[i] end\n"
+                   "if b == 0 then top = a + n - 1 end";
+        case Opcode::Closure:
+            // Captures by value may be nil, so slots are numbered explicitly
+            return "local sub = protos[b]\n"
+                   "local desc, captured, n = sub[4], {}, 0\n"
+                   "for i = 1, #desc, 2 do\n"
+                   "    n = n + 1\n"
+                   "    if desc[i] == 1 then\n"
+                   "        captured[n] = R[desc[i + 1]]\n"
+                   "    else\n"
+                   "        captured[n] = upvals[desc[i + 1]]\n"
+                   "    end\n"
+                   "end\n"
+                   "if sub[8] then\n"
+                   "    R[a] = sub[8](unpack(captured, 1, n))\n"
+                   "else\n"
+                   "    R[a] = wrap(sub, captured)\n"
+                   "end";
+        case Opcode::ForPrep:
+            return "local init, limit, step = R[a], R[a + 1], R[a + 2]\n"
+                   "if type(init) ~= 'number' then error(\"'for' initial value must be a number\") end\n"
+                   "if type(limit) ~= 'number' then error(\"'for' limit must be a number\") end\n"
+                   "if type(step) ~= 'number' then error(\"'for' step must be a number\") end\n"
+                   "if step == 0 then error(\"'for' step is zero\") end\n"
+                   "if mathtype and (mathtype(init) == 'float' or mathtype(step) == 'float') then\n"
+                   "    init = init + 0.0\n"
+                   "    R[a] = init\n"
+                   "end\n"
+                   "if step > 0 and init <= limit or step < 0 and init >= limit then\n"
+                   "    R[a + 3] = init\n"
+                   "else\n"
+                   "    pc = b\n"
+                   "end";
+        case Opcode::ForLoop:
+            // The idx comparison stops integer loops that would wrap around
+            return "local idx, step = R[a], R[a + 2]\n"
+                   "local nxt = idx + step\n"
+                   "if step > 0 then\n"
+                   "    if nxt <= R[a + 1] and nxt > idx then\n"
+                   "        R[a] = nxt\n"
+                   "        R[a + 3] = nxt\n"
+                   "        pc = b\n"
+                   "    end\n"
+                   "elseif nxt >= R[a + 1] and nxt < idx then\n"
+                   "    R[a] = nxt\n"
+                   "    R[a + 3] = nxt\n"
+                   "    pc = b\n"
+                   "end";
+        case Opcode::TForLoop:
+            return "local fn = R[a]\n"
+                   "if b == 1 then\n"
+                   "    R[a + 3] = fn(R[a + 1], R[a + 2])\n"
+                   "elseif b == 2 then\n"
+                   "    R[a + 3], R[a + 4] = fn(R[a + 1], R[a + 2])\n"
+                   "else\n"
+                   "    local results = pack(fn(R[a + 1], R[a + 2]))\n"
+                   "    for i = 1, b do R[a + 2 + i] = results[i] end\n"
+                   "end\n"
+                   "local v = R[a + 3]\n"
+                   "if v ~= nil then\n"
+                   "    R[a + 2] = v\n"
+                   "    pc = c\n"
+                   "end";
+        case Opcode::GetGlobalField: return "R[a] = env[k[b]][k[c]]";
+        case Opcode::GetUpvalField: return "R[a] = upvals[b][1][k[c]]";
+        case Opcode::GetConstUpvalField: return "R[a] = upvals[b][k[c]]";
+        case Opcode::Count: break;
+    }
+    throw std::logic_error("no handler for opcode");
+}
+
+void BytecodeInterpreter::countOps(const Proto& proto, std::vector<double>& weights, Stats& stats) {
+    ++stats.functions;
+    if (!proto.native.empty()) ++stats.natives;
+    stats.instructions += proto.code.size();
+    for (const auto& ins : proto.code) {
+        // Instructions inside loops dominate dispatch, so they weigh more when shaping the tree
+        weights[static_cast<int>(ins.op)] += std::pow(8.0, std::min(ins.loopDepth, 3));
+        if (ins.op == Opcode::GetGlobalField || ins.op == Opcode::GetUpvalField || ins.op == Opcode::GetConstUpvalField) ++stats.fused;
+    }
+    for (const auto& child : proto.protos) {
+        countOps(*child, weights, stats);
+    }
+}
+
+std::unique_ptr<BytecodeInterpreter::Node> BytecodeInterpreter::buildTree(const std::vector<double>& weights, std::mt19937& gen) {
+    // Huffman tree over the opcodes in use: frequent handlers sit behind fewer comparisons
+    std::vector<std::unique_ptr<Node>> nodes;
+    for (size_t op = 0; op < weights.size(); ++op) {
+        if (weights[op] <= 0) continue;
+        auto leaf = std::make_unique<Node>();
+        leaf->weight = weights[op];
+        leaf->op = static_cast<int>(op);
+        nodes.push_back(std::move(leaf));
+    }
+
+    auto heavier = [](const std::unique_ptr<Node>& a, const std::unique_ptr<Node>& b) { return a->weight > b->weight; };
+    std::uniform_int_distribution<int> coin(0, 1);
+    while (nodes.size() > 1) {
+        std::sort(nodes.begin(), nodes.end(), heavier);
+        auto node = std::make_unique<Node>();
+        node->right = std::move(nodes.back());
+        nodes.pop_back();
+        node->left = std::move(nodes.back());
+        nodes.pop_back();
+        // Child order does not change the cost, so it is randomized along with the opcode numbering
+        if (coin(gen)) std::swap(node->left, node->right);
+        node->weight = node->left->weight + node->right->weight;
+        nodes.push_back(std::move(node));
+    }
+    return std::move(nodes.front());
+}
+
+void BytecodeInterpreter::numberLeaves(Node& node, std::vector<int>& numbering, int& next, int depth, double& weightedDepth) {
+    if (node.op >= 0) {
+        numbering[node.op] = next++;
+        weightedDepth += node.weight * depth;
+        return;
+    }
+    numberLeaves(*node.left, numbering, next, depth + 1, weightedDepth);
+    numberLeaves(*node.right, numbering, next, depth + 1, weightedDepth);
+}
+
+int BytecodeInterpreter::firstLeaf(const Node& node, const std::vector<int>& numbering) {
+    return node.op >= 0 ? numbering[node.op] : firstLeaf(*node.left, numbering);
+}
+
+void BytecodeInterpreter::emitTree(const Node& node, const std::vector<int>& numbering, Target::Kind target, int indent, std::stringstream& ss) {
+    std::string pad(indent * 4, ' ');
+    if (node.op >= 0) {
+        std::stringstream lines(handler(static_cast<Opcode>(node.op), target));
+        std::string line;
+        while (std::getline(lines, line)) {
+            ss << pad << line << "\n";
+        }
+        return;
+    }
+    ss << pad << "if op < " << firstLeaf(*node.right, numbering) << " then\n";
+    emitTree(*node.left, numbering, target, indent + 1, ss);
+    ss << pad << "else\n";
+    emitTree(*node.right, numbering, target, indent + 1, ss);
+    ss << pad << "end\n";
+}
+
+void BytecodeInterpreter::writeInt(std::string& out, long long value) {
+    if (value < 0) throw std::logic_error("negative bytecode operand");
+    do {
+        uint8_t byte = value % 128;
+        value /= 128;
+        out += static_cast<char>(value > 0 ? byte + 128 : byte);
+    } while (value > 0);
+}
+
+void BytecodeInterpreter::serialize(const Proto& proto, const std::vector<int>& numbering, std::string& out, std::vector<std::string>* bodies) {
+    writeInt(out, proto.numParams);
+    // 2 marks a native function, whose source follows
+    writeInt(out, !proto.native.empty() ? 2 : proto.vararg ? 1 : 0);
+    if (!proto.native.empty()) {
+        writeInt(out, proto.native.length());
+        out += proto.native;
+    }
+
+    writeInt(out, proto.code.size() * 4);
+    for (const auto& ins : proto.code) {
+        int operands[3] = {ins.a, ins.b, ins.c};
+        int target = BytecodeCompiler::jumpOperand(ins.op);
+        // Jump targets become positions in the flat code array
+        if (target >= 0) operands[target] = operands[target] * 4 + 1;
+        writeInt(out, numbering[static_cast<int>(ins.op)]);
+        for (int value : operands) {
+            writeInt(out, value);
+        }
+    }
+
+    writeInt(out, proto.constants.size());
+    for (const auto& k : proto.constants) {
+        writeInt(out, k.type);
+        if (k.type == Constant::Number || k.type == Constant::String) {
+            writeInt(out, k.value.length());
+            out += k.value;
+        }
+    }
+
+    writeInt(out, proto.protos.size());
+    for (const auto& child : proto.protos) {
+        if (bodies && child->native.empty()) {
+            // Lazy bodies are stored apart and referenced by index; the parent keeps only what closure creation needs
+            std::string body;
+            serialize(*child, numbering, body, bodies);
+            bodies->push_back(body);
+            writeInt(out, bodies->size());
+        } else {
+            // Native functions are needed when the closure is created, so they stay inline behind index 0
+            if (bodies) writeInt(out, 0);
+            serialize(*child, numbering, out, bodies);
+        }
+        writeInt(out, child->upvalues.size());
+        for (const auto& [fromRegister, index] : child->upvalues) {
+            writeInt(out, fromRegister ? 1 : 0);
+            writeInt(out, index);
+        }
+    }
+}
+
+std::string BytecodeInterpreter::generate(const Proto& main, std::string& program, std::vector<std::string>* bodies, Target::Kind target, Stats& stats) {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+
+    std::vector<double> weights(static_cast<int>(Opcode::Count), 0.0);
+    countOps(main, weights, stats);
+    std::unique_ptr<Node> tree = buildTree(weights, gen);
+
+    std::vector<int> numbering(weights.size(), -1);
+    int next = 0;
+    double weightedDepth = 0;
+    numberLeaves(*tree, numbering, next, 0, weightedDepth);
+    stats.opcodes = next;
+    stats.dispatchDepth = weightedDepth / tree->weight;
+
+    program.clear();
+    if (bodies) bodies->clear();
+    serialize(main, numbering, program, bodies);
+
+    std::stringstream ss;
+    ss << "local __vm_load\n";
+    ss << "do\n";
+    ss << "    local unpack = table.unpack or unpack\n";
+    ss << "    local pack = table.pack or function(...) return {n = select('#', ...), ...} end\n";
+    ss << "    local mathtype = math.type\n";
+    if (target == Target::LuaJIT) {
+        ss << "    local bitlib = bit or require('bit')\n";
+    } else if (target == Target::Luau) {
+        ss << "    local bitlib = bit32\n";
+    }
+    ss << "    local env, exec, materialize\n\n";
+
+    ss << "    local function wrap(proto, upvals)\n";
+    ss << "        return function(...) return exec(proto, upvals, ...) end\n";
+    ss << "    end\n\n";
+
+    ss << "    exec = function(proto, upvals, ...)\n";
+    ss << "        local code = proto[1]\n";
+    ss << "        if not code then\n";
+    ss << "            materialize(proto)\n";
+    ss << "            code = proto[1]\n";
+    ss << "        end\n";
+    ss << "        local k, protos = proto[2], proto[3]\n";
+    ss << "        local R = {...}\n";
+    ss << "        local varargs, nvarargs = nil, 0\n";
+    ss << "        if proto[6] then\n";
+    ss << "            nvarargs = select('#', ...) - proto[5]\n";
+    ss << "            if nvarargs > 0 then\n";
+    ss << "                varargs = {select(proto[5] + 1, ...)}\n";
+    ss << "            else\n";
+    ss << "                nvarargs, varargs = 0, {}\n";
+    ss << "            end\n";
+    ss << "        end\n";
+    ss << "        local pc, top = 1, 0\n";
+    ss << "        while true do\n";
+    ss << "            local op, a, b, c = code[pc], code[pc + 1], code[pc + 2], code[pc + 3]\n";
+    ss << "            pc = pc + 4\n";
+    emitTree(*tree, numbering, target, 3, ss);
+    ss << "        end\n";
+    ss << "    end\n\n";
+
+    // Protos are {code, constants, protos, upvalue descriptors, params, vararg, lazy body index, native factory}
+    ss << "    __vm_load = function(reader, globals, fetch)\n";
+    ss << "        env = globals\n";
+    ss << "        local parts = {}\n";
+    ss << "        for piece in reader do parts[#parts + 1] = piece end\n";
+    ss << "        local data, pos = table.concat(parts), 1\n";
+    ss << "        local byte, sub = string.byte, string.sub\n";
+    ss << "        local function int()\n";
+    ss << "            local value, scale = 0, 1\n";
+    ss << "            while true do\n";
+    ss << "                local b = byte(data, pos)\n";
+    ss << "                pos = pos + 1\n";
+    ss << "                if b < 128 then return value + b * scale end\n";
+    ss << "                value = value + (b - 128) * scale\n";
+    ss << "                scale = scale * 128\n";
+    ss << "            end\n";
+    ss << "        end\n";
+    ss << "        local function str()\n";
+    ss << "            local len = int()\n";
+    ss << "            pos = pos + len\n";
+    ss << "            return sub(data, pos - len, pos - 1)\n";
+    ss << "        end\n";
+    if (target != Target::Luau) {
+        ss << "        local function native(source)\n";
+        if (target == Target::Lua54) {
+            ss << "            return assert(load(source, '=', 't', env))\n";
+        } else {
+            ss << "            local f = assert(loadstring(source, '='))\n";
+            ss << "            return setfenv(f, env)\n";
+        }
+        ss << "        end\n";
+    }
+    ss << "        local function body(p)\n";
+    ss << "            local flags\n";
+    ss << "            p[5], flags = int(), int()\n";
+    ss << "            p[6] = flags == 1\n";
+    ss << "            if flags == 2 then p[8] = native(str()) end\n";
+    ss << "            local code, k, protos = {}, {}, {}\n";
+    ss << "            for i = 1, int() do code[i] = int() end\n";
+    ss << "            for i = 1, int() do\n";
+    ss << "                local tag = int()\n";
+    ss << "                if tag == 1 then k[i] = false\n";
+    ss << "                elseif tag == 2 then k[i] = true\n";
+    ss << "                elseif tag == 3 then k[i] = tonumber(str())\n";
+    ss << "                elseif tag == 4 then k[i] = str() end\n";
+    ss << "            end\n";
+    ss << "            for i = 1, int() do\n";
+    ss << "                local child, up = {}, {}\n";
+    if (bodies) {
+        ss << "                child[7] = int()\n";
+        ss << "                if child[7] == 0 then body(child) end\n";
+    } else {
+        ss << "                body(child)\n";
+    }
+    ss << "                for j = 1, int() * 2 do up[j] = int() end\n";
+    ss << "                child[4] = up\n";
+    ss << "                protos[i] = child\n";
+    ss << "            end\n";
+    ss << "            p[1], p[2], p[3] = code, k, protos\n";
+    ss << "            return p\n";
+    ss << "        end\n";
+    // Only reached from exec, after the main body has been read, so the reader state can be reused
+    ss << "        materialize = function(p)\n";
+    ss << "            data, pos = fetch(p[7]), 1\n";
+    ss << "            body(p)\n";
+    ss << "            data = nil\n";
+    ss << "        end\n";
+    ss << "        local main = body({})\n";
+    ss << "        data = nil\n";
+    ss << "        return wrap(main, {})\n";
+    ss << "    end\n";
+    ss << "end\n\n";
+    return ss.str();
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <sstream>
+#include "Bytecode.hpp"
+#include "../Target.hpp"
+
+// Emits the Lua interpreter for a compiled program together with its serialized bytecode
+class BytecodeInterpreter {
+public:
+    struct Stats {
+        size_t functions = 0;
+        size_t instructions = 0;
+        size_t fused = 0;
+        size_t natives = 0;
+        size_t opcodes = 0;
+        double dispatchDepth = 0;
+    };
+
+    // Returns Lua source defining __vm_load(reader, env, fetch); `program` receives the bytes the reader must yield.
+    // With `bodies`, nested functions are stored there instead and fetch(i) must return bodies[i] on first call.
+    // Throws when the program uses an operator the target runtime lacks.
+    static std::string generate(const Proto& main, std::string& program, std::vector<std::string>* bodies, Target::Kind target, Stats& stats);
+
+private:
+    struct Node {
+        double weight = 0;
+        int op = -1;
+        std::unique_ptr<Node> left;
+        std::unique_ptr<Node> right;
+    };
+
+    static void countOps(const Proto& proto, std::vector<double>& weights, Stats& stats);
+    static std::unique_ptr<Node> buildTree(const std::vector<double>& weights, std::mt19937& gen);
+    static void numberLeaves(Node& node, std::vector<int>& numbering, int& next, int depth, double& weightedDepth);
+    static int firstLeaf(const Node& node, const std::vector<int>& numbering);
+    static void emitTree(const Node& node, const std::vector<int>& numbering, Target::Kind target, int indent, std::stringstream& ss);
+    static std::string handler(Opcode op, Target::Kind target);
+    static void writeInt(std::string& out, long long value);
+    static void serialize(const Proto& proto, const std::vector<int>& numbering, std::string& out, std::vector<std::string>* bodies);
+};
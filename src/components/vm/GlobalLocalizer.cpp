@@ -0,0 +1,151 @@
+#include "GlobalLocalizer.hpp"
+
+// Library tables and builtins that programs read but almost never replace; print and require are left alone
+// because hosts commonly swap them after a script is loaded
+const std::set<std::string> GlobalLocalizer::CANDIDATES = {
+    "math", "string", "table", "coroutine", "utf8", "os", "io", "bit", "bit32",
+    "assert", "error", "getmetatable", "setmetatable", "ipairs", "pairs", "next", "pcall", "xpcall",
+    "rawequal", "rawget", "rawlen", "rawset", "select", "tonumber", "tostring", "type", "unpack",
+};
+
+GlobalLocalizer::Report GlobalLocalizer::localize(Block& chunk) {
+    Report report;
+    GlobalLocalizer localizer;
+    localizer.visitBlock(chunk);
+
+    if (localizer.dynamicEnv) {
+        report.skipped = "chunk changes its environment or writes globals by computed name";
+        return report;
+    }
+
+    size_t topLocals = 0;
+    for (const auto& stat : chunk.stats) {
+        if (stat->kind == StatKind::Local || stat->kind == StatKind::LocalFunction) topLocals += stat->names.size();
+    }
+
+    for (const auto& [name, count] : localizer.reads) {
+        if (!CANDIDATES.count(name) || localizer.writes.count(name)) continue;
+        // Lua allows 200 active locals per function; leave the chunk's own declarations room
+        if (topLocals + report.names.size() >= MAX_LOCALS) {
+            report.skipped = "too many locals in the main chunk";
+            break;
+        }
+        report.names.push_back(name);
+        report.reads += count;
+    }
+    if (report.names.empty()) return report;
+
+    auto decl = std::make_shared<Stat>(StatKind::Local);
+    for (const auto& name : report.names) {
+        decl->names.push_back(name);
+        decl->attribs.push_back("");
+        auto value = std::make_shared<Expr>(ExprKind::Name);
+        value->value = name;
+        decl->exprs.push_back(value);
+    }
+    chunk.stats.insert(chunk.stats.begin(), decl);
+    return report;
+}
+
+bool GlobalLocalizer::isGlobal(const std::string& name) const {
+    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+        if (it->count(name)) return false;
+    }
+    return true;
+}
+
+void GlobalLocalizer::declare(const std::string& name) {
+    scopes.back().insert(name);
+}
+
+void GlobalLocalizer::visitBlock(const Block& block, const std::vector<std::string>& locals) {
+    scopes.emplace_back(locals.begin(), locals.end());
+    for (const auto& stat : block.stats) {
+        visitStat(*stat);
+    }
+    scopes.pop_back();
+}
+
+void GlobalLocalizer::visitFunction(const Function& func) {
+    visitBlock(*func.body, func.params);
+}
+
+void GlobalLocalizer::visitStat(const Stat& stat) {
+    switch (stat.kind) {
+        case StatKind::Local:
+            for (const auto& expr : stat.exprs) visitExpr(*expr);
+            for (const auto& name : stat.names) declare(name);
+            return;
+        case StatKind::LocalFunction:
+            declare(stat.names[0]);
+            visitFunction(*stat.func);
+            return;
+        case StatKind::Function:
+            visitTarget(*stat.targets[0]);
+            visitFunction(*stat.func);
+            return;
+        case StatKind::Assign:
+            for (const auto& target : stat.targets) visitTarget(*target);
+            for (const auto& expr : stat.exprs) visitExpr(*expr);
+            return;
+        case StatKind::NumericFor:
+        case StatKind::GenericFor:
+            for (const auto& expr : stat.exprs) visitExpr(*expr);
+            visitBlock(*stat.blocks[0], stat.names);
+            return;
+        case StatKind::Repeat:
+            // The condition sees the body's locals
+            scopes.emplace_back();
+            for (const auto& inner : stat.blocks[0]->stats) visitStat(*inner);
+            visitExpr(*stat.exprs[0]);
+            scopes.pop_back();
+            return;
+        default:
+            for (const auto& expr : stat.exprs) visitExpr(*expr);
+            if (stat.expr) visitExpr(*stat.expr);
+            for (const auto& block : stat.blocks) visitBlock(*block);
+            return;
+    }
+}
+
+void GlobalLocalizer::visitTarget(const Expr& target) {
+    if (target.kind == ExprKind::Name) {
+        if (isGlobal(target.value)) writes.insert(target.value);
+        return;
+    }
+    // _G.name = value replaces the global as well
+    if (target.kind == ExprKind::Index && target.lhs->kind == ExprKind::Name && target.lhs->value == "_G") {
+        if (target.rhs->kind == ExprKind::String) writes.insert(target.rhs->value);
+        else dynamicEnv = true;
+    }
+    visitExpr(target);
+}
+
+void GlobalLocalizer::visitExpr(const Expr& expr) {
+    switch (expr.kind) {
+        case ExprKind::Name:
+            if (expr.value == "_ENV" || expr.value == "setfenv") dynamicEnv = true;
+            if (isGlobal(expr.value)) ++reads[expr.value];
+            return;
+        case ExprKind::Function:
+            visitFunction(*expr.func);
+            return;
+        case ExprKind::Call:
+            // rawset(_G, "name", value)
+            if (expr.lhs->kind == ExprKind::Name && expr.lhs->value == "rawset" && expr.args.size() >= 2 &&
+                expr.args[0]->kind == ExprKind::Name && expr.args[0]->value == "_G" && expr.args[1]->kind == ExprKind::String) {
+                writes.insert(expr.args[1]->value);
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (expr.lhs) visitExpr(*expr.lhs);
+    if (expr.rhs) visitExpr(*expr.rhs);
+    for (const auto& arg : expr.args) visitExpr(*arg);
+    for (const auto& field : expr.fields) {
+        if (field.key) visitExpr(*field.key);
+        visitExpr(*field.value);
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "../parser/LuaAst.hpp"
+
+// Turns reads of standard library globals into reads of upvalue locals declared at the top of the chunk.
+// A name is only localized when the chunk never assigns it, so the snapshot taken at load time stays current.
+class GlobalLocalizer {
+public:
+    struct Report {
+        std::vector<std::string> names;
+        size_t reads = 0;
+        std::string skipped;
+    };
+
+    static Report localize(Block& chunk);
+
+private:
+    static const std::set<std::string> CANDIDATES;
+    static constexpr size_t MAX_LOCALS = 150;
+
+    std::vector<std::set<std::string>> scopes;
+    std::map<std::string, size_t> reads;
+    std::set<std::string> writes;
+    bool dynamicEnv = false;
+
+    bool isGlobal(const std::string& name) const;
+    void declare(const std::string& name);
+    void visitBlock(const Block& block, const std::vector<std::string>& locals = {});
+    void visitFunction(const Function& func);
+    void visitStat(const Stat& stat);
+    void visitExpr(const Expr& expr);
+    void visitTarget(const Expr& target);
+};
@@ -6,10 +6,16 @@
 #include <map>
 #include <random>
 #include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <bitset>
 #include "LuaObfuscator.hpp"
+#include "components/Autotune.hpp"
 #include "components/Logger.hpp"
+#include "components/PayloadCompressor.hpp"
+#include "components/Target.hpp"
+#include "components/protections/Compression.hpp"
 #include <chrono>
 
 void printUsage() {
@@ -17,6 +23,13 @@ void printUsage() {
               << "Usage: obfuscator <command> [options]\n\n"
               << "Commands:\n"
               << "  obfuscate <input_file> <output_file> [options]\n"
+              << "  minify <input_file> <output_file>\n"
+              << "  compress <input_file> <output_file> [--level 1-9] [--target name]\n"
+              << "      Writes a chunk returning a function that decompresses the input, for measuring match-finder levels\n"
+              << "  calibrate <output_file> [--target name]\n"
+              << "      Measures the cost model rates on the embedded Lua, or writes the benchmark to run on the target\n"
+              << "  autotune <output_ini> <input_files...> [--objective size|load|run|total|balanced] [--runs n] [options]\n"
+              << "      Searches chunk sizes and VM state table sizes on the inputs and writes config.ini with the best ones\n"
               << "Options:\n"
               << "  --strings      Encrypt strings\n"
               << "  --no-strings   Disable string encryption\n"
@@ -24,27 +37,133 @@ void printUsage() {
               << "  --no-junk     Disable junk code\n"
               << "  --vm          Apply VM wrapper\n"
               << "  --no-vm       Disable VM wrapper\n"
+              << "  --flow        Flatten control flow of each function\n"
               << "  --all         Apply all obfuscation techniques\n"
-              << "  --chunk-size  Configure array chunk size\n";
+              << "  --target      Runtime to emit for: lua54 (also 5.3), lua51, luajit, luau\n"
+              << "  --bytecode    Write a binary chunk compiled by the embedded Lua compiler\n"
+              << "  --chunk-size  Configure array chunk size\n"
+              << "  --profile     Runtime profile from tools/profile.lua; hot functions get light protection\n"
+              << "  --compression-report  Obfuscate at every [Compression] level and print time, size and unpack cost\n"
+              << "  --max-slowdown  Strongest settings whose estimated run+load time stays within this factor, e.g. 1.15\n"
+              << "  --dry-run     Print the cost model estimate for each protection instead of writing the output\n";
 }
 
 int main(int argc, char* argv[]) {
+    std::string command = argc > 1 ? argv[1] : "";
+    if (command == "calibrate" && argc >= 3) {
+        LuaObfuscator obfuscator;
+        if (!obfuscator.loadConfig("config.ini")) return 1;
+        for (int i = 3; i + 1 < argc; i += 2) {
+            std::string flag = argv[i];
+            if (flag == "--target") {
+                obfuscator.setConfigValue("Output", "target", argv[i + 1]);
+            } else {
+                Logger::warning("Unknown flag: " + flag);
+            }
+        }
+        if (!obfuscator.calibrate(argv[2])) return 1;
+        if (!obfuscator.saveToFile(argv[2])) {
+            Logger::error("Failed to save output file: " + std::string(argv[2]));
+            return 1;
+        }
+        return 0;
+    }
+
+    if (command == "autotune" && argc >= 4) {
+        std::vector<std::string> corpus;
+        Autotune::Options options;
+        for (int i = 3; i < argc; i++) {
+            std::string flag = argv[i];
+            if (flag.compare(0, 2, "--") != 0) {
+                corpus.push_back(flag);
+            } else if (flag == "--all") {
+                options.useStrings = options.useJunk = options.useVM = options.useFlow = true;
+            } else if (flag == "--strings") {
+                options.useStrings = true;
+            } else if (flag == "--junk") {
+                options.useJunk = true;
+            } else if (flag == "--vm") {
+                options.useVM = true;
+            } else if (flag == "--flow") {
+                options.useFlow = true;
+            } else if (flag == "--objective" && i + 1 < argc) {
+                options.objective = argv[++i];
+            } else if (flag == "--target" && i + 1 < argc) {
+                options.target = argv[++i];
+            } else if (flag == "--profile" && i + 1 < argc) {
+                options.profile = argv[++i];
+            } else if (flag == "--runs" && i + 1 < argc) {
+                options.runs = std::max(std::atoi(argv[++i]), 1);
+            } else {
+                Logger::warning("Unknown flag: " + flag);
+            }
+        }
+        if (corpus.empty()) {
+            printUsage();
+            return 1;
+        }
+        return Autotune::run(argv[2], corpus, options) ? 0 : 1;
+    }
+
     if (argc < 4) {
         printUsage();
         return 1;
     }
 
-    std::string command = argv[1];
-    if (command != "obfuscate") {
+    if (command != "obfuscate" && command != "minify" && command != "compress") {
         std::cout << "Unknown command: " << command << "\n";
         return 1;
     }
 
     std::string inputFile = argv[2];
     std::string outputFile = argv[3];
+
+    if (command == "minify" || command == "compress") {
+        LuaObfuscator obfuscator;
+        obfuscator.loadConfig("config.ini");
+        int level = 6;
+        for (int i = 4; i + 1 < argc; i += 2) {
+            std::string flag = argv[i];
+            if (flag == "--level") {
+                // minify takes a [Compression] level, compress a match-finder level
+                obfuscator.setConfigValue("Compression", "level", argv[i + 1]);
+                level = std::atoi(argv[i + 1]);
+            } else if (flag == "--target") {
+                obfuscator.setConfigValue("Output", "target", argv[i + 1]);
+            } else {
+                Logger::warning("Unknown flag: " + flag);
+            }
+        }
+        if (!obfuscator.loadFile(inputFile)) {
+            Logger::error("Failed to load input file: " + inputFile);
+            return 1;
+        }
+        try {
+            if (command == "minify") {
+                obfuscator.minify();
+            } else {
+                obfuscator.compressPayload(level);
+            }
+        } catch (const std::exception& e) {
+            Logger::error((command == "minify" ? "Minification" : "Compression") + std::string(" failed: ") + e.what());
+            return 1;
+        }
+        if (!obfuscator.saveToFile(outputFile)) {
+            Logger::error("Failed to save output file: " + outputFile);
+            return 1;
+        }
+        return 0;
+    }
     bool useStrings = false;
     bool useJunk = false;
     bool useVM = false;
+    bool useFlow = false;
+    std::string target;
+    std::string profile;
+    bool bytecode = false;
+    bool compressionReport = false;
+    bool dryRun = false;
+    std::string maxSlowdown;
 
     Logger::debug("Parsing command line arguments...");
     for (int i = 4; i < argc; i++) {
@@ -52,7 +171,7 @@ int main(int argc, char* argv[]) {
         Logger::debug("Processing flag: " + flag);
         
         if (flag == "--all") {
-            useStrings = useJunk = useVM = true;
+            useStrings = useJunk = useVM = useFlow = true;
             Logger::debug("Enabled all features");
         } else if (flag == "--strings") {
             useStrings = true;
@@ -63,6 +182,23 @@ int main(int argc, char* argv[]) {
         } else if (flag == "--vm") {
             useVM = true;
             Logger::debug("Enabled VM protection");
+        } else if (flag == "--flow") {
+            useFlow = true;
+            Logger::debug("Enabled control flow flattening");
+        } else if (flag == "--bytecode") {
+            bytecode = true;
+            Logger::debug("Enabled binary chunk output");
+        } else if (flag == "--compression-report") {
+            compressionReport = true;
+        } else if (flag == "--target" && i + 1 < argc) {
+            target = argv[++i];
+            Logger::debug("Target runtime: " + target);
+        } else if (flag == "--profile" && i + 1 < argc) {
+            profile = argv[++i];
+        } else if (flag == "--max-slowdown" && i + 1 < argc) {
+            maxSlowdown = argv[++i];
+        } else if (flag == "--dry-run") {
+            dryRun = true;
         } else {
             Logger::warning("Unknown flag: " + flag);
         }
@@ -70,7 +206,12 @@ int main(int argc, char* argv[]) {
 
     Logger::debug("Features enabled - Strings: " + std::string(useStrings ? "yes" : "no") + 
                  ", Junk: " + std::string(useJunk ? "yes" : "no") + 
-                 ", VM: " + std::string(useVM ? "yes" : "no"));
+                 ", VM: " + std::string(useVM ? "yes" : "no") +
+                 ", Flow: " + std::string(useFlow ? "yes" : "no"));
+
+    if (compressionReport && !Compression::levelReport(inputFile, useStrings, useJunk, useVM, useFlow, target, bytecode, profile)) {
+        return 1;
+    }
 
     LuaObfuscator obfuscator;
     
@@ -78,14 +219,37 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    if (!target.empty()) {
+        obfuscator.setConfigValue("Output", "target", target);
+    }
+    if (bytecode) {
+        obfuscator.setConfigValue("Output", "format", "bytecode");
+    }
+    if (!profile.empty()) {
+        obfuscator.setConfigValue("Profile", "file", profile);
+    }
+    if (!maxSlowdown.empty()) {
+        obfuscator.setConfigValue("CostModel", "max_slowdown", maxSlowdown);
+    }
+
     if (!obfuscator.loadFile(inputFile)) {
         Logger::error("Failed to load input file: " + inputFile);
         return 1;
     }
 
+    if (dryRun) {
+        try {
+            std::cout << obfuscator.estimate(useStrings, useJunk, useVM, useFlow);
+        } catch (const std::exception& e) {
+            Logger::error("Cost estimate failed: " + std::string(e.what()));
+            return 1;
+        }
+        return 0;
+    }
+
     auto start = std::chrono::high_resolution_clock::now();
     
-    obfuscator.obfuscate(useStrings, useJunk, useVM);
+    obfuscator.obfuscate(useStrings, useJunk, useVM, useFlow);
     
     auto end = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
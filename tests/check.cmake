@@ -0,0 +1,32 @@
+# Obfuscates SCRIPT with FLAGS (comma separated) for TARGET and checks the output: it must carry no --@obf
+# annotations, and when LUA names an interpreter it must print what the original prints and raise where it raises.
+string(REPLACE "," ";" FLAGS "${FLAGS}")
+execute_process(
+    COMMAND ${OBFUSCATOR} obfuscate ${SCRIPT} ${OUTPUT} ${FLAGS} --target ${TARGET}
+    RESULT_VARIABLE result
+    OUTPUT_VARIABLE log
+    ERROR_VARIABLE log
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "Obfuscation failed:\n${log}")
+endif()
+
+file(READ ${OUTPUT} obfuscated)
+string(FIND "${obfuscated}" "@obf" annotation)
+if(NOT annotation EQUAL -1)
+    message(FATAL_ERROR "Output keeps an annotation: ${OUTPUT}")
+endif()
+
+if(LUA)
+    execute_process(COMMAND ${LUA} ${SCRIPT} RESULT_VARIABLE expectedResult OUTPUT_VARIABLE expected ERROR_VARIABLE expectedError)
+    execute_process(COMMAND ${LUA} ${OUTPUT} RESULT_VARIABLE result OUTPUT_VARIABLE actual ERROR_VARIABLE error)
+    if(expectedResult EQUAL 0 AND NOT result EQUAL 0)
+        message(FATAL_ERROR "Obfuscated script failed:\n${error}")
+    endif()
+    if(NOT expectedResult EQUAL 0 AND result EQUAL 0)
+        message(FATAL_ERROR "Obfuscated script finished where the original failed:\n${expectedError}")
+    endif()
+    if(NOT actual STREQUAL expected)
+        message(FATAL_ERROR "Output differs.\nExpected:\n${expected}\nActual:\n${actual}")
+    endif()
+endif()
@@ -0,0 +1,54 @@
+local log = {}
+local count = 0
+
+--@obf:none
+local function plain(s)
+    count = count + 1
+    return "plain:" .. s
+end
+
+--@obf:fast
+local function quick(n)
+    local t = 0
+    for i = 1, n do t = t + i end
+    return t, "quick"
+end
+
+--@obf:max
+local function guarded(key)
+    local secret = "secret-value"
+    if key == "open" then
+        count = count + 10
+        return secret
+    end
+    return "denied"
+end
+
+local function normal(x)
+    local inner = --[[@obf:max]] function(y) return "inner" .. y end
+    return inner(x) .. "|normal"
+end
+
+--@obf:none
+do
+    local function helper() return "in-none-block" end
+    log[#log + 1] = helper()
+    --@obf:max
+    local function deep() count = count + 100; return "deep-max" end
+    log[#log + 1] = deep()
+end
+
+local function hot(n)
+    local s = 0
+    for i = 1, n do s = s + i % 7 end
+    return s
+end
+
+log[#log + 1] = plain("a")
+log[#log + 1] = select(2, quick(10)) .. quick(100)
+log[#log + 1] = guarded("open")
+log[#log + 1] = guarded("x")
+log[#log + 1] = normal(5)
+log[#log + 1] = hot(20000)
+log[#log + 1] = count
+print(table.concat(log, ","))
@@ -0,0 +1,9 @@
+local co, main = coroutine.running()
+print(type(co), main, coroutine.isyieldable())
+
+local function inside()
+    local _, nested = coroutine.running()
+    return nested, coroutine.isyieldable()
+end
+print(inside())
+print(coroutine.wrap(inside)())
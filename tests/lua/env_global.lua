@@ -0,0 +1,3 @@
+print(_ENV == _G)
+answer = 42
+print(_ENV.answer, _G.answer)
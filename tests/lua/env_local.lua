@@ -0,0 +1,6 @@
+local print = print
+local _ENV = {value = "sandboxed"}
+
+counter = 1
+counter = counter + 1
+print(value, counter)
@@ -0,0 +1,15 @@
+local hex = "\x42\x43"
+local skip = "a\z   b"
+local utf8 = "\u{48}\u{49}"
+print(hex, skip, utf8, #hex + #skip + #utf8)
+
+local seen = {}
+for _, s in ipairs({hex, skip, utf8}) do seen[#seen + 1] = s:byte(1) end
+print(table.concat(seen, " "))
+
+-- Lua 5.1 reads "\x41" as "x41", so the key must not be shortened to t.A for it
+local t = {x41 = "x41", A = "A"}
+print(t["\x41"])
+
+-- Past U+10FFFF Lua 5.4 writes five and six byte sequences
+for _, s in ipairs({"\u{E9}", "\u{10FFFF}", "\u{200000}", "\u{7FFFFFFF}"}) do print(s:byte(1, -1)) end
@@ -0,0 +1,21 @@
+local function fib(n)
+    if n < 2 then return n end
+    return fib(n - 1) + fib(n - 2)
+end
+
+local function label(x)
+    local names = {"zero", "one", "two"}
+    return "v:" .. (names[x] or "many")
+end
+
+local function setup()
+    local t = {}
+    for i = 1, 10 do t[i] = label(i % 4) end
+    return table.concat(t, ",")
+end
+
+print(setup())
+print(fib(18))
+local last
+for i = 1, 500 do last = label(i % 3) end
+print(last)
@@ -0,0 +1,9 @@
+local function depth(n)
+    if n == 0 then return 0 end
+    return 1 + depth(n - 1)
+end
+print(depth(2000))
+
+-- Past the stack of every runtime: the error has to reach the host as it does natively
+print(depth(10000000))
+print("not reached")
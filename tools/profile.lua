@@ -0,0 +1,74 @@
+-- Runtime profile of a script for `obfuscator --profile`: call counts and instruction samples per function.
+-- Usage: lua tools/profile.lua <script.lua> <profile output> [period] [script args...]
+-- A count hook samples the running function every `period` VM instructions (1000 by default) and a call hook counts
+-- calls; coroutines created by the script are hooked too. Only functions of the profiled script are written, one
+-- `<name> <first line> <last line> <calls> <hits>` line each, hottest first.
+
+local path, output, period = arg[1], arg[2], tonumber(arg[3]) or 1000
+if not path or not output then
+    io.stderr:write("usage: lua tools/profile.lua <script.lua> <profile output> [period] [script args...]\n")
+    os.exit(1)
+end
+
+local loadstring = loadstring or load
+local file = assert(io.open(path, "rb"))
+local source = file:read("*a")
+file:close()
+
+local chunkname = "@" .. path
+local main = assert(loadstring(source, chunkname))
+local stats = {}
+
+local function record(level, field)
+    local info = debug.getinfo(level + 1, "Sn")
+    if not info or info.source ~= chunkname or info.what == "main" then return end
+    local key = info.linedefined .. ":" .. info.lastlinedefined
+    local entry = stats[key]
+    if not entry then
+        entry = { first = info.linedefined, last = info.lastlinedefined, calls = 0, hits = 0 }
+        stats[key] = entry
+    end
+    if not entry.name and info.name then entry.name = info.name end
+    entry[field] = entry[field] + 1
+end
+
+local function hook(event)
+    if event == "count" then
+        record(2, "hits")
+    elseif event == "call" or event == "tail call" then
+        record(2, "calls")
+    end
+end
+
+-- Hooks are per coroutine, so every coroutine the script creates gets its own
+local create, wrap = coroutine.create, coroutine.wrap
+local function hooked(f)
+    return function(...)
+        debug.sethook(hook, "c", period)
+        return f(...)
+    end
+end
+coroutine.create = function(f) return create(hooked(f)) end
+coroutine.wrap = function(f) return wrap(hooked(f)) end
+
+debug.sethook(hook, "c", period)
+local ok, err = pcall(main, select(4, ...))
+debug.sethook()
+coroutine.create, coroutine.wrap = create, wrap
+if not ok then io.stderr:write("script failed, profile is partial: " .. tostring(err) .. "\n") end
+
+local entries = {}
+for _, entry in pairs(stats) do entries[#entries + 1] = entry end
+table.sort(entries, function(a, b)
+    if a.hits ~= b.hits then return a.hits > b.hits end
+    return a.first < b.first
+end)
+
+local out = assert(io.open(output, "w"))
+out:write("# ", path, "\n")
+out:write("period ", period, "\n")
+for _, entry in ipairs(entries) do
+    out:write(string.format("%s %d %d %d %d\n", entry.name or "?", entry.first, entry.last, entry.calls, entry.hits))
+end
+out:close()
+print(string.format("%d functions profiled, written to %s", #entries, output))